@@ -1,7 +1,9 @@
 
 #include "asn1common.h"
+#include "asn1arena.h"
 #include "asn1type.h"
 #include "asn1rawdata.h"
+#include "asn1constdata.h"
 #include "asn1object.h"
 #include "asn1integer.h"
 #include "asn1octetstring.h"
@@ -0,0 +1,44 @@
+
+#include "../libsiaecard.h"
+#include "asn1arena.h"
+
+#define ARENA_ALIGN(cb)		(((cb) + sizeof(double) - 1) & ~(unsigned long)(sizeof(double) - 1))
+
+CAsn1Arena::CAsn1Arena() {
+	this->m_pBlocks = NULL;
+	this->m_pbFree = m_Inline.b;
+	this->m_cbFree = sizeof(m_Inline.b);
+}
+
+CAsn1Arena::~CAsn1Arena() {
+	Reset();
+}
+
+void CAsn1Arena::Reset() {
+	while(m_pBlocks) {
+		Block* pNext = m_pBlocks->pNext;
+		delete[] (unsigned char*) m_pBlocks;
+		m_pBlocks = pNext;
+	}
+	m_pbFree = m_Inline.b;
+	m_cbFree = sizeof(m_Inline.b);
+}
+
+void* CAsn1Arena::Alloc(unsigned long cb) {
+	cb = ARENA_ALIGN(cb);
+	if(cb > m_cbFree) {
+		// le richieste grandi hanno un blocco proprio, il blocco corrente resta in uso
+		int bOwn = (cb > ASN1_ARENA_BLOCK/4);
+		unsigned long cbBlock = bOwn ? cb : ASN1_ARENA_BLOCK;
+		Block* pBlock = (Block*) new unsigned char[sizeof(Block) + cbBlock];
+		pBlock->pNext = m_pBlocks;
+		m_pBlocks = pBlock;
+		if(bOwn) return pBlock + 1;
+		m_pbFree = (unsigned char*) (pBlock + 1);
+		m_cbFree = cbBlock;
+	}
+	void* pv = m_pbFree;
+	m_pbFree += cb;
+	m_cbFree -= cb;
+	return pv;
+}
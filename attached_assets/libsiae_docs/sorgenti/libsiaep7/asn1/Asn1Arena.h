@@ -0,0 +1,25 @@
+/*
+	Memoria per gli oggetti ASN.1 di una codifica: le richieste sono servite
+	in sequenza da blocchi contigui e liberate tutte insieme dal distruttore
+	(o da Reset). I primi ASN1_ARENA_INLINE byte stanno nell'oggetto stesso,
+	per cui una SignedData tipica non fa nessuna allocazione.
+*/
+#define ASN1_ARENA_INLINE			2048
+#define ASN1_ARENA_BLOCK			8192
+
+class CAsn1Arena {
+private:
+	struct Block { Block* pNext; double align; };
+	Block*		m_pBlocks;
+	unsigned char*		m_pbFree;
+	unsigned long		m_cbFree;
+	union { double align; void* p; unsigned char b[ASN1_ARENA_INLINE]; } m_Inline;
+	CAsn1Arena(const CAsn1Arena&);
+	CAsn1Arena& operator=(const CAsn1Arena&);
+
+public:
+	CAsn1Arena();
+	~CAsn1Arena();
+	void*		Alloc(unsigned long cb);
+	void		Reset();
+};
@@ -0,0 +1,49 @@
+
+/*
+	Codifiche DER costanti usate da SignDataML. Gli archi degli OID sono
+	scritti in decimale e convertiti in base 128 dalle macro ASN1_ARCn
+	(n = byte occupati), per cui gli array sono calcolati dal compilatore.
+*/
+#define ASN1_ARC2(n)		(unsigned char)(0x80|((n)>>7)), (unsigned char)((n)&0x7F)
+#define ASN1_ARC3(n)		(unsigned char)(0x80|((n)>>14)), (unsigned char)(0x80|(((n)>>7)&0x7F)), (unsigned char)((n)&0x7F)
+#define ASN1_ARC12(a,b)		(unsigned char)((a)*40+(b))
+
+#define DER_OID						0x06
+#define DER_NULL_VALUE				0x05, 0x00
+#define DER_OCTETS					0x04
+#define DER_SEQ						0x30
+#define DER_SET_OF					0x31
+
+// prefissi comuni, con il numero di byte
+#define ARCS_RSADSI		ASN1_ARC12(1,2), ASN1_ARC2(840), ASN1_ARC3(113549)		// 1.2.840.113549 (6)
+#define ARCS_OIWSECSIG	ASN1_ARC12(1,3), 14, 3, 2									// 1.3.14.3.2 (4)
+#define ARCS_NISTHASH	ASN1_ARC12(2,16), ASN1_ARC2(840), 1, 101, 3, 4, 2		// 2.16.840.1.101.3.4.2 (8)
+
+// OID
+static const unsigned char Asn1OidData[] = { DER_OID, 9, ARCS_RSADSI, 1, 7, 1 };
+static const unsigned char Asn1OidSignedData[] = { DER_OID, 9, ARCS_RSADSI, 1, 7, 2 };
+static const unsigned char Asn1OidContentType[] = { DER_OID, 9, ARCS_RSADSI, 1, 9, 3 };
+static const unsigned char Asn1OidMessageDigest[] = { DER_OID, 9, ARCS_RSADSI, 1, 9, 4 };
+static const unsigned char Asn1OidSigningTime[] = { DER_OID, 9, ARCS_RSADSI, 1, 9, 5 };
+static const unsigned char Asn1OidSigningCertificateV2[] = { DER_OID, 11, ARCS_RSADSI, 1, 9, 16, 2, 47 };
+
+// AlgorithmIdentifier: sha1 e rsaEncryption con parametri NULL, sha256 senza (RFC 5754)
+static const unsigned char Asn1AlgSha1[] = { DER_SEQ, 9, DER_OID, 5, ARCS_OIWSECSIG, 26, DER_NULL_VALUE };
+static const unsigned char Asn1AlgSha256[] = { DER_SEQ, 11, DER_OID, 9, ARCS_NISTHASH, 1 };
+static const unsigned char Asn1AlgRsaEncryption[] = { DER_SEQ, 13, DER_OID, 9, ARCS_RSADSI, 1, 1, 1, DER_NULL_VALUE };
+
+// DigestInfo (PKCS#1) senza l'impronta, che va accodata
+static const unsigned char Asn1DigestInfoSha1[] = { DER_SEQ, 33, DER_SEQ, 9, DER_OID, 5, ARCS_OIWSECSIG, 26, DER_NULL_VALUE, DER_OCTETS, 20 };
+static const unsigned char Asn1DigestInfoSha256[] = { DER_SEQ, 49, DER_SEQ, 13, DER_OID, 9, ARCS_NISTHASH, 1, DER_NULL_VALUE, DER_OCTETS, 32 };
+
+// attributo SMIMECapabilities: des-ede3-cbc, des-cbc, sha1WithRSAEncryption o sha256WithRSAEncryption
+#define ASN1_ATTR_SMIME_CAPS(sigalg) { \
+	DER_SEQ, 49, \
+		DER_OID, 9, ARCS_RSADSI, 1, 9, 15, \
+		DER_SET_OF, 36, \
+			DER_SEQ, 34, \
+				DER_SEQ, 10, DER_OID, 8, ARCS_RSADSI, 3, 7, \
+				DER_SEQ, 7, DER_OID, 5, ARCS_OIWSECSIG, 7, \
+				DER_SEQ, 11, DER_OID, 9, ARCS_RSADSI, 1, 1, sigalg }
+static const unsigned char Asn1AttrSmimeCapsSha1[] = ASN1_ATTR_SMIME_CAPS(5);
+static const unsigned char Asn1AttrSmimeCapsSha256[] = ASN1_ATTR_SMIME_CAPS(11);
@@ -0,0 +1,10 @@
+
+/*
+	Frammento DER costante (tipicamente uno degli array di asn1const.h):
+	non viene copiato, la codifica e' una memcpy.
+*/
+class CAsn1ConstData : public CAsn1RawData {
+public:
+	template<size_t N> CAsn1ConstData(const unsigned char (&rgbData)[N]) : CAsn1RawData(rgbData, (unsigned long)N, FALSE) {}
+	CAsn1ConstData(const unsigned char* pbData, unsigned long cbData) : CAsn1RawData(pbData, cbData, FALSE) {}
+};
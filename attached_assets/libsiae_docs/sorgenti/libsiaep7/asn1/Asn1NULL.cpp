@@ -11,7 +11,6 @@ CAsn1NULL::CAsn1NULL() : CAsn1Type() {
 	this->m_dwEncodedDataLength = 0;
 }
 
-int CAsn1NULL::PutData(unsigned char* pbDest) {
-	static unsigned long count = 0;
-	return TRUE;
+unsigned char* CAsn1NULL::PutData(unsigned char* pbDest) {
+	return pbDest;
 }
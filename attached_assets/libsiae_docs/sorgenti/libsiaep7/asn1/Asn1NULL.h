@@ -1,7 +1,7 @@
 
 class CAsn1NULL : public CAsn1Type {
 private:
-	int PutData(unsigned char* pbDest);
+	unsigned char* PutData(unsigned char* pbDest);
 public:
 	CAsn1NULL();
 };
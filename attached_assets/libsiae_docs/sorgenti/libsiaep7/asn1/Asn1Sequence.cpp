@@ -4,44 +4,50 @@
 #include "asn1type.h"
 #include "asn1sequence.h"
 
-CAsn1Sequence::CAsn1Sequence(unsigned long dwSize) : CAsn1Type() {
+CAsn1Sequence::CAsn1Sequence(unsigned long dwSize, CAsn1Arena* pArena) : CAsn1Type() {
+	this->m_pArena = pArena;
 	this->m_bClass = TC_UNIVERSAL;
 	this->m_bConstructed = TRUE;
 	this->m_dwTag = ASN1_SEQUENCE;
-	this->m_rgData = new CAsn1Type*[dwSize];
+	this->m_rgData = (CAsn1Type**) AllocData(dwSize*sizeof(CAsn1Type*));
 	this->m_dwEncodedDataLength = 0;
 	this->m_dwSize = dwSize;
 	this->m_dwFill = 0;
 }
 
 CAsn1Sequence::~CAsn1Sequence() {
-	delete[] this->m_rgData;
+	FreeData(this->m_rgData);
 }
 
 void CAsn1Sequence::Resize(unsigned long dwNewSize) {
 	if(dwNewSize > m_dwSize) {
-		CAsn1Type** ppTmp = new CAsn1Type*[dwNewSize];
+		CAsn1Type** ppTmp = (CAsn1Type**) AllocData(dwNewSize*sizeof(CAsn1Type*));
 		if(!ppTmp) return;
 		memcpy(ppTmp, m_rgData, m_dwFill*sizeof(CAsn1Type*));
-		delete[] m_rgData; m_rgData = ppTmp;
+		FreeData(m_rgData); m_rgData = ppTmp;
 	}
 	m_dwSize = dwNewSize;
 }
 
 void CAsn1Sequence::Add(CAsn1Type* pData) {
-	if(m_dwFill == m_dwSize) Resize(m_dwSize + 10);
+	if(m_dwFill == m_dwSize) Resize(m_dwSize*2 + 10);
 	m_rgData[m_dwFill++] = pData;
-	m_dwEncodedDataLength = 0;
+	Attach(pData);
+	if(!m_bDirty) m_dwEncodedDataLength += pData->GetEncodedLength();
+	InvalidateParent();
+}
+
+unsigned long CAsn1Sequence::ComputeDataLength() {
+	unsigned long dwLength = 0;
 	for(UINT i=0;i<m_dwFill;i++) {
-		m_dwEncodedDataLength += m_rgData[i]->GetEncodedLength();
+		dwLength += m_rgData[i]->GetEncodedLength();
 	}
+	return dwLength;
 }
 
-int CAsn1Sequence::PutData(unsigned char* pbDest) {
+unsigned char* CAsn1Sequence::PutData(unsigned char* pbDest) {
 	for(UINT i=0;i<m_dwFill;i++) {
-		if(m_rgData[i]->GetEncoded(pbDest)) 
-			pbDest+=m_rgData[i]->GetEncodedLength();
-		else return FALSE;
+		if(!(pbDest = m_rgData[i]->Encode(pbDest))) return NULL;
 	}	
-	return TRUE;
+	return pbDest;
 }
@@ -4,10 +4,11 @@ private:
 	unsigned long m_dwFill;
 	unsigned long m_dwSize;
 	CAsn1Type** m_rgData;
-	int PutData(unsigned char* pbDest);
+	unsigned char* PutData(unsigned char* pbDest);
+	unsigned long ComputeDataLength();
 
 public:
-	CAsn1Sequence(unsigned long dwSize);
+	CAsn1Sequence(unsigned long dwSize, CAsn1Arena* pArena = NULL);
 	~CAsn1Sequence();
 	void Resize(unsigned long dwNewSize);
 	void Add(CAsn1Type* pData);
@@ -8,14 +8,18 @@ CAsn1Tagged::CAsn1Tagged(CAsn1Type* pData, unsigned long dwTag) : CAsn1Type() {
 	this->m_bClass = TC_CONTEXT_SPECIFIC;
 	this->m_dwTag = dwTag;
 	this->m_pData = pData;
-	this->m_dwEncodedDataLength = pData->GetEncodedLength();
+	this->m_dwEncodedDataLength = 0;
+	this->m_bConstructed = TRUE;
+	this->m_bDirty = TRUE;
+	Attach(pData);
+}
+
+unsigned long CAsn1Tagged::ComputeDataLength() {
 	this->m_bConstructed = 
-		(m_pData->IsImplicit()) ? pData->IsConstructed() : TRUE;
+		(m_pData->IsImplicit()) ? m_pData->IsConstructed() : TRUE;
+	return m_pData->GetEncodedLength();
 }
 
-int CAsn1Tagged::PutData(unsigned char* pbDest) {
-	if(m_pData->GetEncoded(pbDest)) 
-			pbDest+=m_dwEncodedDataLength;
-	else return FALSE;
-	return TRUE;
+unsigned char* CAsn1Tagged::PutData(unsigned char* pbDest) {
+	return m_pData->Encode(pbDest);
 }
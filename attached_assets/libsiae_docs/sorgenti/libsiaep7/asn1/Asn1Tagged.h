@@ -2,7 +2,8 @@
 class CAsn1Tagged : public CAsn1Type {
 private:
 	CAsn1Type* m_pData;
-	int PutData(unsigned char* pbDest);
+	unsigned char* PutData(unsigned char* pbDest);
+	unsigned long ComputeDataLength();
 public:
 	CAsn1Tagged(CAsn1Type* pData, unsigned long dwTag);
 };
@@ -1,9 +1,32 @@
 
 #include "../libsiaecard.h"
 #include "asn1common.h"
+#include "asn1arena.h"
 #include "asn1type.h"
 
+void CAsn1Type::Invalidate() {
+	for(CAsn1Type* p = this; p && !p->m_bDirty; p = p->m_pParent) 
+		p->m_bDirty = TRUE;
+}
+
+void* CAsn1Type::AllocData(unsigned long cb) {
+	return (m_pArena) ? m_pArena->Alloc(cb) : new unsigned char[cb];
+}
+
+void CAsn1Type::FreeData(void* pv) {
+	if(!m_pArena) delete[] (unsigned char*) pv;
+}
+
+unsigned long CAsn1Type::GetDataLength() {
+	if(m_bDirty) {
+		m_dwEncodedDataLength = ComputeDataLength();
+		m_bDirty = FALSE;
+	}
+	return m_dwEncodedDataLength;
+}
+
 unsigned long CAsn1Type::GetEncodedLength() {
+	GetDataLength();
 	if(m_bImplicit) return m_dwEncodedDataLength;
 	unsigned long res = ((m_dwTag < 31) ? 1:Asn1Common::PackedDWLength(m_dwTag)) + 1 + 
 		((m_dwEncodedDataLength&0xFFFFFF80) ? Asn1Common::DWLength(m_dwEncodedDataLength):0) + 
@@ -23,7 +46,11 @@ unsigned char* CAsn1Type::PutHeader(unsigned char* pbDest) {
 	return pbDest;
 }
 
+unsigned char* CAsn1Type::Encode(unsigned char* pbDest) {
+	GetDataLength();
+	return PutData((m_bImplicit) ? pbDest : PutHeader(pbDest));
+}
+
 int CAsn1Type::GetEncoded(unsigned char* pbDest) {
-	int retval = PutData((m_bImplicit) ? pbDest : PutHeader(pbDest));
-	return retval;
+	return Encode(pbDest) != NULL;
 }
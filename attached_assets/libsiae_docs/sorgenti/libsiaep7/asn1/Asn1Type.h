@@ -32,6 +32,14 @@
 #define ASN1_UNIVERSALSTRING		28L
 #define ASN1_BMPSTRING					30L
 
+/*
+	Le lunghezze sono calcolate una volta sola: ogni oggetto conosce il
+	contenitore a cui e' stato aggiunto e, quando la sua lunghezza cambia,
+	marca come da ricalcolare (m_bDirty) i contenitori sopra di lui. Un
+	oggetto aggiunto a piu' contenitori deve essere gia' completo.
+*/
+class CAsn1Arena;
+
 class CAsn1Type {
 protected:	
 	unsigned char		m_bClass;
@@ -39,8 +47,20 @@ protected:
 	unsigned long		m_dwEncodedDataLength;
 	int		m_bConstructed;
 	int		m_bImplicit;
-	virtual int PutData(unsigned char* pbDest)=0;
-	CAsn1Type() { m_bImplicit = FALSE; }
+	int		m_bDirty;
+	CAsn1Type*	m_pParent;
+	CAsn1Arena*	m_pArena;		// se NULL i buffer sono allocati con new
+	// scrive il contenuto, ritorna il byte successivo o NULL
+	virtual unsigned char* PutData(unsigned char* pbDest)=0;
+	// lunghezza del contenuto, per i tipi che ne contengono altri
+	virtual unsigned long ComputeDataLength() { return m_dwEncodedDataLength; }
+	unsigned long		GetDataLength();
+	void		Attach(CAsn1Type* pChild) { pChild->m_pParent = this; }
+	void		Invalidate();
+	void		InvalidateParent() { if(m_pParent) m_pParent->Invalidate(); }
+	void*		AllocData(unsigned long cb);
+	void		FreeData(void* pv);
+	CAsn1Type() { m_bImplicit = FALSE; m_bDirty = FALSE; m_pParent = NULL; m_pArena = NULL; }
 
 private:
   unsigned char*		PutHeader(unsigned char* pbDest);
@@ -48,10 +68,11 @@ private:
 public:
 
 	unsigned long		GetEncodedLength();
-	void		SetImplicit() { m_bImplicit = TRUE; }
+	void		SetImplicit() { m_bImplicit = TRUE; InvalidateParent(); }
 	unsigned char		GetClass() { return m_bClass; }
 	unsigned long		GetTag() { return m_dwTag; }
 	int    IsConstructed() { return m_bConstructed; }
 	int		IsImplicit() { return m_bImplicit; }
 	int		GetEncoded(unsigned char* pbDest);
+	unsigned char*		Encode(unsigned char* pbDest);
 };
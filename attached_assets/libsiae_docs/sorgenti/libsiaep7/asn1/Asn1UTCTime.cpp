@@ -30,7 +30,7 @@ CAsn1UTCTime::CAsn1UTCTime(unsigned short wYear, unsigned short wMonth, unsigned
 	memcpy(this->m_chData+10, d[wSecond%60], 2);
 }
 
-int CAsn1UTCTime::PutData(unsigned char* pbDest) {
+unsigned char* CAsn1UTCTime::PutData(unsigned char* pbDest) {
 	memcpy(pbDest, this->m_chData, this->m_dwEncodedDataLength);
-	return TRUE;
+	return pbDest + this->m_dwEncodedDataLength;
 }
@@ -0,0 +1,825 @@
+/*****************************************************************************
+        Emulatore software della carta SIAE (trasporto "emu")
+*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "cardemu.h"
+#include "internals.h"
+#include "sysdep.h"
+#include "sha1.h"
+
+/* Status word restituite dalla carta oltre a quelle definite come C_xxx */
+#define EMU_SW_OK              0x9000
+#define EMU_SW_AUTH_FAILED     0x6300
+#define EMU_SW_TRIES_LEFT      0x63C0
+#define EMU_SW_WRONG_LC        0x6700
+#define EMU_SW_CONDITIONS      0x6985
+#define EMU_SW_NO_CURRENT_EF   0x6986
+#define EMU_SW_WRONG_P1P2      0x6A86
+#define EMU_SW_WRONG_OFFSET    0x6B00
+#define EMU_SW_WRONG_INS       0x6D00
+#define EMU_SW_WRONG_CLA       0x6E00
+
+#define EMU_PIN_LEN      8
+#define EMU_PIN_TRIES    3
+#define EMU_PUK_TRIES    10
+#define EMU_KEY_RECORDS  4
+#define EMU_GDO_LEN      26
+#define EMU_USER_CERT    (((0x1a+(EMU_KEY_ID-128)-1)<<8)|2)
+#define EMU_MAX_CONTEXTS (EMU_MAX_READERS+16)
+#define EMU_POLL_MS      10
+
+/* Albero dei file della carta */
+#define EMU_DF          1
+#define EMU_EF          2    /* EF trasparente        */
+#define EMU_EF_RECORD   3    /* EF a record           */
+#define EMU_EF_COUNTER  4    /* contatore (READ COUNTER) */
+
+typedef struct _EMU_FILE {
+  WORD fid;
+  WORD parent;
+  int type;
+} EMU_FILE;
+
+static const EMU_FILE emuFiles[]={
+  {FID_MF,              FID_NONE,            EMU_DF},
+  {FID_EF_GDO,          FID_MF,              EMU_EF},
+  {FID_SIAE_APP_DOMAIN, FID_MF,              EMU_DF},
+  {FID_P11_APP_DOMAIN,  FID_SIAE_APP_DOMAIN, EMU_DF},
+  {FID_SIAE_CNT_DOMAIN, FID_SIAE_APP_DOMAIN, EMU_DF},
+  {FID_EF_KEY_STATUS,   FID_P11_APP_DOMAIN,  EMU_EF_RECORD},
+  {FID_EF_CA_CERT,      FID_P11_APP_DOMAIN,  EMU_EF},
+  {FID_EF_SIAE_CERT,    FID_P11_APP_DOMAIN,  EMU_EF},
+  {EMU_USER_CERT,       FID_P11_APP_DOMAIN,  EMU_EF},
+  {FID_EF_CNT,          FID_SIAE_CNT_DOMAIN, EMU_EF_COUNTER},
+  {FID_EF_BALANCE_CNT,  FID_SIAE_CNT_DOMAIN, EMU_EF_COUNTER}
+};
+#define EMU_FILES ((int)(sizeof(emuFiles)/sizeof(emuFiles[0])))
+
+/* Chiave RSA 1024 di prova (modulo, esponente privato e R^2 mod n per */
+/* la moltiplicazione di Montgomery), big endian                       */
+#define EMU_KEY_LEN 128
+static const BYTE emuKeyN[EMU_KEY_LEN]={
+  0xe2,0x93,0xac,0xc4,0x1a,0x86,0x08,0x15,0x54,0xe5,0x89,0x2a,0xa2,0x9a,0x2c,0x45,
+  0x4e,0x17,0xe0,0x64,0xba,0x3d,0xc9,0xe5,0x79,0x10,0x22,0x80,0xc1,0x6e,0x4b,0xe0,
+  0x90,0x16,0xdd,0x61,0x9c,0x3b,0x69,0x27,0x49,0xa0,0x85,0xe3,0x81,0x53,0x91,0xfe,
+  0xb5,0x72,0x51,0xec,0x9d,0x33,0x19,0x31,0x7e,0xc8,0x96,0x7e,0x64,0x83,0xda,0x33,
+  0x31,0x22,0x95,0x60,0xbe,0x25,0xad,0x02,0x30,0x32,0xad,0x86,0x0a,0xf3,0x25,0x42,
+  0x6d,0x7e,0xca,0x5c,0x5e,0xd2,0x47,0xf4,0x17,0x53,0x1f,0xd3,0xc2,0xc2,0xc1,0xf4,
+  0xb3,0x55,0xb1,0x4b,0x0c,0x8f,0x7b,0x39,0xf1,0xdb,0x5f,0x1f,0x06,0x89,0x37,0xd9,
+  0xb7,0x08,0xd0,0xde,0x2e,0x4b,0xaf,0xa0,0x8b,0x16,0x8f,0x2d,0x7c,0x3b,0x94,0x5f
+};
+static const BYTE emuKeyD[EMU_KEY_LEN]={
+  0xe0,0xd5,0x9b,0xc6,0x09,0x6f,0xe1,0x4b,0x91,0xb0,0x28,0x79,0xf7,0x5a,0xb7,0xfd,
+  0x99,0xed,0xd5,0x8c,0xfe,0xc6,0xdb,0xb6,0xeb,0x78,0x58,0x54,0x9e,0x1d,0x9e,0x0b,
+  0xdb,0xcf,0xe4,0xa4,0xbc,0xcc,0xb3,0x9e,0xf9,0xcf,0xe1,0xac,0x8d,0xa3,0xe9,0x26,
+  0xf0,0xd4,0xdd,0x78,0xc7,0xd1,0x71,0xf9,0x8c,0x8e,0xed,0xcf,0xc4,0x5c,0x96,0xc3,
+  0x01,0x4e,0xd1,0x24,0x13,0x8e,0x0e,0x4f,0x6d,0x0a,0x9b,0xa0,0x26,0x5f,0xff,0x11,
+  0x49,0x31,0x8a,0x3a,0xe5,0xf0,0x17,0x31,0xd6,0x58,0x21,0xc5,0xc2,0x8e,0xc4,0x31,
+  0xac,0x47,0xe8,0x2b,0xca,0x2b,0x43,0xb3,0x60,0x78,0x70,0xfa,0xea,0xcc,0xfc,0x06,
+  0x9d,0x9e,0x8b,0x94,0x6b,0xf4,0x22,0x5b,0xc6,0xf5,0x20,0x55,0xee,0x78,0x40,0x89
+};
+static const BYTE emuKeyR2[EMU_KEY_LEN]={
+  0x5e,0x29,0x00,0xbb,0xe1,0x94,0x55,0xdc,0x2b,0xb5,0x0f,0xa1,0xe6,0x78,0x61,0x69,
+  0x3b,0x2a,0x15,0x6a,0x32,0x21,0x9e,0x97,0xf6,0x49,0x0c,0x89,0xe2,0xdf,0xda,0x1d,
+  0x1c,0x20,0x8f,0x10,0x35,0x18,0x0d,0x24,0x54,0xb2,0x5d,0x8b,0x09,0xc6,0x73,0x02,
+  0xec,0xc9,0x78,0xec,0xcb,0x69,0x50,0x50,0x61,0xd7,0x8a,0xb7,0xbe,0x0f,0xe6,0xc3,
+  0x33,0x13,0x06,0x40,0x85,0xeb,0xb5,0xb5,0xd4,0xc6,0xef,0x82,0x17,0xe7,0xf0,0x27,
+  0xcd,0x95,0x5a,0xb9,0x97,0x8f,0x89,0xa7,0xc6,0xef,0x64,0x5a,0xb8,0x1f,0x8f,0xc2,
+  0xe0,0x01,0xf5,0xbb,0xe1,0xa1,0x8b,0x51,0x80,0x7b,0xfd,0x83,0xe9,0x92,0xed,0x66,
+  0xdd,0x18,0xe5,0x36,0x5b,0x2a,0xf0,0x5f,0xd2,0x91,0x6f,0xe6,0xc8,0x25,0x11,0x50
+};
+
+/* Certificato X.509 autofirmato della chiave di prova (DER) */
+static const BYTE emuCert[601]={
+  0x30,0x82,0x02,0x55,0x30,0x82,0x01,0xbe,0xa0,0x03,0x02,0x01,0x02,0x02,0x05,0x53,
+  0x49,0x41,0x45,0x01,0x30,0x0d,0x06,0x09,0x2a,0x86,0x48,0x86,0xf7,0x0d,0x01,0x01,
+  0x05,0x05,0x00,0x30,0x44,0x31,0x0b,0x30,0x09,0x06,0x03,0x55,0x04,0x06,0x13,0x02,
+  0x49,0x54,0x31,0x17,0x30,0x15,0x06,0x03,0x55,0x04,0x0a,0x0c,0x0e,0x53,0x49,0x41,
+  0x45,0x20,0x45,0x6d,0x75,0x6c,0x61,0x74,0x6f,0x72,0x65,0x31,0x1c,0x30,0x1a,0x06,
+  0x03,0x55,0x04,0x03,0x0c,0x13,0x43,0x61,0x72,0x74,0x61,0x20,0x64,0x69,0x20,0x70,
+  0x72,0x6f,0x76,0x61,0x20,0x53,0x49,0x41,0x45,0x30,0x1e,0x17,0x0d,0x32,0x36,0x31,
+  0x30,0x31,0x35,0x32,0x33,0x33,0x36,0x31,0x39,0x5a,0x17,0x0d,0x34,0x36,0x31,0x30,
+  0x31,0x30,0x32,0x33,0x33,0x36,0x31,0x39,0x5a,0x30,0x44,0x31,0x0b,0x30,0x09,0x06,
+  0x03,0x55,0x04,0x06,0x13,0x02,0x49,0x54,0x31,0x17,0x30,0x15,0x06,0x03,0x55,0x04,
+  0x0a,0x0c,0x0e,0x53,0x49,0x41,0x45,0x20,0x45,0x6d,0x75,0x6c,0x61,0x74,0x6f,0x72,
+  0x65,0x31,0x1c,0x30,0x1a,0x06,0x03,0x55,0x04,0x03,0x0c,0x13,0x43,0x61,0x72,0x74,
+  0x61,0x20,0x64,0x69,0x20,0x70,0x72,0x6f,0x76,0x61,0x20,0x53,0x49,0x41,0x45,0x30,
+  0x81,0x9f,0x30,0x0d,0x06,0x09,0x2a,0x86,0x48,0x86,0xf7,0x0d,0x01,0x01,0x01,0x05,
+  0x00,0x03,0x81,0x8d,0x00,0x30,0x81,0x89,0x02,0x81,0x81,0x00,0xe2,0x93,0xac,0xc4,
+  0x1a,0x86,0x08,0x15,0x54,0xe5,0x89,0x2a,0xa2,0x9a,0x2c,0x45,0x4e,0x17,0xe0,0x64,
+  0xba,0x3d,0xc9,0xe5,0x79,0x10,0x22,0x80,0xc1,0x6e,0x4b,0xe0,0x90,0x16,0xdd,0x61,
+  0x9c,0x3b,0x69,0x27,0x49,0xa0,0x85,0xe3,0x81,0x53,0x91,0xfe,0xb5,0x72,0x51,0xec,
+  0x9d,0x33,0x19,0x31,0x7e,0xc8,0x96,0x7e,0x64,0x83,0xda,0x33,0x31,0x22,0x95,0x60,
+  0xbe,0x25,0xad,0x02,0x30,0x32,0xad,0x86,0x0a,0xf3,0x25,0x42,0x6d,0x7e,0xca,0x5c,
+  0x5e,0xd2,0x47,0xf4,0x17,0x53,0x1f,0xd3,0xc2,0xc2,0xc1,0xf4,0xb3,0x55,0xb1,0x4b,
+  0x0c,0x8f,0x7b,0x39,0xf1,0xdb,0x5f,0x1f,0x06,0x89,0x37,0xd9,0xb7,0x08,0xd0,0xde,
+  0x2e,0x4b,0xaf,0xa0,0x8b,0x16,0x8f,0x2d,0x7c,0x3b,0x94,0x5f,0x02,0x03,0x01,0x00,
+  0x01,0xa3,0x53,0x30,0x51,0x30,0x1d,0x06,0x03,0x55,0x1d,0x0e,0x04,0x16,0x04,0x14,
+  0x0e,0x0a,0x17,0x5e,0xa7,0xb6,0x28,0xcc,0x45,0x4d,0x7c,0x9b,0x04,0xb1,0x95,0x19,
+  0xa0,0x59,0x33,0x32,0x30,0x1f,0x06,0x03,0x55,0x1d,0x23,0x04,0x18,0x30,0x16,0x80,
+  0x14,0x0e,0x0a,0x17,0x5e,0xa7,0xb6,0x28,0xcc,0x45,0x4d,0x7c,0x9b,0x04,0xb1,0x95,
+  0x19,0xa0,0x59,0x33,0x32,0x30,0x0f,0x06,0x03,0x55,0x1d,0x13,0x01,0x01,0xff,0x04,
+  0x05,0x30,0x03,0x01,0x01,0xff,0x30,0x0d,0x06,0x09,0x2a,0x86,0x48,0x86,0xf7,0x0d,
+  0x01,0x01,0x05,0x05,0x00,0x03,0x81,0x81,0x00,0xdc,0x45,0xfe,0xa7,0xa7,0xf6,0xae,
+  0x72,0x06,0x52,0x71,0xc6,0x25,0xa4,0x98,0x75,0x5a,0x4f,0x2f,0x2a,0xae,0x58,0xf9,
+  0x15,0xe6,0xbf,0xae,0x16,0x1e,0x15,0x22,0x22,0x8f,0xca,0x35,0xd7,0x4c,0x7f,0xca,
+  0xcc,0x91,0x28,0xab,0x8f,0xfc,0xc5,0x38,0x17,0xa5,0xed,0x73,0x15,0x48,0xf8,0x0b,
+  0x6b,0xb3,0x8a,0x52,0x9c,0x04,0xa7,0x66,0x2c,0x3b,0xfc,0xf4,0x59,0x9b,0xb7,0x04,
+  0x60,0x24,0x7e,0x87,0x39,0x9c,0x90,0x60,0xa7,0xc9,0xa1,0xa6,0xf9,0x0a,0x41,0x8d,
+  0x5e,0xc0,0xff,0xc8,0x2e,0xbc,0x0d,0x61,0x2a,0xcf,0x32,0x9d,0x65,0x44,0x0b,0x3c,
+  0x4a,0x16,0xe2,0x7e,0x54,0x54,0x2b,0x26,0xd2,0x1c,0x3e,0xa1,0xb7,0xa1,0xc3,0x37,
+  0x8c,0x4b,0xca,0xd1,0xd3,0x6f,0xb2,0xca,0x63
+};
+
+/* Aritmetica modulare a 1024 bit in base 2^32 per la SIGN */
+#define EMU_LIMBS (EMU_KEY_LEN/4)
+typedef unsigned int EMU_LIMB;
+#ifdef WIN32
+typedef unsigned __int64 EMU_DLIMB;
+#else
+typedef unsigned long long EMU_DLIMB;
+#endif
+
+static void BytesToLimbs(const BYTE *b, EMU_LIMB *x)
+{
+  int i;
+  const BYTE *p;
+  for (i=0; i<EMU_LIMBS; i++) {
+    p=b+EMU_KEY_LEN-4*(i+1);
+    x[i]=((EMU_LIMB)p[0]<<24)|((EMU_LIMB)p[1]<<16)|((EMU_LIMB)p[2]<<8)|p[3];
+  }
+}
+
+static void LimbsToBytes(const EMU_LIMB *x, BYTE *b)
+{
+  int i;
+  BYTE *p;
+  for (i=0; i<EMU_LIMBS; i++) {
+    p=b+EMU_KEY_LEN-4*(i+1);
+    p[0]=(BYTE)(x[i]>>24); p[1]=(BYTE)(x[i]>>16);
+    p[2]=(BYTE)(x[i]>>8);  p[3]=(BYTE)x[i];
+  }
+}
+
+static int CmpLimbs(const EMU_LIMB *a, const EMU_LIMB *b)
+{
+  int i;
+  for (i=EMU_LIMBS-1; i>=0; i--)
+    if (a[i]!=b[i]) return (a[i]>b[i])?1:-1;
+  return 0;
+}
+
+static void SubLimbs(EMU_LIMB *a, const EMU_LIMB *b)
+{
+  EMU_DLIMB d;
+  EMU_LIMB borrow=0;
+  int i;
+  for (i=0; i<EMU_LIMBS; i++) {
+    d=(EMU_DLIMB)a[i]-b[i]-borrow;
+    a[i]=(EMU_LIMB)d;
+    borrow=(EMU_LIMB)(d>>32)&1;
+  }
+}
+
+/* r=a*b/R mod n (Montgomery, CIOS); n0=-1/n mod 2^32 */
+static void MontMul(EMU_LIMB *r, const EMU_LIMB *a, const EMU_LIMB *b,
+                    const EMU_LIMB *n, EMU_LIMB n0)
+{
+  EMU_LIMB t[EMU_LIMBS+2];
+  EMU_DLIMB uv;
+  EMU_LIMB c, m;
+  int i, j;
+  memset(t,0,sizeof(t));
+  for (i=0; i<EMU_LIMBS; i++) {
+    c=0;
+    for (j=0; j<EMU_LIMBS; j++) {
+      uv=(EMU_DLIMB)a[j]*b[i]+t[j]+c;
+      t[j]=(EMU_LIMB)uv;
+      c=(EMU_LIMB)(uv>>32);
+    }
+    uv=(EMU_DLIMB)t[EMU_LIMBS]+c;
+    t[EMU_LIMBS]=(EMU_LIMB)uv;
+    t[EMU_LIMBS+1]=(EMU_LIMB)(uv>>32);
+    m=t[0]*n0;
+    uv=(EMU_DLIMB)m*n[0]+t[0];
+    c=(EMU_LIMB)(uv>>32);
+    for (j=1; j<EMU_LIMBS; j++) {
+      uv=(EMU_DLIMB)m*n[j]+t[j]+c;
+      t[j-1]=(EMU_LIMB)uv;
+      c=(EMU_LIMB)(uv>>32);
+    }
+    uv=(EMU_DLIMB)t[EMU_LIMBS]+c;
+    t[EMU_LIMBS-1]=(EMU_LIMB)uv;
+    t[EMU_LIMBS]=t[EMU_LIMBS+1]+(EMU_LIMB)(uv>>32);
+  }
+  if ((t[EMU_LIMBS]!=0)||(CmpLimbs(t,n)>=0)) SubLimbs(t,n);
+  memcpy(r,t,EMU_LIMBS*sizeof(EMU_LIMB));
+}
+
+/* Ritorna FALSE se in non e' minore del modulo */
+static BOOL EmuRsaPrivate(const BYTE *in, BYTE *out)
+{
+  EMU_LIMB n[EMU_LIMBS], r2[EMU_LIMBS], x[EMU_LIMBS], acc[EMU_LIMBS], one[EMU_LIMBS];
+  EMU_LIMB n0, inv;
+  int i, bit;
+
+  BytesToLimbs(emuKeyN,n);
+  BytesToLimbs(in,x);
+  if (CmpLimbs(x,n)>=0) return FALSE;
+  BytesToLimbs(emuKeyR2,r2);
+  /* inverso di n[0] modulo 2^32 con il metodo di Newton */
+  inv=n[0];
+  for (i=0; i<4; i++) inv*=2-n[0]*inv;
+  n0=(EMU_LIMB)0-inv;
+
+  memset(one,0,sizeof(one));
+  one[0]=1;
+  MontMul(x,x,r2,n,n0);
+  MontMul(acc,one,r2,n,n0);
+  for (i=0; i<EMU_KEY_LEN; i++)
+    for (bit=7; bit>=0; bit--) {
+      MontMul(acc,acc,acc,n,n0);
+      if ((emuKeyD[i]>>bit)&1) MontMul(acc,acc,x,n,n0);
+    }
+  MontMul(acc,acc,one,n,n0);
+  LimbsToBytes(acc,out);
+  return TRUE;
+}
+
+/* Stato di una carta emulata. I dati persistenti (PIN, contatori) */
+/* sopravvivono a reset ed estrazioni; quelli volatili (file e      */
+/* ambiente di sicurezza correnti) si azzerano al reset.            */
+typedef struct _EMU_CARD {
+  SYS_SPINLOCK lock;
+  BOOL init;
+  SYS_ATOMIC removed;       /* carta estratta dal lettore             */
+  SYS_ATOMIC events;        /* inserimenti ed estrazioni              */
+  int nHandles;
+  /* stato persistente */
+  char serial[9];
+  DWORD counter;
+  DWORD balance;
+  BYTE pin[EMU_PIN_LEN];
+  BYTE puk[EMU_PIN_LEN];
+  int pinTries;
+  int pukTries;
+  /* stato volatile */
+  WORD df;
+  WORD ef;
+  BOOL pinOk;
+  BYTE key;
+  unsigned int rnd;
+} EMU_CARD;
+
+static EMU_CARD emuCards[EMU_MAX_READERS];
+
+/* Configurazione */
+static SYS_ATOMIC emuConfigured=0;
+static SYS_ATOMIC emuReaders=1;
+static SYS_ATOMIC emuLatency=0;
+static SYS_ATOMIC emuJitter=0;
+static SYS_ATOMIC emuSignLatency=0;
+static SYS_ATOMIC emuReadersChanges=0;
+
+/* Contesti: 0 libero, 1 in uso, 2 annullato da Cancel */
+static SYS_ATOMIC emuContexts[EMU_MAX_CONTEXTS];
+
+static long EnvValue(const char *name, long def, long max)
+{
+  const char *s=getenv(name);
+  long v;
+  if ((s==NULL)||(*s=='\0')) return def;
+  v=atol(s);
+  if (v<0) return def;
+  return (v>max)?max:v;
+}
+
+/* Legge le variabili d'ambiente una sola volta, prima di qualsiasi */
+/* impostazione esplicita                                            */
+static void EmuLoadConfig()
+{
+  if (!SysAtomicCAS(&emuConfigured,0,1)) return;
+  SysAtomicStore(&emuReaders,EnvValue("LIBSIAE_EMU_READERS",1,EMU_MAX_READERS));
+  if (SysAtomicLoad(&emuReaders)==0) SysAtomicStore(&emuReaders,1);
+  SysAtomicStore(&emuLatency,EnvValue("LIBSIAE_EMU_LATENCY",0,10000000));
+  SysAtomicStore(&emuJitter,EnvValue("LIBSIAE_EMU_JITTER",0,10000000));
+  SysAtomicStore(&emuSignLatency,EnvValue("LIBSIAE_EMU_SIGN_LATENCY",0,10000000));
+}
+
+static void PadPin(BYTE *dst, const char *pin)
+{
+  memset(dst,0,EMU_PIN_LEN);
+  memcpy(dst,pin,strlen(pin));
+}
+
+static void ResetVolatile(EMU_CARD *pCard)
+{
+  pCard->df=FID_MF;
+  pCard->ef=FID_NONE;
+  pCard->pinOk=FALSE;
+  pCard->key=0;
+}
+
+/* Da chiamare con il lock della carta */
+static void InitCard(EMU_CARD *pCard, int nReader)
+{
+  if (pCard->init) return;
+  sprintf(pCard->serial,"EM%06d",nReader);
+  pCard->counter=0;
+  pCard->balance=EMU_DEFAULT_BALANCE;
+  PadPin(pCard->pin,EMU_DEFAULT_PIN);
+  PadPin(pCard->puk,EMU_DEFAULT_PUK);
+  pCard->pinTries=EMU_PIN_TRIES;
+  pCard->pukTries=EMU_PUK_TRIES;
+  pCard->rnd=2463534242u+nReader;
+  ResetVolatile(pCard);
+  pCard->init=TRUE;
+}
+
+/* Indice del lettore dal nome, -1 se non e' un lettore emulato attivo */
+static int ReaderIndex(LPCSTR szReader)
+{
+  size_t l=strlen(EMU_READER_PREFIX);
+  const char *p;
+  int n=0;
+  if ((szReader==NULL)||(strncmp(szReader,EMU_READER_PREFIX,l)!=0)) return -1;
+  p=szReader+l;
+  if (*p=='\0') return -1;
+  for (; *p!='\0'; p++) {
+    if ((*p<'0')||(*p>'9')||(n>=EMU_MAX_READERS)) return -1;
+    n=n*10+(*p-'0');
+  }
+  return (n<SysAtomicLoad(&emuReaders))?n:-1;
+}
+
+/* L'handle contiene l'indice del lettore e il numero di eventi della */
+/* carta al momento della connessione: dopo un'estrazione non e' piu' */
+/* valido, come con PC/SC.                                            */
+static EMU_CARD *CardFromHandle(SCARDHANDLE hCard, LONG *pRv)
+{
+  int n=(int)(hCard&0xffff)-1;
+  EMU_CARD *pCard;
+  if ((n<0)||(n>=EMU_MAX_READERS)) {
+    *pRv=SCARD_E_INVALID_HANDLE;
+    return NULL;
+  }
+  pCard=&emuCards[n];
+  if ((n>=SysAtomicLoad(&emuReaders))||SysAtomicLoad(&pCard->removed)||
+      ((long)((hCard>>16)&0x7fff)!=(SysAtomicLoad(&pCard->events)&0x7fff))) {
+    *pRv=SCARD_W_REMOVED_CARD;
+    return NULL;
+  }
+  *pRv=SCARD_S_SUCCESS;
+  return pCard;
+}
+
+static const EMU_FILE *FindFile(WORD fid)
+{
+  int i;
+  for (i=0; i<EMU_FILES; i++)
+    if (emuFiles[i].fid==fid) return &emuFiles[i];
+  return NULL;
+}
+
+/* Contenuto di un EF trasparente; ritorna la lunghezza */
+static int EFContent(EMU_CARD *pCard, WORD fid, BYTE *buf)
+{
+  if (fid==FID_EF_GDO) {
+    memset(buf,0,EMU_GDO_LEN);
+    buf[0]=0x5a;
+    buf[1]=0x08;
+    memcpy(buf+18,pCard->serial,8);
+    return EMU_GDO_LEN;
+  }
+  /* certificati: lunghezza little endian seguita dal DER */
+  buf[0]=(BYTE)(sizeof(emuCert)&0xff);
+  buf[1]=(BYTE)(sizeof(emuCert)>>8);
+  memcpy(buf+2,emuCert,sizeof(emuCert));
+  return (int)sizeof(emuCert)+2;
+}
+
+static WORD CheckPin(EMU_CARD *pCard, BYTE ref, const BYTE *value)
+{
+  BYTE *pRef=(ref==0x81)?pCard->pin:pCard->puk;
+  int *pTries=(ref==0x81)?&pCard->pinTries:&pCard->pukTries;
+  if (*pTries==0) return C_PIN_BLOCKED;
+  if (memcmp(pRef,value,EMU_PIN_LEN)!=0) {
+    (*pTries)--;
+    if (ref==0x81) pCard->pinOk=FALSE;
+    return EMU_SW_AUTH_FAILED;
+  }
+  *pTries=(ref==0x81)?EMU_PIN_TRIES:EMU_PUK_TRIES;
+  if (ref==0x81) pCard->pinOk=TRUE;
+  return EMU_SW_OK;
+}
+
+/* MAC del sigillo: primi 8 byte dello SHA1 di numero di serie, */
+/* challenge e contatore                                        */
+static void SigilloMac(EMU_CARD *pCard, const BYTE *challenge, const BYTE *cnt, BYTE *mac)
+{
+  BYTE buf[8+22+4];
+  BYTE hash[20];
+  memcpy(buf,pCard->serial,8);
+  memcpy(buf+8,challenge,22);
+  memcpy(buf+30,cnt,4);
+  SHA1(buf,sizeof(buf),hash);
+  memcpy(mac,hash,8);
+}
+
+static void PutDword(BYTE *p, DWORD v)
+{
+  p[0]=(BYTE)(v>>24); p[1]=(BYTE)(v>>16); p[2]=(BYTE)(v>>8); p[3]=(BYTE)v;
+}
+
+/* Esegue l'APDU con il lock della carta e ritorna la SW; *pOut riceve */
+/* la lunghezza della risposta. La SIGN lascia in out il blocco da     */
+/* firmare e imposta *pSign: il calcolo RSA avviene fuori dal lock.    */
+static WORD Process(EMU_CARD *pCard, LPCBYTE s, DWORD sl, BYTE *out, DWORD maxOut, DWORD *pOut, BOOL *pSign)
+{
+  BYTE ins, p1, p2;
+  DWORD lc=0, le=0, i;
+  LPCBYTE data=NULL;
+  WORD p1p2;
+  const EMU_FILE *pFile;
+
+  *pOut=0;
+  if (sl<4) return EMU_SW_WRONG_LC;
+  if (s[0]!=0x00) return EMU_SW_WRONG_CLA;
+  ins=s[1]; p1=s[2]; p2=s[3];
+  p1p2=(WORD)((p1<<8)|p2);
+  /* Lc e Le, con Le esteso solo per la READ BINARY */
+  if (sl==5) le=s[4]?s[4]:256;
+  else if ((sl==7)&&(s[4]==0)&&(ins==0xb0)) {
+    le=(s[5]<<8)|s[6];
+    if (le==0) le=65536;
+  }
+  else if (sl>5) {
+    lc=s[4];
+    data=s+5;
+    if (sl==5+lc+1) le=s[5+lc]?s[5+lc]:256;
+    else if (sl!=5+lc) return EMU_SW_WRONG_LC;
+  }
+  if (le>maxOut) le=maxOut;
+
+  switch (ins) {
+  case 0xa4:  /* SELECT */
+    if ((p1p2!=0x0000)||(lc!=2)) return EMU_SW_WRONG_P1P2;
+    pFile=FindFile((WORD)((data[0]<<8)|data[1]));
+    if (pFile==NULL) return C_FILE_NOT_FOUND;
+    if (pFile->type==EMU_DF) {
+      if ((pFile->fid!=FID_MF)&&(pFile->fid!=pCard->df)&&(pFile->parent!=pCard->df)&&
+          (pFile->fid!=FindFile(pCard->df)->parent))
+        return C_FILE_NOT_FOUND;
+      pCard->df=pFile->fid;
+      pCard->ef=FID_NONE;
+    }
+    else {
+      if (pFile->parent!=pCard->df) return C_FILE_NOT_FOUND;
+      pCard->ef=pFile->fid;
+    }
+    return EMU_SW_OK;
+
+  case 0xb0:  /* READ BINARY */
+  {
+    BYTE buf[sizeof(emuCert)+2];
+    DWORD off=((p1&0x7f)<<8)|p2;
+    DWORD len;
+    if (pCard->ef==FID_NONE) return EMU_SW_NO_CURRENT_EF;
+    if (FindFile(pCard->ef)->type!=EMU_EF) return C_WRONG_TYPE;
+    len=EFContent(pCard,pCard->ef,buf);
+    if (off>len) return EMU_SW_WRONG_OFFSET;
+    *pOut=(le<len-off)?le:len-off;
+    memcpy(out,buf+off,*pOut);
+    return (*pOut<le)?C_WRONG_LENGTH:EMU_SW_OK;
+  }
+
+  case 0xb2:  /* READ RECORD: stato delle chiavi */
+    if ((p2!=0x04)||(p1==0)) return EMU_SW_WRONG_P1P2;
+    if (pCard->ef==FID_NONE) return EMU_SW_NO_CURRENT_EF;
+    if (FindFile(pCard->ef)->type!=EMU_EF_RECORD) return C_WRONG_TYPE;
+    if (p1>EMU_KEY_RECORDS) return C_RECORD_NOT_FOUND;
+    out[0]=(BYTE)((p1+128==EMU_KEY_ID)?1:0);
+    *pOut=1;
+    return EMU_SW_OK;
+
+  case 0x20:  /* VERIFY */
+    if ((p1!=0)||((p2!=0x81)&&(p2!=0x82))) return C_UNKNOWN_OBJECT;
+    if (lc==0) {
+      /* senza dati: numero di tentativi rimasti */
+      if ((p2==0x81)&&pCard->pinOk) return EMU_SW_OK;
+      return (WORD)(EMU_SW_TRIES_LEFT|((p2==0x81)?pCard->pinTries:pCard->pukTries));
+    }
+    if (lc!=EMU_PIN_LEN) return EMU_SW_WRONG_LC;
+    return CheckPin(pCard,p2,data);
+
+  case 0x24:  /* CHANGE REFERENCE DATA */
+  case 0x2c:  /* RESET RETRY COUNTER */
+  {
+    WORD sw;
+    if ((p1!=0)||(p2!=0x81)) return C_UNKNOWN_OBJECT;
+    if (lc!=2*EMU_PIN_LEN) return EMU_SW_WRONG_LC;
+    sw=CheckPin(pCard,(BYTE)((ins==0x24)?0x81:0x82),data);
+    if (sw!=EMU_SW_OK) return sw;
+    memcpy(pCard->pin,data+EMU_PIN_LEN,EMU_PIN_LEN);
+    pCard->pinTries=EMU_PIN_TRIES;
+    return EMU_SW_OK;
+  }
+
+  case 0x32:  /* READ COUNTER, CMP_SIGILLO */
+    if (pCard->ef==FID_NONE) return EMU_SW_NO_CURRENT_EF;
+    if (FindFile(pCard->ef)->type!=EMU_EF_COUNTER) return C_WRONG_TYPE;
+    if (p1p2==0x0001) {
+      PutDword(out,(pCard->ef==FID_EF_CNT)?pCard->counter:pCard->balance);
+      *pOut=4;
+      return EMU_SW_OK;
+    }
+    if (p1p2==0x8312) {
+      if (lc!=22) return EMU_SW_WRONG_LC;
+      if (pCard->ef!=FID_EF_CNT) return C_WRONG_TYPE;
+      if (pCard->balance==0) return EMU_SW_CONDITIONS;
+      pCard->counter++;
+      pCard->balance--;
+      PutDword(out,pCard->counter);
+      SigilloMac(pCard,data,out,out+4);
+      *pOut=12;
+      return EMU_SW_OK;
+    }
+    return EMU_SW_WRONG_P1P2;
+
+  case 0x22:  /* MANAGE SECURITY ENVIRONMENT */
+    if (p1p2==0xf301) {
+      pCard->key=0;
+      return EMU_SW_OK;
+    }
+    if (p1p2==0xf1b8) {
+      if ((lc!=3)||(data[0]!=0x83)||(data[1]!=0x01)) return C_WRONG_DATA;
+      if ((data[2]!=EMU_KEY_ID)||(pCard->df!=FID_P11_APP_DOMAIN)) return C_UNKNOWN_OBJECT;
+      pCard->key=data[2];
+      return EMU_SW_OK;
+    }
+    return EMU_SW_WRONG_P1P2;
+
+  case 0x2a:  /* PERFORM SECURITY OPERATION: firma RSA "raw" */
+    if (p1p2!=0x8086) return EMU_SW_WRONG_P1P2;
+    if ((lc!=EMU_KEY_LEN+1)||(data[0]!=0)) return EMU_SW_WRONG_LC;
+    if (pCard->key==0) return EMU_SW_CONDITIONS;
+    if (!pCard->pinOk) return C_NOT_AUTHORIZED;
+    if (maxOut<EMU_KEY_LEN) return EMU_SW_WRONG_LC;
+    for (i=0; i<EMU_KEY_LEN; i++) out[i]=data[1+i];
+    *pOut=EMU_KEY_LEN;
+    *pSign=TRUE;
+    return EMU_SW_OK;
+  }
+  return EMU_SW_WRONG_INS;
+}
+
+/* Numero pseudocasuale (xorshift) per la variazione della latenza */
+static unsigned int NextRandom(EMU_CARD *pCard)
+{
+  unsigned int x=pCard->rnd;
+  x^=x<<13; x^=x>>17; x^=x<<5;
+  pCard->rnd=x;
+  return x;
+}
+
+/* Funzioni del trasporto */
+
+static LONG EmuEstablishContext(SIAE_TRANSPORT *t, SCARDCONTEXT *phContext)
+{
+  int i;
+  EmuLoadConfig();
+  for (i=0; i<EMU_MAX_CONTEXTS; i++)
+    if (SysAtomicCAS(&emuContexts[i],0,1)) {
+      *phContext=(SCARDCONTEXT)(i+1);
+      return SCARD_S_SUCCESS;
+    }
+  return SCARD_E_NO_MEMORY;
+}
+
+static SYS_ATOMIC *ContextState(SCARDCONTEXT hContext)
+{
+  if ((hContext<1)||(hContext>EMU_MAX_CONTEXTS)) return NULL;
+  if (SysAtomicLoad(&emuContexts[hContext-1])==0) return NULL;
+  return &emuContexts[hContext-1];
+}
+
+static LONG EmuReleaseContext(SIAE_TRANSPORT *t, SCARDCONTEXT hContext)
+{
+  SYS_ATOMIC *p=ContextState(hContext);
+  if (p==NULL) return SCARD_E_INVALID_HANDLE;
+  SysAtomicStore(p,0);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG EmuListReaders(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPSTR mszReaders, LPDWORD pcchReaders)
+{
+  char name[MAX_READER_NAME];
+  DWORD size=1, l;
+  int i, n=(int)SysAtomicLoad(&emuReaders);
+  if (ContextState(hContext)==NULL) return SCARD_E_INVALID_HANDLE;
+  for (i=0; i<n; i++) size+=sprintf(name,EMU_READER_PREFIX "%d",i)+1;
+  if (mszReaders==NULL) {
+    *pcchReaders=size;
+    return SCARD_S_SUCCESS;
+  }
+  if (*pcchReaders<size) {
+    *pcchReaders=size;
+    return SCARD_E_INSUFFICIENT_BUFFER;
+  }
+  for (i=0, l=0; i<n; i++) l+=sprintf(mszReaders+l,EMU_READER_PREFIX "%d",i)+1;
+  mszReaders[l]='\0';
+  *pcchReaders=size;
+  return SCARD_S_SUCCESS;
+}
+
+/* Stato corrente di un lettore nel formato di SCardGetStatusChange, */
+/* con il numero di eventi nei 16 bit alti                           */
+static DWORD ReaderState(LPCSTR szReader)
+{
+  int n;
+  if (strcmp(szReader,"\\\\?PnP?\\Notification")==0)
+    return (DWORD)((SysAtomicLoad(&emuReadersChanges)&0x7fff)+1)<<16;
+  n=ReaderIndex(szReader);
+  if (n<0) return SCARD_STATE_UNKNOWN|SCARD_STATE_IGNORE;
+  return ((DWORD)(SysAtomicLoad(&emuCards[n].events)&0xffff)<<16)|
+         (SysAtomicLoad(&emuCards[n].removed)?SCARD_STATE_EMPTY:SCARD_STATE_PRESENT);
+}
+
+static LONG EmuGetStatusChange(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, DWORD dwTimeout, SCARD_READERSTATE *rgReaderStates, DWORD cReaders)
+{
+  SYS_ATOMIC *pCtx=ContextState(hContext);
+  DWORD i, st, waited=0;
+  BOOL changed;
+  if (pCtx==NULL) return SCARD_E_INVALID_HANDLE;
+  for (;;) {
+    changed=FALSE;
+    for (i=0; i<cReaders; i++) {
+      st=ReaderState(rgReaderStates[i].szReader);
+      if ((rgReaderStates[i].dwCurrentState&~SCARD_STATE_CHANGED)!=st) {
+        st|=SCARD_STATE_CHANGED;
+        changed=TRUE;
+      }
+      rgReaderStates[i].dwEventState=st;
+    }
+    if (changed) return SCARD_S_SUCCESS;
+    if (SysAtomicCAS(pCtx,2,1)) return SCARD_E_CANCELLED;
+    if ((dwTimeout!=INFINITE)&&(waited>=dwTimeout)) return SCARD_E_TIMEOUT;
+    SysSleep(EMU_POLL_MS);
+    waited+=EMU_POLL_MS;
+  }
+}
+
+static LONG EmuCancel(SIAE_TRANSPORT *t, SCARDCONTEXT hContext)
+{
+  SYS_ATOMIC *p=ContextState(hContext);
+  if (p==NULL) return SCARD_E_INVALID_HANDLE;
+  SysAtomicCAS(p,1,2);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG EmuConnect(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPCSTR szReader, SCARDHANDLE *phCard)
+{
+  EMU_CARD *pCard;
+  int n;
+  if (ContextState(hContext)==NULL) return SCARD_E_INVALID_HANDLE;
+  n=ReaderIndex(szReader);
+  if (n<0) return SCARD_E_UNKNOWN_READER;
+  pCard=&emuCards[n];
+  if (SysAtomicLoad(&pCard->removed)) return SCARD_E_NO_SMARTCARD;
+  SysSpinLock(&pCard->lock);
+  InitCard(pCard,n);
+  if (pCard->nHandles++==0) ResetVolatile(pCard);
+  *phCard=(SCARDHANDLE)(((SysAtomicLoad(&pCard->events)&0x7fff)<<16)|(n+1));
+  SysSpinUnlock(&pCard->lock);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG EmuReconnect(SIAE_TRANSPORT *t, SCARDHANDLE hCard)
+{
+  LONG rv;
+  EMU_CARD *pCard=CardFromHandle(hCard,&rv);
+  if (pCard==NULL) return rv;
+  return SCARD_S_SUCCESS;
+}
+
+static LONG EmuDisconnect(SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition)
+{
+  int n=(int)(hCard&0xffff)-1;
+  EMU_CARD *pCard;
+  if ((n<0)||(n>=EMU_MAX_READERS)) return SCARD_E_INVALID_HANDLE;
+  pCard=&emuCards[n];
+  SysSpinLock(&pCard->lock);
+  if (pCard->nHandles>0) pCard->nHandles--;
+  if (dwDisposition!=SCARD_LEAVE_CARD) ResetVolatile(pCard);
+  SysSpinUnlock(&pCard->lock);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG EmuBeginTransaction(SIAE_TRANSPORT *t, SCARDHANDLE hCard)
+{
+  LONG rv;
+  CardFromHandle(hCard,&rv);
+  return rv;
+}
+
+static LONG EmuEndTransaction(SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition)
+{
+  LONG rv;
+  CardFromHandle(hCard,&rv);
+  return rv;
+}
+
+static LONG EmuTransmit(SIAE_TRANSPORT *t, SCARDHANDLE hCard, LPCBYTE pbSend, DWORD cbSend, LPBYTE pbRecv, LPDWORD pcbRecv)
+{
+  LONG rv;
+  EMU_CARD *pCard=CardFromHandle(hCard,&rv);
+  DWORD outLen=0;
+  BOOL bSign=FALSE;
+  WORD sw;
+  long delay, jitter;
+
+  if (pCard==NULL) return rv;
+  if (*pcbRecv<2) return SCARD_E_INSUFFICIENT_BUFFER;
+  SysSpinLock(&pCard->lock);
+  sw=Process(pCard,pbSend,cbSend,pbRecv,*pcbRecv-2,&outLen,&bSign);
+  delay=SysAtomicLoad(&emuLatency);
+  jitter=SysAtomicLoad(&emuJitter);
+  if (jitter>0) delay+=(long)(NextRandom(pCard)%(unsigned int)(2*jitter+1))-jitter;
+  SysSpinUnlock(&pCard->lock);
+
+  if (bSign) {
+    if (!EmuRsaPrivate(pbRecv,pbRecv)) {
+      outLen=0;
+      sw=C_WRONG_DATA;
+    }
+    delay+=SysAtomicLoad(&emuSignLatency);
+  }
+  pbRecv[outLen]=(BYTE)(sw>>8);
+  pbRecv[outLen+1]=(BYTE)(sw&0xff);
+  *pcbRecv=outLen+2;
+  if (delay>0) SysSleepUs(delay);
+  return SCARD_S_SUCCESS;
+}
+
+SIAE_TRANSPORT emuTransport={
+  EMU_TRANSPORT_NAME, NULL,
+  EmuEstablishContext, EmuReleaseContext, EmuListReaders,
+  EmuGetStatusChange, EmuCancel,
+  EmuConnect, EmuReconnect, EmuDisconnect,
+  EmuBeginTransaction, EmuEndTransaction, EmuTransmit
+};
+
+/* Configurazione esportata */
+
+int CALLINGCONV SetEmulatorReaders(int nReaders)
+{
+  if ((nReaders<1)||(nReaders>EMU_MAX_READERS)) return C_GENERIC_ERROR;
+  EmuLoadConfig();
+  if (SysAtomicExchange(&emuReaders,nReaders)!=nReaders)
+    SysAtomicAdd(&emuReadersChanges,1);
+  return C_OK;
+}
+
+int CALLINGCONV SetEmulatorLatency(DWORD dwLatency, DWORD dwJitter, DWORD dwSignLatency)
+{
+  if ((dwLatency>10000000)||(dwJitter>10000000)||(dwSignLatency>10000000)) return C_GENERIC_ERROR;
+  EmuLoadConfig();
+  SysAtomicStore(&emuLatency,(long)dwLatency);
+  SysAtomicStore(&emuJitter,(long)dwJitter);
+  SysAtomicStore(&emuSignLatency,(long)dwSignLatency);
+  return C_OK;
+}
+
+int CALLINGCONV SetEmulatorCardPresent(int nReader, BOOL bPresent)
+{
+  EMU_CARD *pCard;
+  if ((nReader<0)||(nReader>=EMU_MAX_READERS)) return C_GENERIC_ERROR;
+  pCard=&emuCards[nReader];
+  SysSpinLock(&pCard->lock);
+  bPresent=(bPresent!=FALSE);
+  if (SysAtomicLoad(&pCard->removed)==bPresent) {
+    SysAtomicStore(&pCard->removed,!bPresent);
+    SysAtomicAdd(&pCard->events,1);
+    pCard->nHandles=0;
+    ResetVolatile(pCard);
+  }
+  SysSpinUnlock(&pCard->lock);
+  return C_OK;
+}
+
+int CALLINGCONV ResetEmulatorCard(int nReader, DWORD dwCounter, DWORD dwBalance)
+{
+  EMU_CARD *pCard;
+  if ((nReader<0)||(nReader>=EMU_MAX_READERS)) return C_GENERIC_ERROR;
+  pCard=&emuCards[nReader];
+  SysSpinLock(&pCard->lock);
+  pCard->init=FALSE;
+  InitCard(pCard,nReader);
+  pCard->counter=dwCounter;
+  pCard->balance=dwBalance;
+  SysSpinUnlock(&pCard->lock);
+  return C_OK;
+}
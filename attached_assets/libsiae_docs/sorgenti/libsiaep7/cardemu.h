@@ -0,0 +1,66 @@
+#ifndef CARDEMU_H
+#define CARDEMU_H
+
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************
+  Emulatore software della carta SIAE, registrato come trasporto "emu".
+  Si seleziona con SelectTransport("emu") o con LIBSIAE_TRANSPORT=emu e
+  presenta i lettori virtuali "SIAE Emulator 0", "SIAE Emulator 1", ...
+  ciascuno con una carta sempre inserita (salvo SetEmulatorCardPresent).
+
+  La carta risponde al sottoinsieme di APDU usato dalla libreria: SELECT
+  sull'albero MF/0000/1111/1112, READ BINARY (anche con Le esteso), READ
+  RECORD sull'EF 5f02, VERIFY/CHANGE REFERENCE DATA/RESET RETRY COUNTER
+  per PIN (0x81) e PUK (0x82), READ COUNTER su 1000/1001, CMP_SIGILLO,
+  MSE restore/set e SIGN con una chiave RSA 1024 di prova. Contatore e
+  saldo restano nella memoria del processo.
+
+  PIN e PUK iniziali sono EMU_DEFAULT_PIN e EMU_DEFAULT_PUK; l'unica
+  chiave e' EMU_KEY_ID, con un certificato autofirmato di prova che fa
+  anche da certificato CA e SIAE.
+
+  Variabili d'ambiente lette alla prima apertura di un contesto (le
+  funzioni Set... hanno la precedenza):
+    LIBSIAE_EMU_READERS        numero di lettori (predefinito 1)
+    LIBSIAE_EMU_LATENCY        latenza di ogni APDU in microsecondi
+    LIBSIAE_EMU_JITTER         variazione casuale massima (+/-) della latenza
+    LIBSIAE_EMU_SIGN_LATENCY   latenza aggiuntiva della SIGN
+*****************************************************************************/
+
+#define EMU_TRANSPORT_NAME  "emu"
+#define EMU_READER_PREFIX   "SIAE Emulator "
+#define EMU_DEFAULT_PIN     "1234"
+#define EMU_DEFAULT_PUK     "12345678"
+#define EMU_KEY_ID          0x81
+#define EMU_DEFAULT_BALANCE 1000000
+
+/* Numero massimo di lettori virtuali */
+#define EMU_MAX_READERS     256
+
+/* Numero di lettori virtuali (da 1 a EMU_MAX_READERS); la variazione */
+/* viene segnalata come un cambiamento dell'elenco dei lettori.       */
+int CALLINGCONV SetEmulatorReaders(int nReaders);
+
+/* Latenza di ogni APDU e della SIGN, con variazione casuale, in us */
+int CALLINGCONV SetEmulatorLatency(DWORD dwLatency, DWORD dwJitter, DWORD dwSignLatency);
+
+/* Simula l'inserimento o l'estrazione della carta nel lettore nReader */
+int CALLINGCONV SetEmulatorCardPresent(int nReader, BOOL bPresent);
+
+/* Riporta la carta del lettore nReader allo stato iniziale (PIN, PUK, */
+/* tentativi) con i valori indicati di contatore e saldo.              */
+int CALLINGCONV ResetEmulatorCard(int nReader, DWORD dwCounter, DWORD dwBalance);
+
+/* Uso interno: trasporto registrato da transport.c */
+extern SIAE_TRANSPORT emuTransport;
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // CARDEMU_H
@@ -0,0 +1,344 @@
+/*****************************************************************************
+            Cache su disco dei certificati letti dalla carta SIAE
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libsiaecardt.h"
+#include "libsiaecard.h"
+#include "internals.h"
+#include "certcache.h"
+#include "sysdep.h"
+
+#ifdef WIN32
+#	include <windows.h>
+#	define PATH_SEP '\\'
+#else
+#	include <sys/types.h>
+#	include <sys/stat.h>
+#	include <sys/mman.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	define PATH_SEP '/'
+#endif
+
+#define CERTCACHE_MAGIC        "SIAECC01"
+#define CERTCACHE_MAX_ENTRIES  16
+#define CERTCACHE_MAX_SIZE     (256*1024)
+
+/* Ogni carta ha un file <dir>/<serial>.siaecc cosi' composto:         */
+/*   CC_HEADER, nEntries x CC_ENTRY, dati degli oggetti                */
+/* I campi sono in formato nativo: la cache e' locale alla macchina e  */
+/* un file scritto da una build con layout diverso viene scartato      */
+/* grazie a entrySize.                                                 */
+typedef struct _CC_HEADER {
+  char         magic[8];
+  BYTE         serial[8];
+  unsigned int entrySize;
+  unsigned int nEntries;
+} CC_HEADER;
+
+typedef struct _CC_ENTRY {
+  unsigned short kind;
+  unsigned short fid;
+  unsigned int   offset;
+  unsigned int   len;
+  unsigned int   fpLen;
+  BYTE           fp[CERT_FP_LEN];
+} CC_ENTRY;
+
+typedef struct _CC_MAP {
+  const BYTE *base;
+  size_t      size;
+#ifdef WIN32
+  HANDLE      hFile;
+  HANDLE      hMap;
+#endif
+} CC_MAP;
+
+/* cacheDir e cacheInit sono protetti da cacheLock: la directory puo' */
+/* essere cambiata mentre altri slot stanno leggendo o scrivendo       */
+static char *cacheDir=NULL;
+static int   cacheInit=FALSE;
+static SYS_SPINLOCK cacheLock=0;
+static SYS_ATOMIC   tmpCounter=0;  /* distingue i file temporanei dei thread */
+
+/* Con bDefault la directory viene impostata solo se nessuno l'ha gia' fatto */
+static int SetCacheDir(const char *szDir, int bDefault)
+{
+  char *dir=NULL;
+  char *old=NULL;
+  if ((szDir!=NULL)&&(*szDir!='\0')) {
+    dir=(char*)malloc(strlen(szDir)+1);
+    if (dir==NULL) return C_GENERIC_ERROR;
+    strcpy(dir,szDir);
+  }
+  SysSpinLock(&cacheLock);
+  if (bDefault&&cacheInit) old=dir;
+  else {
+    old=cacheDir;
+    cacheDir=dir;
+    cacheInit=TRUE;
+  }
+  SysSpinUnlock(&cacheLock);
+  if (old!=NULL) free(old);
+  return C_OK;
+}
+
+int CALLINGCONV SetCertificateCache(const char *szDir)
+{
+  S_TRACE("SetCertificateCache: %s\n", (szDir!=NULL)?szDir:"(null)");
+  return SetCacheDir(szDir,FALSE);
+}
+
+int CertCacheEnabled(void)
+{
+  int init, enabled;
+  SysSpinLock(&cacheLock);
+  init=cacheInit;
+  enabled=(cacheDir!=NULL);
+  SysSpinUnlock(&cacheLock);
+  if (init) return enabled;
+  SetCacheDir(getenv("LIBSIAE_CERT_CACHE"),TRUE);
+  SysSpinLock(&cacheLock);
+  enabled=(cacheDir!=NULL);
+  SysSpinUnlock(&cacheLock);
+  return enabled;
+}
+
+/* Nome del file di cache della carta: va liberato con free() */
+static char *CachePath(const BYTE serial[8], const char *suffix)
+{
+  char *path;
+  char *p;
+  int i;
+  size_t l;
+  SysSpinLock(&cacheLock);
+  if (cacheDir==NULL) {
+    SysSpinUnlock(&cacheLock);
+    return NULL;
+  }
+  l=strlen(cacheDir);
+  path=(char*)malloc(l+1+16+strlen(".siaecc")+strlen(suffix)+1);
+  if (path!=NULL) strcpy(path,cacheDir);
+  SysSpinUnlock(&cacheLock);
+  if (path==NULL) return NULL;
+  p=path+l;
+  if ((l>0)&&(p[-1]!='/')&&(p[-1]!=PATH_SEP)) *p++=PATH_SEP;
+  for (i=0; i<8; i++, p+=2) sprintf(p,"%02X",serial[i]);
+  strcpy(p,".siaecc");
+  strcat(p,suffix);
+  return path;
+}
+
+static int MapCache(const char *path, CC_MAP *m)
+{
+#ifdef WIN32
+  DWORD size;
+  memset(m,0,sizeof(*m));
+  m->hFile=CreateFileA(path,GENERIC_READ,FILE_SHARE_READ|FILE_SHARE_DELETE,NULL,
+                       OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (m->hFile==INVALID_HANDLE_VALUE) return FALSE;
+  size=GetFileSize(m->hFile,NULL);
+  if ((size==INVALID_FILE_SIZE)||(size==0)||(size>CERTCACHE_MAX_SIZE)) {
+    CloseHandle(m->hFile);
+    return FALSE;
+  }
+  m->hMap=CreateFileMappingA(m->hFile,NULL,PAGE_READONLY,0,0,NULL);
+  if (m->hMap==NULL) {
+    CloseHandle(m->hFile);
+    return FALSE;
+  }
+  m->base=(const BYTE*)MapViewOfFile(m->hMap,FILE_MAP_READ,0,0,0);
+  if (m->base==NULL) {
+    CloseHandle(m->hMap);
+    CloseHandle(m->hFile);
+    return FALSE;
+  }
+  m->size=size;
+  return TRUE;
+#else
+  struct stat st;
+  void *base;
+  int fd;
+  memset(m,0,sizeof(*m));
+  fd=open(path,O_RDONLY);
+  if (fd<0) return FALSE;
+  if ((fstat(fd,&st)!=0)||(st.st_size==0)||(st.st_size>CERTCACHE_MAX_SIZE)) {
+    close(fd);
+    return FALSE;
+  }
+  base=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (base==MAP_FAILED) return FALSE;
+  m->base=(const BYTE*)base;
+  m->size=(size_t)st.st_size;
+  return TRUE;
+#endif
+}
+
+static void UnmapCache(CC_MAP *m)
+{
+  if (m->base==NULL) return;
+#ifdef WIN32
+  UnmapViewOfFile((LPCVOID)m->base);
+  CloseHandle(m->hMap);
+  CloseHandle(m->hFile);
+#else
+  munmap((void*)m->base,m->size);
+#endif
+  m->base=NULL;
+}
+
+/* Verifica che il file mappato sia una cache integra della carta serial */
+static const CC_HEADER *CheckCache(const CC_MAP *m, const BYTE serial[8])
+{
+  const CC_HEADER *h=(const CC_HEADER*)m->base;
+  const CC_ENTRY *e;
+  unsigned int i;
+  if (m->size<sizeof(CC_HEADER)) return NULL;
+  if (memcmp(h->magic,CERTCACHE_MAGIC,8)!=0) return NULL;
+  if (memcmp(h->serial,serial,8)!=0) return NULL;
+  if ((h->entrySize!=sizeof(CC_ENTRY))||(h->nEntries>CERTCACHE_MAX_ENTRIES)) return NULL;
+  if (m->size<sizeof(CC_HEADER)+h->nEntries*sizeof(CC_ENTRY)) return NULL;
+  e=(const CC_ENTRY*)(h+1);
+  for (i=0; i<h->nEntries; i++) {
+    if ((e[i].offset>m->size)||(e[i].len>m->size-e[i].offset)) return NULL;
+    if (e[i].fpLen>CERT_FP_LEN) return NULL;
+  }
+  return h;
+}
+
+int CertCacheLookup(const BYTE serial[8], WORD kind, WORD fid,
+                    const BYTE *fp, int fpLen, BYTE *data, int *len)
+{
+  const CC_HEADER *h;
+  const CC_ENTRY *e;
+  CC_MAP m;
+  char *path;
+  unsigned int i;
+  int rv=C_GENERIC_ERROR;
+
+  if (!CertCacheEnabled()||(len==NULL)) return C_GENERIC_ERROR;
+  if ((fpLen<0)||(fpLen>CERT_FP_LEN)) return C_GENERIC_ERROR;
+  path=CachePath(serial,"");
+  if (path==NULL) return C_GENERIC_ERROR;
+  if (!MapCache(path,&m)) {
+    free(path);
+    return C_GENERIC_ERROR;
+  }
+  free(path);
+
+  h=CheckCache(&m,serial);
+  if (h!=NULL) {
+    e=(const CC_ENTRY*)(h+1);
+    for (i=0; i<h->nEntries; i++) {
+      if ((e[i].kind!=kind)||(e[i].fid!=fid)) continue;
+      /* impronta diversa: l'oggetto sulla carta e' cambiato */
+      if ((e[i].fpLen!=(unsigned int)fpLen)||(memcmp(e[i].fp,fp,fpLen)!=0)) break;
+      if (data==NULL) rv=C_OK;
+      else if (*len<(int)e[i].len) rv=C_WRONG_LEN;
+      else {
+        memcpy(data,m.base+e[i].offset,e[i].len);
+        rv=C_OK;
+      }
+      *len=(int)e[i].len;
+      break;
+    }
+  }
+  UnmapCache(&m);
+  S_TRACE("CertCacheLookup: kind=%d, fid=0x%04X, rv=0x%04X\n", kind, fid, rv);
+  return rv;
+}
+
+void CertCacheStore(const BYTE serial[8], WORD kind, WORD fid,
+                    const BYTE *fp, int fpLen, const BYTE *data, int len)
+{
+  const CC_HEADER *h=NULL;
+  const CC_ENTRY *e;
+  CC_ENTRY ent[CERTCACHE_MAX_ENTRIES];
+  const BYTE *src[CERTCACHE_MAX_ENTRIES];
+  CC_HEADER hdr;
+  CC_MAP m;
+  char *path=NULL;
+  char *tmpPath=NULL;
+  char suffix[32];
+  BYTE *image=NULL;
+  size_t total;
+  unsigned int n=0, i;
+  FILE *f;
+
+  if (!CertCacheEnabled()) return;
+  if ((fpLen<0)||(fpLen>CERT_FP_LEN)||(len<=0)||(len>CERTCACHE_MAX_SIZE/4)) return;
+  path=CachePath(serial,"");
+#ifdef WIN32
+  sprintf(suffix,".%lu.%ld",(unsigned long)GetCurrentProcessId(),SysAtomicAdd(&tmpCounter,1));
+#else
+  sprintf(suffix,".%lu.%ld",(unsigned long)getpid(),SysAtomicAdd(&tmpCounter,1));
+#endif
+  tmpPath=CachePath(serial,suffix);
+  if ((path==NULL)||(tmpPath==NULL)) goto CleanUp;
+
+  /* Si conservano gli altri oggetti gia' presenti per la stessa carta */
+  if (MapCache(path,&m)) h=CheckCache(&m,serial);
+  else m.base=NULL;
+  total=sizeof(CC_HEADER);
+  if (h!=NULL) {
+    e=(const CC_ENTRY*)(h+1);
+    for (i=0; (i<h->nEntries)&&(n<CERTCACHE_MAX_ENTRIES-1); i++) {
+      if ((e[i].kind==kind)&&(e[i].fid==fid)) continue;
+      ent[n]=e[i];
+      src[n]=m.base+e[i].offset;
+      total+=e[i].len;
+      n++;
+    }
+  }
+  memset(&ent[n],0,sizeof(ent[n]));
+  ent[n].kind=kind;
+  ent[n].fid=fid;
+  ent[n].len=(unsigned int)len;
+  ent[n].fpLen=(unsigned int)fpLen;
+  memcpy(ent[n].fp,fp,fpLen);
+  src[n]=data;
+  total+=len;
+  n++;
+  total+=n*sizeof(CC_ENTRY);
+
+  image=(BYTE*)malloc(total);
+  if (image!=NULL) {
+    size_t off=sizeof(CC_HEADER)+n*sizeof(CC_ENTRY);
+    memset(&hdr,0,sizeof(hdr));
+    memcpy(hdr.magic,CERTCACHE_MAGIC,8);
+    memcpy(hdr.serial,serial,8);
+    hdr.entrySize=sizeof(CC_ENTRY);
+    hdr.nEntries=n;
+    for (i=0; i<n; i++) {
+      ent[i].offset=(unsigned int)off;
+      memcpy(image+off,src[i],ent[i].len);
+      off+=ent[i].len;
+    }
+    memcpy(image,&hdr,sizeof(hdr));
+    memcpy(image+sizeof(hdr),ent,n*sizeof(CC_ENTRY));
+  }
+  UnmapCache(&m);
+  if (image==NULL) goto CleanUp;
+
+  /* Scrittura su file temporaneo e rinomina: chi legge in parallelo vede */
+  /* sempre un file completo                                              */
+  f=fopen(tmpPath,"wb");
+  if (f==NULL) goto CleanUp;
+  i=(fwrite(image,1,total,f)==total);
+  if (fclose(f)!=0) i=FALSE;
+#ifdef WIN32
+  if (!i||!MoveFileExA(tmpPath,path,MOVEFILE_REPLACE_EXISTING)) remove(tmpPath);
+#else
+  if (!i||(rename(tmpPath,path)!=0)) remove(tmpPath);
+#endif
+  S_TRACE("CertCacheStore: kind=%d, fid=0x%04X, len=%d, ok=%d\n", kind, fid, len, i);
+
+CleanUp:
+  if (image!=NULL) free(image);
+  if (path!=NULL) free(path);
+  if (tmpPath!=NULL) free(tmpPath);
+}
@@ -0,0 +1,37 @@
+#ifndef CERTCACHE_H
+#define CERTCACHE_H
+
+#include "libsiaecardt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Cache su disco dei certificati della carta, indicizzata per numero di */
+/* serie. E' disattivata finche' non viene indicata una directory con    */
+/* SetCertificateCache() o con la variabile d'ambiente LIBSIAE_CERT_CACHE. */
+
+/* Tipi di oggetto memorizzati */
+#define CERTCACHE_CERT           1   /* contenuto dell'EF di un certificato */
+
+int  CertCacheEnabled(void);
+
+/* Cerca l'oggetto (kind,fid) della carta serial la cui impronta       */
+/* (al massimo CERT_FP_LEN byte) coincide con fp. Con data==NULL       */
+/* restituisce solo la lunghezza.                                      */
+/* Ritorna C_OK, C_WRONG_LEN se *len e' insufficiente (in *len viene   */
+/* restituita la lunghezza necessaria) oppure C_GENERIC_ERROR se       */
+/* l'oggetto non e' presente o non e' piu' valido.                     */
+int  CertCacheLookup(const BYTE serial[8], WORD kind, WORD fid,
+                     const BYTE *fp, int fpLen, BYTE *data, int *len);
+
+/* Inserisce o sostituisce l'oggetto (kind,fid) della carta serial.    */
+/* Gli errori di scrittura vengono ignorati: la cache e' solo un aiuto. */
+void CertCacheStore(const BYTE serial[8], WORD kind, WORD fid,
+                    const BYTE *fp, int fpLen, const BYTE *data, int len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // CERTCACHE_H
@@ -14,51 +14,16 @@
 #ifdef _WIN32
 #	define getpid _getpid
 #endif
-static void _S_TRACE(const char* szFormat, ...)
-{
-	char szLogPath[128] = {0};
-	time_t t;
-	struct tm m = {0};
-    FILE* f;
-	va_list va;
-    #if defined(WIN32) || defined(_WIN32)
-        char szSysPath[MAX_PATH];
-        GetSystemDirectoryA(szSysPath, sizeof(szSysPath));
-        sprintf(szLogPath, "%c:/libsiaelog/libsiae.log", szSysPath[0]);
-    #else
-        strcpy(szLogPath, "/libsiaelog/libsiae.log");
-    #endif
-    f = fopen(szLogPath, "ab+");
-    if (f)
-    {
-		t = time(NULL);
-		m = *localtime(&t);
-		fprintf(f, "[%04d, %02d:%02d:%02d, %08d] ", getpid(), m.tm_hour, m.tm_min, m.tm_sec, clock());
-        va_start(va, szFormat);
-        vfprintf(f, szFormat, va);
-        fclose (f);
-        va_end(va);
-    }
-    #ifdef _DEBUG
-    va_start(va, szFormat);
-	vfprintf(stderr, szFormat, va);
-	va_end(va);
-    #endif
-}
-
-
-#define S_TRACE _S_TRACE
-static void S_TRACE_BUFFER(const char* NAME, const unsigned char* BUFF, size_t LEN)
-{
-	size_t i;
-	size_t L = LEN * 2 + 1;
-	char* szBuf = (char*)malloc(L);
-	memset(szBuf, 0, L);
-	for(i=0;i<LEN;i++)
-		sprintf(szBuf+(i*2), "%02X", BUFF[i]);
-	_S_TRACE("%s -> %s\n", NAME, szBuf);
-	free(szBuf);
-}
+#include "tracelog.h"
+
+/* Traccia diagnostica, scritta in modo asincrono da tracelog.c */
+#define S_TRACE(...)        TRACE_AT(TRACE_LEVEL_INFO,__VA_ARGS__)
+#define S_TRACE_ERROR(...)  TRACE_AT(TRACE_LEVEL_ERROR,__VA_ARGS__)
+#define S_TRACE_APDU(...)   TRACE_AT(TRACE_LEVEL_APDU,__VA_ARGS__)
+#define S_TRACE_BUFFER(name,buf,len) TRACE_BUFFER_AT(TRACE_LEVEL_APDU,name,buf,len)
+
+/* PIN e PUK non compaiono mai nella traccia */
+#define S_SECRET(s) (((s)!=NULL)?"***":"(null)")
 
 #ifdef __cplusplus
 extern "C" {
@@ -74,7 +39,9 @@ extern "C" {
 #endif
 
 /* Costanti */
-#define EXCHANGE_BUFFER 128
+#define EXCHANGE_BUFFER 128     /* blocco di READ BINARY gestito da tutti i lettori */
+#define MAX_READ_BLOCK  1024    /* blocco massimo; oltre 256 byte serve l'APDU estesa */
+#define MAX_READER_NAME 128
 
 /* FID NOTEVOLI */
 #define FID_MF              0x3f00
@@ -83,6 +50,11 @@ extern "C" {
 #define FID_SIAE_CNT_DOMAIN 0x1112
 #define FID_EF_CNT          0x1000
 #define FID_EF_BALANCE_CNT  0x1001
+#define FID_EF_GDO          0x2f02
+#define FID_EF_KEY_STATUS   0x5f02
+#define FID_EF_CA_CERT      0x4101
+#define FID_EF_SIAE_CERT    0x4102
+#define FID_NONE            0xffff
 
 /* APDU */
 #define APDU_SELECT         0x00a40000
@@ -102,6 +74,68 @@ extern "C" {
 #define SW_WRONG_LENGTH     0x6282
 #define SW_AUTH_FAILED      0x6300
 
+/* Esito di una READ BINARY di len byte che indica un blocco troppo grande */
+/* per il lettore o la carta: errore di trasporto, 6700, 6Fxx, oppure 6C00 */
+/* quando la carta non puo' indicare una lunghezza oltre 256               */
+#define READ_BLOCK_REJECTED(rv,sw,len) \
+  (((rv)==C_GENERIC_ERROR)||(((rv)==C_OK)&&(((sw)==0x6700)||(((sw)&0xff00)==0x6f00)|| \
+   (((sw)==0x6c00)&&((len)>256)))))
+
+/* Modello del file correntemente selezionato sulla carta di uno slot.   */
+/* Consente a SelectML di evitare le SELECT che non cambierebbero il     */
+/* file corrente. Il modello presuppone che la carta sia usata soltanto  */
+/* da questa libreria e viene invalidato (valid=FALSE) su reset, reconnect, */
+/* FinalizeML, status word inattese e SELECT inviate con SendAPDU.       */
+#define MAX_DF_DEPTH        4
+
+typedef struct _SELECT_STATE {
+  int  valid;                 /* il modello rispecchia lo stato della carta */
+  int  depth;                 /* numero di DF nel path corrente             */
+  WORD path[MAX_DF_DEPTH];    /* DF a partire dall'MF                       */
+  WORD ef;                    /* EF selezionato, FID_NONE se nessuno        */
+  DWORD forgotten;            /* incrementato a ogni reset/rimozione        */
+} SELECT_STATE;
+
+/* Metadati della carta inserita in uno slot. Sono invarianti finche' la  */
+/* carta resta nel lettore: vengono letti al primo utilizzo e scartati    */
+/* insieme al modello della SELECT (reset, rimozione, FinalizeML).        */
+#define MAX_CACHED_CERTS    4
+#define CERT_FP_LEN         64  /* byte iniziali dell'EF usati come impronta */
+#define MAX_CACHED_IAS      512 /* IssuerAndSerialNumber DER piu' lungo      */
+
+#define PIN_PAD_UNKNOWN     0
+#define PIN_PAD_NONE        1   /* la carta accetta il PIN cosi' com'e'   */
+#define PIN_PAD_8           2   /* il PIN va completato a 8 byte con 0x00 */
+
+typedef struct _SESSION_CACHE {
+  int  hasSN;
+  BYTE serial[8];
+  BYTE keyID;                 /* 0 se non ancora letto                      */
+  int  nCerts;
+  WORD certFid[MAX_CACHED_CERTS];
+  int  certLen[MAX_CACHED_CERTS];
+  int  certFpLen[MAX_CACHED_CERTS];
+  BYTE certFp[MAX_CACHED_CERTS][CERT_FP_LEN];
+  int  pinPadding;            /* PIN_PAD_xxx                                */
+  BYTE iasKeyID;              /* chiave del certificato di ias, 0 se vuoto  */
+  int  iasLen;
+  BYTE ias[MAX_CACHED_IAS];   /* IssuerAndSerialNumber per PKCS7SignML      */
+} SESSION_CACHE;
+
+/* Stato dello slot conservato da scardhal.c: i puntatori restituiti vanno */
+/* usati soltanto tra BeginTransactionML e EndTransactionML                */
+SELECT_STATE  *SlotSelectState(int nSlot);
+SESSION_CACHE *SlotSession(int nSlot);
+/* Puntatore alle statistiche dello slot, NULL se lo slot non esiste */
+void *volatile *SlotStatsRef(int nSlot);
+
+/* IssuerAndSerialNumber del certificato della chiave kid, conservato   */
+/* nella cache di sessione (quindi per la carta presente nello slot).   */
+/* GetSessionIssuerSerial ritorna C_GENERIC_ERROR se non e' presente o  */
+/* se *len e' insufficiente.                                            */
+int  GetSessionIssuerSerial(BYTE kid, BYTE *ias, int *len, int nSlot);
+void SetSessionIssuerSerial(BYTE kid, const BYTE *ias, int len, int nSlot);
+
 #ifdef __cplusplus
 };
 #endif
@@ -8,25 +8,142 @@
 #include "libsiaecard.h"
 #include "scardhal.h"
 #include "internals.h"
+#include "certcache.h"
+#include "stats.h"
+#include "probes.h"
 
 extern int defSlot;
-extern SCARDHANDLE hCards[MAX_READERS];
+
+/* Path assoluti dei file utilizzati dalla libreria */
+static const WORD PathEFCnt[]        = {FID_MF,FID_SIAE_APP_DOMAIN,FID_SIAE_CNT_DOMAIN,FID_EF_CNT};
+static const WORD PathEFBalance[]    = {FID_MF,FID_SIAE_APP_DOMAIN,FID_SIAE_CNT_DOMAIN,FID_EF_BALANCE_CNT};
+static const WORD PathP11Domain[]    = {FID_MF,FID_SIAE_APP_DOMAIN,FID_P11_APP_DOMAIN};
+static const WORD PathEFKeyStatus[]  = {FID_MF,FID_SIAE_APP_DOMAIN,FID_P11_APP_DOMAIN,FID_EF_KEY_STATUS};
+static const WORD PathEFGdo[]        = {FID_MF,FID_EF_GDO};
+#define PATH_LEN(p) ((int)(sizeof(p)/sizeof((p)[0])))
+
+static int IsDF(WORD fid)
+{
+  return (fid==FID_MF)||(fid==FID_SIAE_APP_DOMAIN)||
+         (fid==FID_P11_APP_DOMAIN)||(fid==FID_SIAE_CNT_DOMAIN);
+}
+
+/* EF noti: contatori, GDO, stato chiavi, certificati CA/SIAE e certificati */
+/* utente (FID 0x1a02, 0x1b02, ... associati alle chiavi)                    */
+static int IsKnownEF(WORD fid)
+{
+  if ((fid==FID_EF_CNT)||(fid==FID_EF_BALANCE_CNT)||(fid==FID_EF_GDO)||
+      (fid==FID_EF_KEY_STATUS)||(fid==FID_EF_CA_CERT)||(fid==FID_EF_SIAE_CERT))
+    return TRUE;
+  return ((fid&0x00ff)==0x02)&&((fid>>8)>=0x1a)&&((fid>>8)<0x2a);
+}
+
+/* Calcola in pNext lo stato che la carta assume dopo la SELECT di fid. */
+/* Ritorna FALSE se lo stato risultante non e' prevedibile.            */
+static int NextSelectState(const SELECT_STATE *pCur, WORD fid, SELECT_STATE *pNext)
+{
+  *pNext=*pCur;
+  pNext->ef=FID_NONE;
+  if (fid==FID_MF) {
+    pNext->valid=TRUE;
+    pNext->depth=1;
+    pNext->path[0]=FID_MF;
+    return TRUE;
+  }
+  if (!pCur->valid) return FALSE;
+  if (!IsDF(fid)) {
+    if (!IsKnownEF(fid)) return FALSE;
+    pNext->ef=fid;
+    return TRUE;
+  }
+  if (fid==pCur->path[pCur->depth-1]) return TRUE;           /* DF corrente */
+  if ((pCur->depth>1)&&(fid==pCur->path[pCur->depth-2])) {   /* DF padre    */
+    pNext->depth--;
+    return TRUE;
+  }
+  if (pCur->depth<MAX_DF_DEPTH) {                            /* DF figlio   */
+    pNext->path[pNext->depth++]=fid;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static int SameSelectState(const SELECT_STATE *a, const SELECT_STATE *b)
+{
+  if ((!a->valid)||(!b->valid)) return FALSE;
+  if ((a->depth!=b->depth)||(a->ef!=b->ef)) return FALSE;
+  return memcmp(a->path,b->path,a->depth*sizeof(WORD))==0;
+}
 
 int CALLINGCONV SelectML(WORD fid, int nSlot)
 {
   WORD SW;
   int x;
+  int known, wasValid;
+  DWORD forgotten;
+  SELECT_STATE next;
+  SELECT_STATE *pCur;
   BYTE pSend[2];
   pSend[0]=(BYTE)((fid&0xff00)>>8);
   pSend[1]=(BYTE)(fid&0x00ff);
-  BeginTransactionML(nSlot);
+  S_PROBE2(call__entry,"SelectML",nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  pCur=SlotSelectState(nSlot);
+  known=NextSelectState(pCur,fid,&next);
+  if (known&&SameSelectState(pCur,&next)) {
+    /* la SELECT non cambierebbe il file corrente */
+    EndTransactionML(nSlot);
+    S_PROBE3(call__return,"SelectML",nSlot,C_OK);
+    return C_OK;
+  }
+  wasValid=pCur->valid;
+  forgotten=pCur->forgotten;
   x=SendAPDUML(nSlot,APDU_SELECT,2,0,pSend,0,&SW);
+  /* SendAPDUML invalida il modello a ogni SELECT: lo si aggiorna se la */
+  /* SELECT e' riuscita e nel frattempo la carta non e' stata resettata */
+  /* (salvo la SELECT dell'MF, il cui risultato e' comunque noto)       */
+  if ((x==C_OK)&&(SW==0x9000)&&known&&
+      ((wasValid&&(pCur->forgotten==forgotten))||(fid==FID_MF))) {
+    next.forgotten=pCur->forgotten;
+    *pCur=next;
+  }
+  else pCur->valid=FALSE;
   EndTransactionML(nSlot);
+  S_PROBE3(call__return,"SelectML",nSlot,(x!=C_OK)?x:SW);
   if (x!=C_OK) return x;
   if (SW!=0x9000) return SW;
   return C_OK;
 }
 
+/* SelectPathML seleziona il file individuato da un path assoluto (a      */
+/* partire dall'MF) inviando soltanto le SELECT necessarie a partire dal  */
+/* DF corrente: se il DF corrente e' gia' sul path si scende da li', se e' */
+/* un figlio di un DF del path si risale al padre, altrimenti si riparte  */
+/* dall'MF.                                                               */
+static int SelectPathML(const WORD *path, int n, int nSlot)
+{
+  int rv=C_OK;
+  int nDF, common, start, i;
+  const SELECT_STATE *pCur;
+
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  pCur=SlotSelectState(nSlot);
+  nDF=IsDF(path[n-1])?n:n-1;
+  start=0;
+  if (pCur->valid) {
+    for (common=0;(common<nDF)&&(common<pCur->depth);common++)
+      if (pCur->path[common]!=path[common]) break;
+    if (common==pCur->depth) start=common;
+    else if ((common>0)&&(common==pCur->depth-1)) start=common-1;
+  }
+  for (i=start;i<n;i++) {
+    rv=SelectML(path[i],nSlot);
+    if (rv!=C_OK) break;
+  }
+  EndTransactionML(nSlot);
+  return rv;
+}
+
 int CALLINGCONV Select(WORD fid)
 {
   return SelectML(fid,defSlot);
@@ -37,53 +154,63 @@ int CALLINGCONV ReadBinaryML(WORD Offset, BYTE *Buffer, int *Len, int nSlot)
   int rv=C_OK;
   WORD SW=0;
   WORD Offset1;
-  DWORD dimDati;
-  DWORD index;
-  BYTE blockLen;
+  int dimDati;
+  int blockLen;
+  int q;
   int letti=0;
-  BYTE tmpBuffer[256];
+  S_PROBE2(call__entry,"ReadBinaryML",nSlot);
   /* Verifica dei parametri */
   if (!IsInitialized())
     return C_NOT_INITIALIZED;
   if (Buffer==NULL)
     return C_GENERIC_ERROR;
-  if ((Len==NULL)||(*Len==0))
+  if ((Len==NULL)||(*Len<=0))
     return C_GENERIC_ERROR;
   Offset1 = Offset;
   dimDati = *Len;
-  index=0;
-  blockLen=EXCHANGE_BUFFER;
-
-  /* Il buffer viene letto a blocchi di dimensioni pari a EXCHANGE_BUFFER.  */
-  /* Il valore massimo di EXCHANGE_BUFFER secondo le specifiche PC/SC  249 */
-  /* tuttavia non tutti i lettori riescono a lavorare correttamente con     */
-  /* buffer di tali dimensioni.                                             */
-  BeginTransactionML(nSlot);
-  while (dimDati>=EXCHANGE_BUFFER) {
-    rv=SendAPDUML(nSlot,APDU_READBINARY|Offset1,0,&blockLen,0,tmpBuffer,&SW);
-    if (rv!=C_OK) { goto CleanUp;}
-    if ((SW!=SW_OK)&&(SW!=SW_WRONG_LENGTH)) { rv = SW; goto CleanUp;}
-    memcpy(Buffer+letti,tmpBuffer,blockLen);
-    if (blockLen!=EXCHANGE_BUFFER) {
-      *Len=letti;
-      rv = C_WRONG_LENGTH;
-	  goto CleanUp;
+
+  /* Il buffer viene letto a blocchi la cui dimensione dipende dal lettore */
+  /* (GetReadBlockML): si parte dal blocco piu' grande, anche con APDU     */
+  /* estese, e se il lettore o la carta lo rifiutano si ritenta lo stesso  */
+  /* blocco con la dimensione inferiore, fino a EXCHANGE_BUFFER che tutti  */
+  /* i lettori gestiscono. La dimensione raggiunta resta associata al      */
+  /* lettore, che Initialize ha gia' provato alla prima connessione.       */
+  /* Conta come rifiuto solo READ_BLOCK_REJECTED: una risposta 9000 piu'   */
+  /* corta del blocco indica la fine dell'EF e con 6Cxx si rilegge subito  */
+  /* il numero di byte indicato dalla carta.                               */
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  while (letti<dimDati) {
+    blockLen=GetReadBlockML(nSlot);
+    if (blockLen>dimDati-letti) blockLen=dimDati-letti;
+    q=blockLen;
+    rv=ReadBinaryBlockML(nSlot,Offset1,Buffer+letti,&q,&SW);
+    if ((blockLen>EXCHANGE_BUFFER)&&READ_BLOCK_REJECTED(rv,SW,blockLen)) {
+      S_TRACE_ERROR("ReadBinaryML: block of %d bytes rejected (rv=%d, SW=0x%04X)\n", blockLen, rv, SW);
+      if (LowerReadBlockML(nSlot)) {
+        rv=C_OK;
+        continue;
+      }
+    }
+    if ((rv==C_OK)&&((SW&0xff00)==0x6c00)) {
+      q=(SW&0xff)?(SW&0xff):256;
+      if (q>blockLen) q=blockLen;
+      rv=ReadBinaryBlockML(nSlot,Offset1,Buffer+letti,&q,&SW);
     }
-    dimDati-=EXCHANGE_BUFFER;
-    letti+=blockLen;
-    Offset1 = (WORD)(Offset1 + blockLen);
-  }
-  if (dimDati>0) {
-    rv=SendAPDUML(nSlot,APDU_READBINARY|Offset1,0,(BYTE*)&dimDati,0,tmpBuffer,&SW);
     if (rv!=C_OK) { goto CleanUp;}
     if ((SW!=SW_OK)&&(SW!=SW_WRONG_LENGTH)) { rv = SW; goto CleanUp;}
-    memcpy(Buffer+letti,tmpBuffer,dimDati);
-    letti+=dimDati;
+    letti+=q;
+    Offset1 = (WORD)(Offset1 + q);
+    if (q<blockLen) {
+      /* L'EF e' terminato prima: e' un errore solo se non si tratta */
+      /* dell'ultimo blocco richiesto                                */
+      if (letti-q+blockLen<dimDati) rv = C_WRONG_LENGTH;
+      break;
+    }
   }
-  if ((rv!=C_OK)&&(rv!=SW_WRONG_LENGTH)) { rv = SW; goto CleanUp;}
   *Len=letti;
 CleanUp:
   EndTransactionML(nSlot);
+  S_PROBE3(call__return,"ReadBinaryML",nSlot,rv);
   return rv;
 }
 
@@ -94,19 +221,29 @@ int CALLINGCONV ReadBinary(WORD Offset, BYTE *Buffer, int *Len)
 
 int CALLINGCONV GetSNML(BYTE serial[8], int nSlot)
 {
-  int rv;
+  int rv=C_OK;
   int l=26;
   BYTE ef_gdo[26];
+  SESSION_CACHE *pSess;
+  S_PROBE2(call__entry,"GetSNML",nSlot);
   if (!IsInitialized())     return C_NOT_INITIALIZED;
 
-  BeginTransactionML(nSlot);
-  if (SelectML(0x3f00,nSlot)!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  if (SelectML(0x2f02,nSlot)!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  if (ReadBinaryML(0,ef_gdo,&l,nSlot)!=C_OK) {rv= C_GENERIC_ERROR; goto CleanUp;}
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  /* Il numero di serie non cambia finche' la carta resta nel lettore */
+  pSess=SlotSession(nSlot);
+  if (pSess->hasSN) {
+    memcpy(serial,pSess->serial,8);
+    goto CleanUp;
+  }
+  if (SelectPathML(PathEFGdo,PATH_LEN(PathEFGdo),nSlot)!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
+  if ((ReadBinaryML(0,ef_gdo,&l,nSlot)!=C_OK)||(l<26)) {rv= C_GENERIC_ERROR; goto CleanUp;}
   memcpy(serial,&ef_gdo[18],8);
+  memcpy(pSess->serial,serial,8);
+  pSess->hasSN=TRUE;
 CleanUp:
   EndTransactionML(nSlot);
-  return C_OK;
+  S_PROBE3(call__return,"GetSNML",nSlot,rv);
+  return rv;
 }
 
 int CALLINGCONV GetSN(BYTE serial[8])
@@ -118,17 +255,19 @@ int CALLINGCONV ReadRecordML( int nRec, BYTE* Buffer, int *Len, int nSlot)
 {
   WORD SW=0;
   int rv=C_OK;
+  S_PROBE2(call__entry,"ReadRecordML",nSlot);
   if (!IsInitialized()) return C_NOT_INITIALIZED;
   if ((Buffer==NULL)&&(Len==NULL)) return C_GENERIC_ERROR;
   if ((Len==NULL)||(*Len>255)) return C_WRONG_LENGTH;
   if (nRec>255) return C_RECORD_NOT_FOUND;
 
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
   rv=SendAPDUML(nSlot,APDU_READRECORD|0x00000004|(WORD)(nRec<<8),0,(BYTE*)Len,NULL,Buffer,&SW);
   if (rv!=C_OK) {goto CleanUp;}
   if (SW!=SW_OK) {rv = SW; goto CleanUp;}
 CleanUp:
   EndTransactionML(nSlot);
+  S_PROBE3(call__return,"ReadRecordML",nSlot,rv);
   return rv;
 }
 
@@ -139,18 +278,26 @@ int CALLINGCONV ReadRecord( int nRec, BYTE* Buffer, int *Len)
 
 int CALLINGCONV VerifyPINML(int nPIN, char *pin, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD SW=0;
-  S_TRACE("VerifyPINML: %d, %s, %d\n", nPIN, pin, nSlot);
+  S_TRACE("VerifyPINML: %d, %s, %d\n", nPIN, S_SECRET(pin), nSlot);
+  S_PROBE2(call__entry,"VerifyPINML",nSlot);
 
   if (!IsInitialized()) return C_NOT_INITIALIZED;
   if (nPIN!=1) {
-	  S_TRACE("VerifyPINML: invalid pin ID \n");
+	  S_TRACE_ERROR("VerifyPINML: invalid pin ID \n");
 	  return C_GENERIC_ERROR;
   }
-  BeginTransactionML(nSlot);
-  rv=SendAPDUML(nSlot,APDU_VERIFYPIN|0x00000081,(BYTE)strlen(pin),NULL,(BYTE*)pin,NULL,&SW);
-  if (rv!=C_OK) {goto CleanUp;}
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  /* Se la carta ha gia' rifiutato un PIN non completato a 8 byte si */
+  /* evita il primo tentativo, destinato a fallire con 0x6700        */
+  if (SlotSession(nSlot)->pinPadding==PIN_PAD_8) SW=0x6700;
+  else {
+    rv=SendAPDUML(nSlot,APDU_VERIFYPIN|0x00000081,(BYTE)strlen(pin),NULL,(BYTE*)pin,NULL,&SW);
+    if (rv!=C_OK) {goto CleanUp;}
+    if ((SW!=0x6700)&&(strlen(pin)!=8)) SlotSession(nSlot)->pinPadding=PIN_PAD_NONE;
+  }
 
   if (SW==0x6700)
   {
@@ -159,6 +306,7 @@ int CALLINGCONV VerifyPINML(int nPIN, char *pin, int nSlot)
 	  memcpy(nPin, pin, min(strlen(pin), 8) );
 	  rv=SendAPDUML(nSlot,APDU_VERIFYPIN|0x00000081,(BYTE)8,NULL,(BYTE*)nPin,NULL,&SW);
 	  if (rv!=C_OK) {goto CleanUp;}
+	  if (SW!=0x6700) SlotSession(nSlot)->pinPadding=PIN_PAD_8;
   }
 
   if (SW==SW_AUTH_FAILED)
@@ -170,6 +318,8 @@ int CALLINGCONV VerifyPINML(int nPIN, char *pin, int nSlot)
   if (SW!=SW_OK) {rv = SW; goto CleanUp;}
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_VERIFYPIN,tStart,rv);
+  S_PROBE3(call__return,"VerifyPINML",nSlot,rv);
   S_TRACE("VerifyPINML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -181,11 +331,13 @@ int CALLINGCONV VerifyPIN(int nPIN, char *pin)
 
 int CALLINGCONV ChangePINML(int nPIN, char *Oldpin, char *Newpin, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD SW=0;
   BYTE sBuff[256];
   
-  S_TRACE("ChangePINML: %d, %s, %s, %d\n", nPIN, Oldpin, Newpin, nSlot);
+  S_TRACE("ChangePINML: %d, %s, %s, %d\n", nPIN, S_SECRET(Oldpin), S_SECRET(Newpin), nSlot);
+  S_PROBE2(call__entry,"ChangePINML",nSlot);
 
   if (!IsInitialized()) return C_NOT_INITIALIZED;
   if (nPIN!=1) return C_GENERIC_ERROR;
@@ -193,7 +345,7 @@ int CALLINGCONV ChangePINML(int nPIN, char *Oldpin, char *Newpin, int nSlot)
   memcpy(sBuff,Oldpin,strlen(Oldpin));
   memcpy(sBuff+8,Newpin,strlen(Newpin));
   
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
 
   rv=SendAPDUML(nSlot,APDU_CRD|0x00000081,16,0,sBuff,NULL,&SW);
   if (rv!=C_OK) goto CleanUp;
@@ -210,6 +362,8 @@ int CALLINGCONV ChangePINML(int nPIN, char *Oldpin, char *Newpin, int nSlot)
 
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_CHANGEPIN,tStart,rv);
+  S_PROBE3(call__return,"ChangePINML",nSlot,rv);
   S_TRACE("ChangePINML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -221,10 +375,12 @@ int CALLINGCONV ChangePIN(int nPIN, char *Oldpin, char *Newpin)
 
 int CALLINGCONV UnblockPINML(int nPIN, char *Puk, char *Newpin, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD SW=0;
   BYTE sBuff[256], oBuff[128]; BYTE bLen;
-  S_TRACE("UnblockPINML: %d, %s, %s, %d\n", nPIN, Puk, Newpin, nSlot);
+  S_TRACE("UnblockPINML: %d, %s, %s, %d\n", nPIN, S_SECRET(Puk), S_SECRET(Newpin), nSlot);
+  S_PROBE2(call__entry,"UnblockPINML",nSlot);
 
   if (!IsInitialized()) return C_NOT_INITIALIZED;
   if (nPIN!=1) return C_GENERIC_ERROR;
@@ -233,7 +389,7 @@ int CALLINGCONV UnblockPINML(int nPIN, char *Puk, char *Newpin, int nSlot)
   memcpy(sBuff+8,Newpin,strlen(Newpin));
   bLen = 0;
 
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
   rv=SendAPDUML(nSlot,APDU_RRC|0x00000081,16,&bLen,sBuff,oBuff,&SW);
   if (rv!=C_OK) goto CleanUp;
   if (SW==SW_AUTH_FAILED)
@@ -247,6 +403,8 @@ int CALLINGCONV UnblockPINML(int nPIN, char *Puk, char *Newpin, int nSlot)
   if (SW!=SW_OK) {rv= SW; goto CleanUp;}
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_UNBLOCKPIN,tStart,rv);
+  S_PROBE3(call__return,"UnblockPINML",nSlot,rv);
   S_TRACE("UnblockPINML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -258,23 +416,19 @@ int CALLINGCONV UnblockPIN(int nPIN, char *Puk, char *Newpin)
 
 int CALLINGCONV ReadCounterML(DWORD *value,int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD SW=0;
   BYTE tmp[4];
   BYTE len=4;
 
   S_TRACE("ReadCounterML: %d\n", nSlot);
+  S_PROBE2(call__entry,"ReadCounterML",nSlot);
   if (!IsInitialized()) return C_NOT_INITIALIZED;
 
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
 
-  rv=SelectML(FID_MF,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_SIAE_APP_DOMAIN,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_SIAE_CNT_DOMAIN,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_EF_CNT,nSlot);
+  rv=SelectPathML(PathEFCnt,PATH_LEN(PathEFCnt),nSlot);
   if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
   rv=SendAPDUML(nSlot,APDU_READ_COUNTER,0,&len,NULL,tmp,&SW);
   if (rv!=C_OK) goto CleanUp;
@@ -284,6 +438,8 @@ int CALLINGCONV ReadCounterML(DWORD *value,int nSlot)
 
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_READCOUNTER,tStart,rv);
+  S_PROBE3(call__return,"ReadCounterML",nSlot,rv);
   S_TRACE("ReadCounterML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -295,24 +451,20 @@ int CALLINGCONV ReadCounter(DWORD *value)
 
 int CALLINGCONV ReadBalanceML(DWORD *value, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD SW=0;
   BYTE tmp[4];
   BYTE len=4;
 
   S_TRACE("ReadBalanceML: %d\n", nSlot);
+  S_PROBE2(call__entry,"ReadBalanceML",nSlot);
 
   if (!IsInitialized()) return C_NOT_INITIALIZED;
 
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
 
-  rv=SelectML(FID_MF,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_SIAE_APP_DOMAIN,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_SIAE_CNT_DOMAIN,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_EF_BALANCE_CNT,nSlot);
+  rv=SelectPathML(PathEFBalance,PATH_LEN(PathEFBalance),nSlot);
   if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
   rv=SendAPDUML(nSlot,APDU_READ_COUNTER,0,&len,NULL,tmp,&SW);
   if (rv!=C_OK) goto CleanUp;
@@ -322,6 +474,8 @@ int CALLINGCONV ReadBalanceML(DWORD *value, int nSlot)
 
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_READBALANCE,tStart,rv);
+  S_PROBE3(call__return,"ReadBalanceML",nSlot,rv);
   S_TRACE("ReadBalanceML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -331,9 +485,22 @@ int CALLINGCONV ReadBalance(DWORD *value)
   return ReadBalanceML(value, defSlot);
 }
 
+/* Prepara il challenge di 22 byte per l'APDU CMP_SIGILLO */
+static void SigilloChallenge(BYTE *pSend, BYTE *Data_Ora, DWORD Prezzo, BYTE *SN)
+{
+  memcpy(pSend,(BYTE*)"\x00\x01",2);
+  memcpy(pSend+2,SN,8);
+  memcpy(pSend+10,Data_Ora,8);
+  pSend[18]=(BYTE)((Prezzo&0xff000000)>>24);
+  pSend[19]=(BYTE)((Prezzo&0x00ff0000)>>16);
+  pSend[20]=(BYTE)((Prezzo&0x0000ff00)>>8);
+  pSend[21]=(BYTE) (Prezzo&0x000000ff);
+}
+
 int CALLINGCONV ComputeSigilloML(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,
                             BYTE *mac,DWORD *cnt, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD SW=0;
   BYTE tmp[12];
@@ -341,26 +508,15 @@ int CALLINGCONV ComputeSigilloML(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,
   BYTE pSend[22];
   
   S_TRACE("ComputeSigilloML: %d\n", nSlot);
+  S_PROBE2(call__entry,"ComputeSigilloML",nSlot);
 
   if (!IsInitialized()) return C_NOT_INITIALIZED;
 
-  BeginTransactionML(nSlot);
-  rv=SelectML(FID_MF,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_SIAE_APP_DOMAIN,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_SIAE_CNT_DOMAIN,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_EF_CNT,nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  rv=SelectPathML(PathEFCnt,PATH_LEN(PathEFCnt),nSlot);
   if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
   /* Preparazione Challenge */
-  memcpy(pSend,(BYTE*)"\x00\x01",2);
-  memcpy(pSend+2,SN,8);
-  memcpy(pSend+10,Data_Ora,8);
-  pSend[18]=(BYTE)((Prezzo&0xff000000)>>24);
-  pSend[19]=(BYTE)((Prezzo&0x00ff0000)>>16);
-  pSend[20]=(BYTE)((Prezzo&0x0000ff00)>>8);
-  pSend[21]=(BYTE) (Prezzo&0x000000ff);
+  SigilloChallenge(pSend,Data_Ora,Prezzo,SN);
   rv=SendAPDUML(nSlot,APDU_CMP_SIGILLO,22,&len,pSend,tmp,&SW);
   if (rv!=C_OK) goto CleanUp;
   if (SW!=SW_OK) { rv = SW; goto CleanUp;}
@@ -369,6 +525,8 @@ int CALLINGCONV ComputeSigilloML(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,
 
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_SIGILLO,tStart,rv);
+  S_PROBE3(call__return,"ComputeSigilloML",nSlot,rv);
   S_TRACE("ComputeSigilloML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -381,20 +539,24 @@ int CALLINGCONV ComputeSigillo(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,
 
 int CALLINGCONV ComputeSigilloExML(BYTE *Data_Ora,DWORD Prezzo,BYTE *mac,DWORD *cnt,int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   BYTE sn[8];
   int rv=C_OK;
 
   S_TRACE("ComputeSigilloExML: %d\n", nSlot);
+  S_PROBE2(call__entry,"ComputeSigilloExML",nSlot);
 
   if (!IsInitialized()) return C_NOT_INITIALIZED;
 
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
 
   rv=GetSNML(sn,nSlot);
   if (rv!=C_OK) goto CleanUp;
   rv = ComputeSigilloML(Data_Ora, Prezzo, sn, mac, cnt,nSlot);
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_SIGILLOEX,tStart,rv);
+  S_PROBE3(call__return,"ComputeSigilloExML",nSlot,rv);
   S_TRACE("ComputeSigilloExML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -406,23 +568,19 @@ int CALLINGCONV ComputeSigilloEx(BYTE *Data_Ora,DWORD Prezzo,BYTE *mac,DWORD *cn
 
 int CALLINGCONV ComputeSigilloFastML(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt,int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD SW=0;
   BYTE tmp[12];
   BYTE len=12;
   BYTE pSend[22];
   /* Preparazione Challenge */
-  memcpy(pSend,(BYTE*)"\x00\x01",2);
-  memcpy(pSend+2,SN,8);
-  memcpy(pSend+10,Data_Ora,8);
-  pSend[18]=(BYTE)((Prezzo&0xff000000)>>24);
-  pSend[19]=(BYTE)((Prezzo&0x00ff0000)>>16);
-  pSend[20]=(BYTE)((Prezzo&0x0000ff00)>>8);
-  pSend[21]=(BYTE) (Prezzo&0x000000ff);
+  SigilloChallenge(pSend,Data_Ora,Prezzo,SN);
   
   S_TRACE("ComputeSigilloFastML: %d\n", nSlot);
+  S_PROBE2(call__entry,"ComputeSigilloFastML",nSlot);
 
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
 
   rv=SendAPDUML(nSlot,APDU_CMP_SIGILLO,22,&len,pSend,tmp,&SW);
   if (rv!=C_OK) goto CleanUp;
@@ -432,6 +590,8 @@ int CALLINGCONV ComputeSigilloFastML(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,BYTE *
   memcpy(mac,&tmp[4],8);
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_SIGILLOFAST,tStart,rv);
+  S_PROBE3(call__return,"ComputeSigilloFastML",nSlot,rv);
   S_TRACE("ComputeSigilloFastML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -441,6 +601,66 @@ int CALLINGCONV ComputeSigilloFast(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,BYTE *ma
   return ComputeSigilloFastML(Data_Ora,Prezzo,SN,mac,cnt,defSlot);
 }
 
+/* ComputeSigilloBatchML calcola nItems sigilli fiscali all'interno di una   */
+/* sola transazione PC/SC: l'EF contatore viene selezionato una volta sola e */
+/* le APDU CMP_SIGILLO vengono inviate una di seguito all'altra.             */
+/* Data_Ora e SN sono array di nItems elementi da 8 byte, Prezzo di nItems   */
+/* DWORD; mac (nItems*8 byte), cnt e status ricevono i risultati per ticket. */
+/* L'elaborazione si ferma al primo errore della carta, che viene anche      */
+/* restituito dalla funzione; gli elementi non elaborati restano con status  */
+/* C_GENERIC_ERROR. status puo' essere NULL.                                 */
+int CALLINGCONV ComputeSigilloBatchML(int nItems,BYTE *Data_Ora,DWORD *Prezzo,BYTE *SN,
+                            BYTE *mac,DWORD *cnt,int *status,int nSlot)
+{
+  SYS_INT64 tStart=SysTimeUs();
+  int rv=C_OK;
+  int i;
+  WORD SW=0;
+  BYTE tmp[12];
+  BYTE len=12;
+  BYTE pSend[22];
+
+  S_TRACE("ComputeSigilloBatchML: %d, nItems=%d\n", nSlot, nItems);
+  S_PROBE2(call__entry,"ComputeSigilloBatchML",nSlot);
+
+  if (!IsInitialized()) return C_NOT_INITIALIZED;
+  if ((nItems<=0)||(Data_Ora==NULL)||(Prezzo==NULL)||(SN==NULL)||(mac==NULL)||(cnt==NULL))
+    return C_GENERIC_ERROR;
+  if (status!=NULL)
+    for (i=0;i<nItems;i++) status[i]=C_GENERIC_ERROR;
+
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  rv=SelectPathML(PathEFCnt,PATH_LEN(PathEFCnt),nSlot);
+  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
+
+  for (i=0;i<nItems;i++) {
+    SigilloChallenge(pSend,Data_Ora+i*8,Prezzo[i],SN+i*8);
+    len=12;
+    rv=SendAPDUML(nSlot,APDU_CMP_SIGILLO,22,&len,pSend,tmp,&SW);
+    if ((rv==C_OK)&&(SW!=SW_OK)) rv=SW;
+    if (status!=NULL) status[i]=rv;
+    if (rv!=C_OK) {
+      S_TRACE("ComputeSigilloBatchML: item %d failed\n", i);
+      goto CleanUp;
+    }
+    cnt[i]=(tmp[0]<<24)|(tmp[1]<<16)|(tmp[2]<<8)|tmp[3];
+    memcpy(mac+i*8,&tmp[4],8);
+  }
+
+CleanUp:
+  EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_SIGILLOBATCH,tStart,rv);
+  S_PROBE3(call__return,"ComputeSigilloBatchML",nSlot,rv);
+  S_TRACE("ComputeSigilloBatchML: %d, rv=0x%08X\n", nSlot, rv);
+  return rv;
+}
+
+int CALLINGCONV ComputeSigilloBatch(int nItems,BYTE *Data_Ora,DWORD *Prezzo,BYTE *SN,
+                            BYTE *mac,DWORD *cnt,int *status)
+{
+  return ComputeSigilloBatchML(nItems,Data_Ora,Prezzo,SN,mac,cnt,status,defSlot);
+}
+
 
 int CALLINGCONV Padding(BYTE *toPad, int Len, BYTE *Padded)
 {
@@ -456,22 +676,30 @@ int CALLINGCONV Padding(BYTE *toPad, int Len, BYTE *Padded)
 }
 
 BYTE CALLINGCONV GetKeyIDML(int nSlot) {
+  SYS_INT64 tStart=SysTimeUs();
   BYTE status, brv = 0;
   int len=1,n=1;
 
   S_TRACE("GetKeyIDML: %d\n", nSlot);
+  S_PROBE2(call__entry,"GetKeyIDML",nSlot);
 
-  BeginTransactionML(nSlot);
-  if (SelectML(0x0000,nSlot)!=C_OK) {brv = 0; goto CleanUp;}
-  if (SelectML(0x1111,nSlot)!=C_OK) {brv = 0; goto CleanUp;}
-  if (SelectML(0x5f02,nSlot)!=C_OK) {brv = 0; goto CleanUp;}
+  if (BeginTransactionML(nSlot)!=C_OK) return 0;
+  brv=SlotSession(nSlot)->keyID;
+  if (brv!=0) goto CleanUp;
+  if (SelectPathML(PathEFKeyStatus,PATH_LEN(PathEFKeyStatus),nSlot)!=C_OK) {brv = 0; goto CleanUp;}
   while (ReadRecordML(n,&status,&len,nSlot)==C_OK) {
-	if (status==1) { brv = (n+128); goto CleanUp;}
+	if (status==1) {
+      brv = (n+128);
+      SlotSession(nSlot)->keyID=brv;
+      goto CleanUp;
+    }
     if (len>1) len=1;
     n++;
   }
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_GETKEYID,tStart,(brv!=0)?C_OK:C_GENERIC_ERROR);
+  S_PROBE3(call__return,"GetKeyIDML",nSlot,brv);
   S_TRACE("GetKeyIDML: %d, rv=0x%08X\n", nSlot, brv);
   return brv;
 }
@@ -480,44 +708,128 @@ BYTE CALLINGCONV GetKeyID() {
   return GetKeyIDML(defSlot);
 }
 
+/* Indice del certificato fid nella cache di sessione, -1 se assente */
+static int CachedCert(WORD fid, int nSlot)
+{
+  SESSION_CACHE *pSess=SlotSession(nSlot);
+  int i;
+  for (i=0; i<pSess->nCerts; i++)
+    if (pSess->certFid[i]==fid) return i;
+  return -1;
+}
+
+static int CacheCert(WORD fid, int len, const BYTE *fp, int fpLen, int nSlot)
+{
+  SESSION_CACHE *pSess=SlotSession(nSlot);
+  int i=pSess->nCerts;
+  if (i>=MAX_CACHED_CERTS) return -1;
+  pSess->certFid[i]=fid;
+  pSess->certLen[i]=len;
+  pSess->certFpLen[i]=fpLen;
+  memcpy(pSess->certFp[i],fp,fpLen);
+  pSess->nCerts++;
+  return i;
+}
+
+int GetSessionIssuerSerial(BYTE kid, BYTE *ias, int *len, int nSlot)
+{
+  SESSION_CACHE *pSess;
+  int rv=C_GENERIC_ERROR;
+  if (BeginTransactionML(nSlot)!=C_OK) return C_GENERIC_ERROR;
+  pSess=SlotSession(nSlot);
+  if ((kid!=0)&&(pSess->iasKeyID==kid)&&(pSess->iasLen<=*len)) {
+    memcpy(ias,pSess->ias,pSess->iasLen);
+    *len=pSess->iasLen;
+    rv=C_OK;
+  }
+  EndTransactionML(nSlot);
+  return rv;
+}
+
+void SetSessionIssuerSerial(BYTE kid, const BYTE *ias, int len, int nSlot)
+{
+  SESSION_CACHE *pSess;
+  if ((len<=0)||(len>MAX_CACHED_IAS)) return;
+  if (BeginTransactionML(nSlot)!=C_OK) return;
+  pSess=SlotSession(nSlot);
+  memcpy(pSess->ias,ias,len);
+  pSess->iasLen=len;
+  pSess->iasKeyID=kid;
+  EndTransactionML(nSlot);
+}
+
+/* Tutti i certificati risiedono nel DF del dominio P11 */
+static int SelectCert(WORD fid, int nSlot)
+{
+  WORD path[4];
+  path[0]=FID_MF;
+  path[1]=FID_SIAE_APP_DOMAIN;
+  path[2]=FID_P11_APP_DOMAIN;
+  path[3]=fid;
+  return SelectPathML(path,4,nSlot);
+}
+
 static int GetCert(WORD fid, BYTE *cert, int* dim, int nSlot)
 {
 	// funzione interna: nessuna trasnaction
-  BYTE dimBuff[2];
+  SESSION_CACHE *pSess=SlotSession(nSlot);
+  BYTE fp[CERT_FP_LEN];
+  BYTE serial[8];
+  int useDisk=FALSE;
   int q=0;
   int dd=0;
+  int i=0;
   int rv=C_OK;
 
   S_TRACE("GetCert: %d\n", nSlot);
 
-  rv=SelectML(fid, nSlot);  
-  if (rv!=C_OK) return C_GENERIC_ERROR;
-  q=2;
-  rv=ReadBinaryML(0,dimBuff,&q,nSlot);
-  if ((rv!=C_OK)||(q<2)) return C_GENERIC_ERROR;
-  dd=(dimBuff[1]<<8)|dimBuff[0];
+  /* Il primo blocco dell'EF contiene la lunghezza e fa da impronta per */
+  /* la cache su disco: viene letto una sola volta per sessione         */
+  i=CachedCert(fid,nSlot);
+  if (i<0) {
+    rv=SelectCert(fid,nSlot);
+    if (rv!=C_OK) return C_GENERIC_ERROR;
+    q=CERT_FP_LEN;
+    rv=ReadBinaryML(0,fp,&q,nSlot);
+    if ((rv!=C_OK)||(q<2)) return C_GENERIC_ERROR;
+    dd=(fp[1]<<8)|fp[0];
+    i=CacheCert(fid,dd,fp,q,nSlot);
+  }
+  else dd=pSess->certLen[i];
   if (*dim<dd) {
     *dim=dd;
     return C_WRONG_LEN;
   }
   *dim=dd;
-  if (cert!=NULL) {
-    rv=ReadBinaryML(2,cert,dim,nSlot);
-    if (rv!=C_OK) return C_GENERIC_ERROR;
+  if (cert==NULL) return C_OK;
+
+  if ((i>=0)&&CertCacheEnabled()&&(GetSNML(serial,nSlot)==C_OK)) {
+    useDisk=TRUE;
+    q=dd;
+    if ((CertCacheLookup(serial,CERTCACHE_CERT,fid,pSess->certFp[i],pSess->certFpLen[i],cert,&q)==C_OK)&&(q==dd))
+      return C_OK;
   }
+  rv=SelectCert(fid,nSlot);
+  if (rv!=C_OK) return C_GENERIC_ERROR;
+  rv=ReadBinaryML(2,cert,dim,nSlot);
+  if (rv!=C_OK) return C_GENERIC_ERROR;
+  if (useDisk)
+    CertCacheStore(serial,CERTCACHE_CERT,fid,pSess->certFp[i],pSess->certFpLen[i],cert,*dim);
   return C_OK;
 }
 
 int CALLINGCONV GetCertificateML(BYTE *cert, int* dim, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   WORD fidcert=0;
   BYTE k=0;
 
   S_TRACE("GetCertificateML: cert=0x%08X, dim=0x%08X, %d\n", cert, dim, nSlot);
+  S_PROBE2(call__entry,"GetCertificateML",nSlot);
   if (dim==NULL) return C_GENERIC_ERROR;
 
-  BeginTransactionML(nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
 
   k=GetKeyIDML(nSlot);
   k-=128;
@@ -526,6 +838,8 @@ int CALLINGCONV GetCertificateML(BYTE *cert, int* dim, int nSlot)
   rv = GetCert(fidcert, cert, dim, nSlot);
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_GETCERTIFICATE,tStart,rv);
+  S_PROBE3(call__return,"GetCertificateML",nSlot,rv);
   S_TRACE("GetCertificateML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -537,17 +851,18 @@ int CALLINGCONV GetCertificate(BYTE *cert, int* dim)
 
 int CALLINGCONV GetCACertificateML(BYTE *cert, int* dim, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
-  WORD fidcert=0x4101;
+  WORD fidcert=FID_EF_CA_CERT;
 
   S_TRACE("GetCACertificateML: %d\n", nSlot);
+  S_PROBE2(call__entry,"GetCACertificateML",nSlot);
 
-  BeginTransactionML(nSlot);
-  SelectML(0x3f00,nSlot);
-  SelectML(0x0000,nSlot);
-  SelectML(0x1111,nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
   rv = GetCert(fidcert, cert, dim, nSlot);
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_GETCACERTIFICATE,tStart,rv);
+  S_PROBE3(call__return,"GetCACertificateML",nSlot,rv);
 
   S_TRACE("GetCACertificateML: %d, rv=0x%08X\n", nSlot, rv);
 
@@ -561,17 +876,18 @@ int CALLINGCONV GetCACertificate(BYTE *cert, int* dim)
 
 int CALLINGCONV GetSIAECertificateML(BYTE *cert, int* dim, int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
-  WORD fidcert=0x4102;
+  WORD fidcert=FID_EF_SIAE_CERT;
 
   S_TRACE("GetSIAECertificateML: %d\n", nSlot);
+  S_PROBE2(call__entry,"GetSIAECertificateML",nSlot);
 
-  BeginTransactionML(nSlot);
-  SelectML(0x3f00,nSlot);
-  SelectML(0x0000,nSlot);
-  SelectML(0x1111,nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
   rv = GetCert(fidcert, cert, dim, nSlot);
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_GETSIAECERTIFICATE,tStart,rv);
+  S_PROBE3(call__return,"GetSIAECertificateML",nSlot,rv);
   S_TRACE("GetSIAECertificateML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -583,6 +899,7 @@ int CALLINGCONV GetSIAECertificate(BYTE *cert, int* dim)
 
 int CALLINGCONV SignML(int kx,BYTE *toSign,BYTE *Signed,int nSlot)
 {
+  SYS_INT64 tStart=SysTimeUs();
   int rv=C_OK;
   BYTE pSendMSE[3];
   BYTE pSendSGN[255];
@@ -590,16 +907,13 @@ int CALLINGCONV SignML(int kx,BYTE *toSign,BYTE *Signed,int nSlot)
   BYTE len=128;
 
   S_TRACE("SignML: %d\n", nSlot);
+  S_PROBE2(call__entry,"SignML",nSlot);
 
   if (!IsInitialized()) return C_NOT_INITIALIZED;
   if (kx>255) return C_UNKNOWN_OBJECT;
 
-  BeginTransactionML(nSlot);
-  rv=SelectML(FID_MF,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_SIAE_APP_DOMAIN,nSlot);
-  if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
-  rv=SelectML(FID_P11_APP_DOMAIN,nSlot);
+  if (BeginTransactionML(nSlot)!=C_OK) return C_NOT_INITIALIZED;
+  rv=SelectPathML(PathP11Domain,PATH_LEN(PathP11Domain),nSlot);
   if (rv!=C_OK) {rv= C_FILE_NOT_FOUND; goto CleanUp;}
   pSendMSE[0]=0x83; pSendMSE[1]=0x01; pSendMSE[2]=(BYTE)kx;
 
@@ -614,6 +928,8 @@ int CALLINGCONV SignML(int kx,BYTE *toSign,BYTE *Signed,int nSlot)
   if (SW!=SW_OK) {rv = SW; goto CleanUp;}
 CleanUp:
   EndTransactionML(nSlot);
+  StatsCall(nSlot,STATS_CALL_SIGN,tStart,rv);
+  S_PROBE3(call__return,"SignML",nSlot,rv);
   S_TRACE("SignML: %d, rv=0x%08X\n", nSlot, rv);
   return rv;
 }
@@ -52,10 +52,63 @@ int CALLINGCONV ComputeSigilloEx(BYTE *Data_Ora,DWORD Prezzo,BYTE *mac,DWORD *cn
 int CALLINGCONV ComputeSigilloExML(BYTE *Data_Ora,DWORD Prezzo,BYTE *mac,DWORD *cnt, int nSlot);
 int CALLINGCONV ComputeSigilloFast(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt);
 int CALLINGCONV ComputeSigilloFastML(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt, int nSlot);
+int CALLINGCONV ComputeSigilloBatch(int nItems,BYTE *Data_Ora,DWORD *Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt,int *status);
+int CALLINGCONV ComputeSigilloBatchML(int nItems,BYTE *Data_Ora,DWORD *Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt,int *status,int nSlot);
+
+/* Cache su disco dei certificati (szDir==NULL la disattiva) */
+int CALLINGCONV SetCertificateCache(const char *szDir);
+
+/* Livello della traccia diagnostica (0 off, 1 errori, 2 chiamate, 3 APDU) */
+int CALLINGCONV SetTraceLevel(int nLevel);
+int CALLINGCONV GetTraceLevel();
+
+/* Statistiche di latenza per slot (costanti STATS_xxx in libsiaecardt.h) */
+typedef struct _SIAE_HISTOGRAM {
+  DWORD count;
+  DWORD errors;                 /* APDU con SW diversa da 90xx/61xx o */
+                                /* chiamate con risultato diverso da C_OK */
+  DWORD max;
+  DWORD buckets[STATS_BUCKETS];
+} SIAE_HISTOGRAM;
+
+typedef struct _SIAE_STATS {
+  DWORD resets;                 /* APDU ritrasmesse dopo un reset della carta */
+  SIAE_HISTOGRAM transaction;   /* attesa in SCardBeginTransaction */
+  SIAE_HISTOGRAM apdu[STATS_APDU_CLASSES];
+  SIAE_HISTOGRAM call[STATS_CALLS];
+} SIAE_STATS;
+
+/* GetStatsML copia le statistiche senza fermare le operazioni in corso; */
+/* GetStatsPercentile ritorna il percentile (0..100) di un istogramma,   */
+/* in microsecondi.                                                      */
+int CALLINGCONV GetStatsML(SIAE_STATS *pStats, int nSlot);
+int CALLINGCONV ResetStatsML(int nSlot);
+DWORD CALLINGCONV GetStatsPercentile(const SIAE_HISTOGRAM *pHist, double dPercent);
 
 /* Funzioni per la gestione delle operazioni crittografiche */
 int CALLINGCONV Padding(BYTE *toPad, int Len, BYTE *Padded);
 int CALLINGCONV Hash(int mec,BYTE *toHash, int Len, BYTE *Hashed);
+
+/* Hash incrementale (HASH_SHA1, HASH_SHA256, HASH_MD5): i dati possono */
+/* essere passati a pezzi man mano che sono prodotti. Il contesto e'    */
+/* opaco, puo' stare sullo stack e HashFinal lo azzera.                 */
+#ifdef WIN32
+typedef unsigned __int64 SIAE_UINT64;
+#else
+typedef unsigned long long SIAE_UINT64;
+#endif
+
+typedef struct _HASH_CONTEXT {
+  int mec;
+  union {
+    SIAE_UINT64 align;
+    unsigned char state[248];
+  } u;
+} HASH_CONTEXT;
+
+int CALLINGCONV HashInit(HASH_CONTEXT *pCtx, int mec);
+int CALLINGCONV HashUpdate(HASH_CONTEXT *pCtx, const BYTE *pData, SIAE_UINT64 nLen);
+int CALLINGCONV HashFinal(HASH_CONTEXT *pCtx, BYTE *Hashed);
 int CALLINGCONV Sign(int kx,BYTE *toSign,BYTE *Signed);
 int CALLINGCONV SignML(int kx,BYTE *toSign,BYTE *Signed, int nSlot);
 BYTE CALLINGCONV GetKeyID();
@@ -70,8 +70,69 @@ typedef unsigned int UINT;
 
 #define HASH_SHA1                     0x01
 #define HASH_MD5                      0x02
+#define HASH_SHA256                   0x03    /* digest di 32 byte */
 
 #define MAX_READERS 16
+/* Limite degli indici di slot accettati: lo stato degli slot viene    */
+/* allocato a blocchi al primo utilizzo, per cui la memoria cresce con */
+/* gli slot effettivamente usati e non con MAX_SLOTS (che coincide con */
+/* il campo a 16 bit delle registrazioni APDU). MAX_READERS resta solo */
+/* per compatibilita'                                                  */
+#define MAX_SLOTS   65536
+
+/* Stato di uno slot restituito da GetSlotState: flag nei bit bassi,   */
+/* contatore degli eventi di inserimento/rimozione nei bit 16..30      */
+#define SLOT_STATE_KNOWN              0x0001  /* il monitor ha gia' rilevato lo slot */
+#define SLOT_STATE_READER             0x0002  /* il lettore esiste                   */
+#define SLOT_STATE_PRESENT            0x0004  /* carta inserita                      */
+#define SLOT_STATE_MUTE               0x0008  /* carta che non risponde              */
+#define SLOT_STATE_EVENTS(s)          (((s)>>16)&0x7fff)
+
+/* Eventi notificati alle callback registrate con RegisterSlotCallback */
+#define SLOT_EVENT_INSERTED           1
+#define SLOT_EVENT_REMOVED            2
+#define SLOT_EVENT_RESET              3
+
+typedef void (CALLINGCONV_1 *t_SlotCallback)(int nSlot, int nEvent, void *pUserData);
+
+/* Statistiche di uno slot restituite da GetStatsML. Le latenze sono in  */
+/* microsecondi, raccolte in istogrammi log-lineari: i primi             */
+/* STATS_SUB_BUCKETS intervalli sono larghi 1 us, poi ogni potenza di 2  */
+/* e' divisa in STATS_SUB_BUCKETS intervalli uguali (errore < 12.5%).    */
+#define STATS_SUB_BUCKETS             8
+#define STATS_BUCKETS                 232     /* fino a circa 35 minuti */
+
+/* Classi di APDU */
+#define STATS_APDU_SELECT             0
+#define STATS_APDU_READBINARY         1
+#define STATS_APDU_READRECORD         2
+#define STATS_APDU_VERIFY             3
+#define STATS_APDU_READCOUNTER        4
+#define STATS_APDU_SIGILLO            5
+#define STATS_APDU_MSE                6
+#define STATS_APDU_SIGN               7
+#define STATS_APDU_OTHER              8
+#define STATS_APDU_CLASSES            9
+
+/* Funzioni della libreria (le varianti senza ML sono comprese) */
+#define STATS_CALL_INITIALIZE         0
+#define STATS_CALL_VERIFYPIN          1
+#define STATS_CALL_CHANGEPIN          2
+#define STATS_CALL_UNBLOCKPIN         3
+#define STATS_CALL_READCOUNTER        4
+#define STATS_CALL_READBALANCE        5
+#define STATS_CALL_SIGILLO            6
+#define STATS_CALL_SIGILLOEX          7
+#define STATS_CALL_SIGILLOFAST        8
+#define STATS_CALL_SIGILLOBATCH       9
+#define STATS_CALL_GETKEYID           10
+#define STATS_CALL_GETCERTIFICATE     11
+#define STATS_CALL_GETCACERTIFICATE   12
+#define STATS_CALL_GETSIAECERTIFICATE 13
+#define STATS_CALL_SIGN               14
+#define STATS_CALL_PKCS7SIGN          15
+#define STATS_CALL_SMIMESIGN          16
+#define STATS_CALLS                   17
 
 #ifdef __cplusplus
 };
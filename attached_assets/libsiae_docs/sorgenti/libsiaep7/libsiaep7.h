@@ -25,6 +25,31 @@ typedef int (CALLINGCONV_1 *t_PKCS7SignML)(
 	const char* szOutputFileName,
 	int bInitialize);
 
+/*
+	PKCS7SignExML(): come PKCS7SignML, con dwFlags:
+	PKCS7_FLAG_SHA256	impronta SHA-256 invece di SHA-1 (DigestInfo,
+				digestAlgorithms, messageDigest) e attributo
+				signing-certificate-v2, come richiesto da CAdES-BES
+*/
+
+#define PKCS7_FLAG_SHA256	0x00000001
+
+int CALLINGCONV PKCS7SignExML(
+	const char *pin,
+	unsigned long slot,
+	const char* szInputFileName,
+	const char* szOutputFileName,
+	unsigned long dwFlags,
+	int bInitialize);
+
+typedef int (CALLINGCONV_1 *t_PKCS7SignExML)(
+	const char *pin,
+	unsigned long slot,
+	const char* szInputFileName,
+	const char* szOutputFileName,
+	unsigned long dwFlags,
+	int bInitialize);
+
 /*
 SMIMESignML(): crea un messaggio S/MIME firmato ed eventualmente cifrato (anche per pi destinatari)
 */
@@ -63,7 +88,7 @@ int CALLINGCONV SMIMESignML(
 		// prima del percorso dell'allegato stesso.
 		// es: file_a.txt|c:\file1.txt;file_b.pfd|c:\temp\tmpfile.pdf
 
-	unsigned long dwFlags, // Riservato per usi futuri, specificare 0
+	unsigned long dwFlags, // 0 oppure PKCS7_FLAG_SHA256 (vedere PKCS7SignExML)
 	int bInitialize
 );
 
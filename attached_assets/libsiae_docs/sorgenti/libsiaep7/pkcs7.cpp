@@ -4,6 +4,7 @@
 #include "internals.h"
 #include "md5.h"
 #include "sha1.h"
+#include "sha256.h"
 #include "scardhal.h"
 #include <string.h>
 #include <stdio.h>
@@ -16,18 +17,16 @@ using namespace std;
 #include "utility.h"
 
 #include "pkcs7.h"
+#include "stats.h"
+#include "probes.h"
+#include "sysdep.h"
 
 #define CRLF "\r\n"
 #include "asn1/asn1.h"
+#include "asn1/asn1const.h"
 
 #include <assert.h>
 
-#ifdef WIN32
-#	include <malloc.h>
-#else
-#	include <alloca.h>
-#endif
-
 #include <vector>
 typedef struct _DER_ITEM
 {
@@ -97,11 +96,19 @@ static _DER_ITEM_vector der_parse(const unsigned char *der_begin, size_t der_len
 static int SignDataML(
 		int slot,
 		unsigned short wKid,
+		int nDigest,	// HASH_SHA1 o HASH_SHA256
+		const unsigned char* pbContentDigest,	// impronta dei dati gia' calcolata, o NULL
 		const unsigned char* pbCertContext,
 		unsigned long cbCertContext,
 		const unsigned char* pbToBeSigned, unsigned long cbToBeSigned,		// Data to process
 		unsigned char* pbSignedBlob, unsigned long* pcbSignedBlob	// Output data
 		);
+static int EncodeSigningCertificateV2(
+		CAsn1Arena* pArena,
+		const unsigned char* pbCertContext, unsigned long cbCertContext,
+		const unsigned char* pbIAS, unsigned long cbIAS,
+		unsigned char** ppbAttr, unsigned long* pcbAttr	// attributo DER, in pArena
+		);
 static void FlipMem(unsigned char* pbBuffer, unsigned long cbBuffer) {
 	unsigned char *p = pbBuffer;
 	unsigned char *q = pbBuffer + cbBuffer - 1;
@@ -114,62 +121,180 @@ static void FlipMem(unsigned char* pbBuffer, unsigned long cbBuffer) {
 
 
 
+/*
+	Lettura e impronta del file da firmare, sovrapposte alle operazioni sulla
+	carta (PIN, chiave, certificato): un thread legge il file a blocchi nel
+	buffer, un secondo calcola l'impronta dei blocchi gia' letti. Alla fine il
+	buffer contiene comunque l'intero file, che va incluso come eContent.
+	I file di un solo blocco sono letti subito, senza thread.
+*/
+#define INPUT_CHUNK (256*1024)
+
+typedef struct _SIGN_INPUT
+{
+	FILE* f;
+	unsigned char* pbData;
+	long cbData;
+	int nDigest;			// HASH_SHA1 o HASH_SHA256
+	SYS_MUTEX lock;			// protegge nRead e bDone
+	SYS_COND progress;		// segnalata a ogni blocco letto e alla fine
+	long nRead;				// byte gia' letti
+	int bDone;				// lettura terminata, anche per errore
+	int bReadOk;
+	int bHashOk;
+	unsigned char Digest[SHA256HashSize];
+	SYS_THREAD reader;
+	SYS_THREAD hasher;
+	int bThreads;
+	int bSync;				// lock e progress inizializzati
+} SIGN_INPUT;
+
+static SYS_THREAD_PROC(InputReader, arg)
+{
+	SIGN_INPUT* in = (SIGN_INPUT*)arg;
+	long off = 0, n;
+	while (off < in->cbData)
+	{
+		n = in->cbData - off;
+		if (n > INPUT_CHUNK) n = INPUT_CHUNK;
+		if ((long)fread(in->pbData + off, 1, n, in->f) != n) break;
+		off += n;
+		SysMutexLock(&in->lock);
+		in->nRead = off;
+		SysCondBroadcast(&in->progress);
+		SysMutexUnlock(&in->lock);
+	}
+	SysMutexLock(&in->lock);
+	in->bReadOk = (off == in->cbData);
+	in->bDone = TRUE;
+	SysCondBroadcast(&in->progress);
+	SysMutexUnlock(&in->lock);
+	return SYS_THREAD_RETURN;
+}
+
+// Un errore dell'impronta lascia bHashOk a FALSE: non si firma mai
+// un digest parziale. Il lettore non attende l'hasher e termina da solo.
+static SYS_THREAD_PROC(InputHasher, arg)
+{
+	SIGN_INPUT* in = (SIGN_INPUT*)arg;
+	HASH_CONTEXT ctx;
+	long hashed = 0, n;
+	int bDone, bOk;
+	bOk = (HashInit(&ctx, in->nDigest) == C_OK);
+	while (bOk)
+	{
+		SysMutexLock(&in->lock);
+		while ((in->nRead == hashed) && !in->bDone)
+			SysCondWait(&in->progress, &in->lock);
+		n = in->nRead;
+		bDone = in->bDone;
+		SysMutexUnlock(&in->lock);
+		if (n > hashed)
+		{
+			bOk = (HashUpdate(&ctx, in->pbData + hashed, (SIAE_UINT64)(n - hashed)) == C_OK);
+			hashed = n;
+		}
+		else if (bDone) break;
+	}
+	bOk = (HashFinal(&ctx, in->Digest) == C_OK) && bOk;
+	in->bHashOk = bOk && (hashed == in->cbData);
+	if (!in->bHashOk) memset(in->Digest, 0, sizeof in->Digest);
+	return SYS_THREAD_RETURN;
+}
+
+static void InputStart(SIGN_INPUT* in)
+{
+	SysMutexInit(&in->lock);
+	SysCondInit(&in->progress);
+	in->bSync = TRUE;
+	if (in->cbData > INPUT_CHUNK && SysThreadCreate(&in->reader, InputReader, in))
+	{
+		if (SysThreadCreate(&in->hasher, InputHasher, in))
+		{
+			in->bThreads = TRUE;
+			return;
+		}
+		SysThreadJoin(in->reader);
+	}
+	else InputReader(in);
+	InputHasher(in);
+}
+
+/* Attende lettura e impronta; si puo' chiamare piu' volte */
+static int InputWait(SIGN_INPUT* in)
+{
+	if (in->bThreads)
+	{
+		SysThreadJoin(in->reader);
+		SysThreadJoin(in->hasher);
+		in->bThreads = FALSE;
+	}
+	if (in->bSync)
+	{
+		SysCondDestroy(&in->progress);
+		SysMutexDestroy(&in->lock);
+		in->bSync = FALSE;
+	}
+	if (in->f)
+	{
+		fclose(in->f);
+		in->f = NULL;
+	}
+	return in->bReadOk && in->bHashOk;
+}
+
 /*
 	PKCS7Sign(): crea un pacchetto PKCS#7 firmato usando la smartcard SIAE
 */
-int CALLINGCONV PKCS7SignML(
+static int PKCS7SignSlot(
 	const char *pin, // pin smartcard
 	unsigned long slot, // slot da utilizzare, zero based
 	const char* szInputFileName, // nome del file di input
 	const char* szOutputFileName, // nome del file di output
+	unsigned long dwFlags, // PKCS7_FLAG_xxx
 	int bInitialize)
 {
-	S_TRACE("PKCS7SignML(): entry point\n");
-
-	long lenCer, lenDati;
-	unsigned char *dati;
+	S_TRACE("PKCS7SignML(): entry point, dwFlags=0x%08lX\n", dwFlags);
 
-	unsigned char	 *certificato;
+	long lenCer = 0;
+	unsigned char	 *certificato = NULL;
+	unsigned char* pSignedBlob = NULL;
+	unsigned long dwSignedBlobLen = 0;
 
-	FILE* f;
-	unsigned short risultato = 0;
+	int risultato = C_OK;
 	int		ritorno = 0;
 	unsigned char	kid = 0;
+	int iInitRes = C_GENERIC_ERROR;
+	SIGN_INPUT in;
+
+	memset(&in, 0, sizeof in);
+	in.nDigest = (dwFlags & PKCS7_FLAG_SHA256) ? HASH_SHA256 : HASH_SHA1;
 
 	S_TRACE("PKCS7SignML(): opening file\n");
-	if( (f = fopen(szInputFileName, "rb")) ==  NULL )
+	if( (in.f = fopen(szInputFileName, "rb")) ==  NULL )
 	{
 		return(C_GENERIC_ERROR);
 	}
 	
-	fseek(f, 0, SEEK_END);
-	lenDati = ftell(f);
-	fseek(f, 0, SEEK_SET);
+	fseek(in.f, 0, SEEK_END);
+	in.cbData = ftell(in.f);
+	fseek(in.f, 0, SEEK_SET);
 	
-	if ( (dati = (unsigned char *)malloc(lenDati+1))==NULL )
-	{
-		fclose(f);
-		return(C_GENERIC_ERROR);
-	}
-
-	memset(dati, 0, lenDati);
-	if ( fread( dati, 1, lenDati, f)!=lenDati )
+	if ( in.cbData < 0 || (in.pbData = (unsigned char *)malloc(in.cbData+1))==NULL )
 	{
-		fclose(f);
-		free(dati);
+		fclose(in.f);
 		return(C_GENERIC_ERROR);
 	}
-	fclose(f);
+	InputStart(&in);
 
-	int iInitRes = C_OK;
 	if (bInitialize) 
 	{
 		S_TRACE("PKCS7SignML(): Initialize(slot)\n");
 		iInitRes = Initialize(slot);
 		if ( iInitRes != C_OK && iInitRes != C_ALREADY_INITIALIZED)
 		{
-			free(dati);
-			return(iInitRes);
+			risultato = iInitRes;
+			goto CleanUp;
 		}
 	}
 
@@ -182,48 +307,54 @@ int CALLINGCONV PKCS7SignML(
 	ritorno = VerifyPINML(1, (char*) pin, slot); 
 	if ( ritorno != C_OK )
 	{
-		free(dati);
-		return(ritorno);
+		risultato = ritorno;
+		goto CleanUp;
 	}
 
 	S_TRACE("PKCS7SignML(): GetKeyID()\n");
 	kid = GetKeyIDML(slot);
 	if ( kid == 0 )
 	{
-		free(dati);
-		return(C_GENERIC_ERROR);
+		risultato = C_GENERIC_ERROR;
+		goto CleanUp;
 	}
 
 	S_TRACE("PKCS7SignEx(): GetCertificate()\n");
-	lenCer = 0;
 	ritorno = GetCertificateML(NULL, (int*)&lenCer, slot);
 	if ( ritorno != C_WRONG_LEN && ritorno != C_OK ) // aggiunto:  ritorno != C_WRONG_LEN
 	{
-		free(dati);
-		return(ritorno);
+		risultato = ritorno;
+		goto CleanUp;
 	}
 	if ( (certificato = (unsigned char *)malloc(lenCer+1))==NULL )
 	{
-		free(dati);
-		return(C_GENERIC_ERROR);
+		risultato = C_GENERIC_ERROR;
+		goto CleanUp;
 	}
 	ritorno = GetCertificateML(certificato, (int*)&lenCer, slot);
 	if ( ritorno != C_OK )
 	{
-		free(dati);
-		free(certificato);
-		return(ritorno);
+		risultato = ritorno;
+		goto CleanUp;
 	}
 
+	S_TRACE("PKCS7SignML(): waiting for input\n");
+	if (!InputWait(&in))
+	{
+		S_TRACE_ERROR("PKCS7SignML(): cannot read or hash %s\n", szInputFileName);
+		risultato = C_GENERIC_ERROR;
+		goto CleanUp;
+	}
+	S_PROBE2(file__read, szInputFileName, in.cbData);
 
-	unsigned long dwSignedBlobLen = lenDati + lenCer + 128 + (1024*8); // stima lunghezza pacchetto p7m: dati + cer + firma + 8Kb di overhead
-	unsigned char* pSignedBlob = new unsigned char[dwSignedBlobLen]; 
+	dwSignedBlobLen = in.cbData + lenCer + 128 + (1024*8); // stima lunghezza pacchetto p7m: dati + cer + firma + 8Kb di overhead
+	pSignedBlob = new unsigned char[dwSignedBlobLen]; 
 
 	if (certificato && pSignedBlob)
 	{
 		S_TRACE("PKCS7SignML(): SignDataML()\n");
-		int bRes = SignDataML(slot, kid, certificato, lenCer, dati, lenDati, pSignedBlob, &dwSignedBlobLen);
-		assert(bRes && (dwSignedBlobLen <= (unsigned long)(lenDati + lenCer + 128 + (1024*8))));
+		int bRes = SignDataML(slot, kid, in.nDigest, in.Digest, certificato, lenCer, in.pbData, in.cbData, pSignedBlob, &dwSignedBlobLen);
+		assert(bRes && (dwSignedBlobLen <= (unsigned long)(in.cbData + lenCer + 128 + (1024*8))));
 		if (!bRes) 
 		{
 			risultato = C_GENERIC_ERROR;
@@ -242,21 +373,63 @@ int CALLINGCONV PKCS7SignML(
 	
 	}
 
+CleanUp:
+	// i thread scrivono nel buffer: vanno attesi prima di liberarlo
+	InputWait(&in);
+
 	if (bInitialize && iInitRes == C_OK) 
 		ritorno = FinalizeML(slot);
 
 	if (pSignedBlob) delete [] pSignedBlob; pSignedBlob=NULL;
 
-	free(dati);
+	free(in.pbData);
 	free(certificato);
 
 	S_TRACE("PKCS7SignML(): returning %d\n", risultato);
 	return(risultato);
 }
 
+int CALLINGCONV PKCS7SignExML(
+	const char *pin,
+	unsigned long slot,
+	const char* szInputFileName,
+	const char* szOutputFileName,
+	unsigned long dwFlags,
+	int bInitialize)
+{
+	if (dwFlags & ~(unsigned long)PKCS7_FLAG_SHA256)
+		return C_GENERIC_ERROR;
+	// misura anche i percorsi di errore che escono in anticipo
+	SYS_INT64 tStart = SysTimeUs();
+	S_PROBE2(call__entry, "PKCS7SignML", (int)slot);
+	int rv = PKCS7SignSlot(pin, slot, szInputFileName, szOutputFileName, dwFlags, bInitialize);
+	StatsCall((int)slot, STATS_CALL_PKCS7SIGN, tStart, rv);
+	S_PROBE3(call__return, "PKCS7SignML", (int)slot, rv);
+	return rv;
+}
+
+int CALLINGCONV PKCS7SignML(
+	const char *pin,
+	unsigned long slot,
+	const char* szInputFileName,
+	const char* szOutputFileName,
+	int bInitialize)
+{
+	return PKCS7SignExML(pin, slot, szInputFileName, szOutputFileName, 0, bInitialize);
+}
+
+static int Digest(int nDigest, const unsigned char* pbData, unsigned long cbData, unsigned char* pbDigest)
+{
+	if (nDigest == HASH_SHA256)
+		return SHA256(pbData, cbData, pbDigest);
+	return SHA1(pbData, cbData, pbDigest);
+}
+
 static int SignDataML(
 		int slot,
 		unsigned short wKid,
+		int nDigest,
+		const unsigned char* pbContentDigest,
 		const unsigned char* pbCertContext,
 		unsigned long cbCertContext,
 		const unsigned char* pbToBeSigned, unsigned long cbToBeSigned,		// Data to process
@@ -264,38 +437,49 @@ static int SignDataML(
 		)
 {
 	int bRet = FALSE;
-	unsigned char Sha1Digest[] = {0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14, // struttura per OID sha1
-						 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
-						 0x00, 0x00, 0x00, 0x00};
-	unsigned char* Sha1Digest_ptr = Sha1Digest + (sizeof Sha1Digest - 0x14);
+	if (nDigest != HASH_SHA1 && nDigest != HASH_SHA256) return FALSE;
+	const int bSha256 = (nDigest == HASH_SHA256);
+
+	// DigestInfo da firmare, con l'impronta in coda
+	unsigned char DigestInfo[sizeof Asn1DigestInfoSha256 + SHA256HashSize];
+	unsigned char* pbDigestInfo = DigestInfo;
+	unsigned long cbDigest = bSha256 ? SHA256HashSize : SHA1HashSize;
+	unsigned long cbDigestInfo = bSha256 ? sizeof Asn1DigestInfoSha256 : sizeof Asn1DigestInfoSha1;
+	memcpy(DigestInfo, bSha256 ? Asn1DigestInfoSha256 : Asn1DigestInfoSha1, cbDigestInfo);
+	unsigned char* pbDigest = pbDigestInfo + cbDigestInfo;
+	cbDigestInfo += cbDigest;
 
 	unsigned char RsaEncryption[256];
-	if(pbSignedBlob && !SHA1(
+	if(pbSignedBlob && pbContentDigest)
+		memcpy(pbDigest, pbContentDigest, cbDigest);
+	else if(pbSignedBlob && !Digest(
+		nDigest,
 		pbToBeSigned, 
 		cbToBeSigned,
-		Sha1Digest_ptr)) return FALSE;
-	CAsn1NULL Null;
-	CAsn1Sequence ContentInfo(2);
-	CAsn1Object SignedDataOID("1.2.840.113549.1.7.2");
-	CAsn1Sequence SignedData(5);
+		pbDigest)) return FALSE;
+
+	// i buffer degli oggetti ASN.1 vengono da Arena e sono liberati all'uscita
+	CAsn1Arena Arena;
+	CAsn1Sequence ContentInfo(2, &Arena);
+	CAsn1ConstData SignedDataOID(Asn1OidSignedData);
+	CAsn1Sequence SignedData(5, &Arena);
 	ContentInfo.Add(&SignedDataOID);
 
 	// Version
-	CAsn1Integer Version(1);
+	CAsn1Integer Version(1, &Arena);
 	SignedData.Add(&Version);
 	
 	// Digest Algorithms
-	CAsn1Set DigestAlgorithmIdentifiers(2);
-	CAsn1Sequence DigestAlgorithmIdentifier(2);
-	CAsn1Object Sha1OID("1.3.14.3.2.26");
-	DigestAlgorithmIdentifier.Add(&Sha1OID);
-	DigestAlgorithmIdentifier.Add(&Null);
+	CAsn1Set DigestAlgorithmIdentifiers(2, &Arena);
+	CAsn1ConstData DigestAlgorithmIdentifier(
+		bSha256 ? Asn1AlgSha256 : Asn1AlgSha1,
+		bSha256 ? sizeof Asn1AlgSha256 : sizeof Asn1AlgSha1);
 	DigestAlgorithmIdentifiers.Add(&DigestAlgorithmIdentifier);
 	SignedData.Add(&DigestAlgorithmIdentifiers);
 	
 	// EncapsulatedContent Info
-	CAsn1Sequence EncapsulatedContentInfo(2);
-	CAsn1Object Pkcs7DataOID("1.2.840.113549.1.7.1");
+	CAsn1Sequence EncapsulatedContentInfo(2, &Arena);
+	CAsn1ConstData Pkcs7DataOID(Asn1OidData);
 	CAsn1OctetString Data(pbToBeSigned, cbToBeSigned, FALSE);
 	CAsn1Tagged eContent(&Data, 0);
 	EncapsulatedContentInfo.Add(&Pkcs7DataOID);
@@ -307,16 +491,16 @@ static int SignDataML(
 		pbCertContext,
 		cbCertContext,
 		FALSE);
-	CAsn1Set CertificateSet(1);
+	CAsn1Set CertificateSet(1, &Arena);
 	CertificateSet.Add(&Certificate);
 	CertificateSet.SetImplicit();
 	CAsn1Tagged Certificates(&CertificateSet, 0);
 	SignedData.Add(&Certificates);
 	
 	// SignerInfos
-	CAsn1Set SignerInfos(1);
-	CAsn1Sequence SignerInfo1(6);
-	CAsn1Integer SignerInfoVersion(1);
+	CAsn1Set SignerInfos(1, &Arena);
+	CAsn1Sequence SignerInfo1(6, &Arena);
+	CAsn1Integer SignerInfoVersion(1, &Arena);
 	SignerInfo1.Add(&SignerInfoVersion);
 	
 #define DER_CLASS_UNIVERSAL (0)
@@ -327,79 +511,91 @@ static int SignDataML(
 #define DER_BIT_STRING (DER_CLASS_UNIVERSAL + 3)
 #define DER_CONTEXT (DER_CLASS_CONTEXT_SPECIFIC + DER_CONSTRUCTED)
 
-	const unsigned char* pbIssuer = NULL;
-	size_t cbIssuer = NULL;
-	const unsigned char* pbSN = NULL;
-	size_t cbSN = NULL;
+	// IssuerAndSerialNumber: ricavato dal certificato alla prima firma e poi
+	// preso dalla cache di sessione dello slot, che vale per la carta inserita
+	unsigned char* pbIAS = (unsigned char*) Arena.Alloc(MAX_CACHED_IAS);
+	int cbIAS = MAX_CACHED_IAS;
+	if (GetSessionIssuerSerial((BYTE)wKid, pbIAS, &cbIAS, slot) != C_OK)
+	{
+		const unsigned char* pbIssuer = NULL;
+		size_t cbIssuer = NULL;
+		const unsigned char* pbSN = NULL;
+		size_t cbSN = NULL;
 
-	_DER_ITEM_vector v1 = der_parse(pbCertContext, cbCertContext);
-	if (v1.size() < 1 || v1[0].tag != DER_SEQUENCE)
-		return FALSE;
-	_DER_ITEM_vector v2 = der_parse(v1[0].value, v1[0].len);
-		if (v2.size() < 3
-			|| v2[0].tag != DER_SEQUENCE
-			|| v2[1].tag != DER_SEQUENCE
-			|| v2[2].tag != DER_BIT_STRING)
+		_DER_ITEM_vector v1 = der_parse(pbCertContext, cbCertContext);
+		if (v1.size() < 1 || v1[0].tag != DER_SEQUENCE)
 			return FALSE;
+		_DER_ITEM_vector v2 = der_parse(v1[0].value, v1[0].len);
+			if (v2.size() < 3
+				|| v2[0].tag != DER_SEQUENCE
+				|| v2[1].tag != DER_SEQUENCE
+				|| v2[2].tag != DER_BIT_STRING)
+				return FALSE;
+
+			int off = 0;
+			_DER_ITEM_vector v3 = der_parse(v2[0].value, v2[0].len);
+
+			// con version number
+			if (v3.size() > 6
+				&& v3[0].tag == DER_CONTEXT + 0
+				&& v3[1].tag == DER_INTEGER
+				&& v3[2].tag == DER_SEQUENCE
+				&& v3[3].tag == DER_SEQUENCE
+				&& v3[4].tag == DER_SEQUENCE
+				&& v3[5].tag == DER_SEQUENCE
+				&& v3[6].tag == DER_SEQUENCE)
+			{
+				pbIssuer = v3[3].fvalue;
+				cbIssuer = v3[3].flen;
+				pbSN = v3[1].value;
+				cbSN = v3[1].len;
+			}
+			// senza version number
+			else if (v3.size() > 5
+				&& v3[0].tag == DER_INTEGER
+				&& v3[1].tag == DER_SEQUENCE
+				&& v3[2].tag == DER_SEQUENCE
+				&& v3[3].tag == DER_SEQUENCE
+				&& v3[4].tag == DER_SEQUENCE
+				&& v3[5].tag == DER_SEQUENCE)
+			{
+				pbIssuer = v3[2].fvalue;
+				cbIssuer = v3[2].flen;
+				pbSN = v3[0].value;
+				cbSN = v3[0].len;
+			}
+			else
+				return FALSE;
 
-		int off = 0;
-		_DER_ITEM_vector v3 = der_parse(v2[0].value, v2[0].len);
-
-		// con version number
-		if (v3.size() > 6
-			&& v3[0].tag == DER_CONTEXT + 0
-			&& v3[1].tag == DER_INTEGER
-			&& v3[2].tag == DER_SEQUENCE
-			&& v3[3].tag == DER_SEQUENCE
-			&& v3[4].tag == DER_SEQUENCE
-			&& v3[5].tag == DER_SEQUENCE
-			&& v3[6].tag == DER_SEQUENCE)
-		{
-			pbIssuer = v3[3].fvalue;
-			cbIssuer = v3[3].flen;
-			pbSN = v3[1].value;
-			cbSN = v3[1].len;
-		}
-		// senza version number
-		else if (v3.size() > 5
-			&& v3[0].tag == DER_INTEGER
-			&& v3[1].tag == DER_SEQUENCE
-			&& v3[2].tag == DER_SEQUENCE
-			&& v3[3].tag == DER_SEQUENCE
-			&& v3[4].tag == DER_SEQUENCE
-			&& v3[5].tag == DER_SEQUENCE)
-		{
-			pbIssuer = v3[2].fvalue;
-			cbIssuer = v3[2].flen;
-			pbSN = v3[0].value;
-			cbSN = v3[0].len;
-		}
-		else
-			return FALSE;
-
-
-	CAsn1Sequence IssuerAndSerialNumber(2);
-	CAsn1RawData Issuer(
-		pbIssuer,
-		(unsigned long)cbIssuer, TRUE);
-	
-	CAsn1Integer SerialNumber(
-			pbSN,
-			(unsigned long)cbSN, TRUE);
 
-	IssuerAndSerialNumber.Add(&Issuer);
-	IssuerAndSerialNumber.Add(&SerialNumber);
+		CAsn1Sequence IssuerAndSerialNumber(2, &Arena);
+		CAsn1RawData Issuer(
+			pbIssuer,
+			(unsigned long)cbIssuer, FALSE);
+		
+		CAsn1Integer SerialNumber(
+				pbSN,
+				(unsigned long)cbSN, FALSE);
+
+		IssuerAndSerialNumber.Add(&Issuer);
+		IssuerAndSerialNumber.Add(&SerialNumber);
+		cbIAS = IssuerAndSerialNumber.GetEncodedLength();
+		pbIAS = (unsigned char*) Arena.Alloc(cbIAS);
+		IssuerAndSerialNumber.GetEncoded(pbIAS);
+		SetSessionIssuerSerial((BYTE)wKid, pbIAS, cbIAS, slot);
+	}
+	CAsn1RawData IssuerAndSerialNumber(pbIAS, cbIAS, FALSE);
 	SignerInfo1.Add(&IssuerAndSerialNumber);
 
 	SignerInfo1.Add(&DigestAlgorithmIdentifier);
 	
 	// Signed attributes
-		CAsn1Set SignedAttributes(4);
+		CAsn1Set SignedAttributes(5, &Arena);
 
 		// Content type
-		CAsn1Sequence ContentType(2);
-		CAsn1Object ContentTypeOID("1.2.840.113549.1.9.3");
-		CAsn1Set ContentTypeValue(1);
+		CAsn1Sequence ContentType(2, &Arena);
+		CAsn1ConstData ContentTypeOID(Asn1OidContentType);
+		CAsn1Set ContentTypeValue(1, &Arena);
 		ContentTypeValue.Add(&Pkcs7DataOID);
 		ContentType.Add(&ContentTypeOID);
 		ContentType.Add(&ContentTypeValue);
@@ -409,63 +605,60 @@ static int SignDataML(
 		time_t curTime = time(NULL);
 		pCurTm = gmtime(&curTime);
 		CAsn1UTCTime Time(pCurTm->tm_year+1900, pCurTm->tm_mon+1, pCurTm->tm_mday, pCurTm->tm_hour, pCurTm->tm_min, pCurTm->tm_sec);
-		CAsn1Sequence SigningTime(2);
-		CAsn1Object SigningTimeOID("1.2.840.113549.1.9.5");
-		CAsn1Set SigningTimeValue(1);
+		CAsn1Sequence SigningTime(2, &Arena);
+		CAsn1ConstData SigningTimeOID(Asn1OidSigningTime);
+		CAsn1Set SigningTimeValue(1, &Arena);
 		SigningTimeValue.Add(&Time);
 		SigningTime.Add(&SigningTimeOID);
 		SigningTime.Add(&SigningTimeValue);
 
 		// Message digest
-		CAsn1Sequence MessageDigest(2);
-		CAsn1Object MessageDigestOID("1.2.840.113549.1.9.4");
-		CAsn1Set MessageDigestValue(1);
-		CAsn1OctetString MessageDigestOctets((unsigned char*) Sha1Digest_ptr, 20);
+		CAsn1Sequence MessageDigest(2, &Arena);
+		CAsn1ConstData MessageDigestOID(Asn1OidMessageDigest);
+		CAsn1Set MessageDigestValue(1, &Arena);
+		CAsn1OctetString MessageDigestOctets(pbDigest, cbDigest, TRUE, &Arena);
 		MessageDigestValue.Add(&MessageDigestOctets);
 		MessageDigest.Add(&MessageDigestOID);
 		MessageDigest.Add(&MessageDigestValue);
 
 		// S/mime capabilities
-		CAsn1Sequence SmimeCapabilities_attr(2);
-		CAsn1Object SmimeCapabilitiesOID("1.2.840.113549.1.9.15");
-		CAsn1Set SmimeCapabilitiesValue(1);
-		CAsn1Sequence SmimeCapabilities(3);
-		CAsn1Sequence SmimeCapabilitiy_Des_ede3_cbc(1);
-		CAsn1Object Des_ede3_cbcOID("1.2.840.113549.3.7");
-		CAsn1Sequence SmimeCapabilitiy_Des_cbc(1);
-		CAsn1Object Des_cbcOID("1.3.14.3.2.7");
-		CAsn1Sequence SmimeCapabilitiy_sha1WithRSA(1);
-		CAsn1Object sha1WithRSAOID("1.2.840.113549.1.1.5");
-
-		SmimeCapabilitiy_Des_ede3_cbc.Add(&Des_ede3_cbcOID);
-		SmimeCapabilitiy_Des_cbc.Add(&Des_cbcOID);
-		SmimeCapabilitiy_sha1WithRSA.Add(&sha1WithRSAOID);
-		SmimeCapabilities.Add(&SmimeCapabilitiy_Des_ede3_cbc);
-		SmimeCapabilities.Add(&SmimeCapabilitiy_Des_cbc);
-		SmimeCapabilities.Add(&SmimeCapabilitiy_sha1WithRSA);
-		SmimeCapabilitiesValue.Add(&SmimeCapabilities);
-		SmimeCapabilities_attr.Add(&SmimeCapabilitiesOID);
-		SmimeCapabilities_attr.Add(&SmimeCapabilitiesValue);
+		// (gli array hanno lunghezze diverse: ognuno ha il suo oggetto)
+		CAsn1ConstData SmimeCapabilitiesSha1_attr(Asn1AttrSmimeCapsSha1);
+		CAsn1ConstData SmimeCapabilitiesSha256_attr(Asn1AttrSmimeCapsSha256);
+
+		// Signing certificate v2 (RFC 5035), richiesto da CAdES-BES: solo con SHA-256
+		unsigned char* pbSigningCertificateV2 = NULL;
+		unsigned long cbSigningCertificateV2 = 0;
+		if (bSha256 && !EncodeSigningCertificateV2(&Arena,
+				pbCertContext, cbCertContext, pbIAS, cbIAS,
+				&pbSigningCertificateV2, &cbSigningCertificateV2))
+			return FALSE;
+		CAsn1RawData SigningCertificateV2_attr(pbSigningCertificateV2, cbSigningCertificateV2, FALSE);
 
 	SignedAttributes.Add(&ContentType);
 	SignedAttributes.Add(&SigningTime);
 	SignedAttributes.Add(&MessageDigest);
-	SignedAttributes.Add(&SmimeCapabilities_attr);
+	SignedAttributes.Add(bSha256 ? &SmimeCapabilitiesSha256_attr : &SmimeCapabilitiesSha1_attr);
+	if (bSha256)
+		SignedAttributes.Add(&SigningCertificateV2_attr);
 	
 	// RSA of attributes
 	unsigned long cbRsaSize = 0x80;
 	if(pbSignedBlob) {
 		unsigned char Padded[256] = {0};
+		S_PROBE1(signedattrs__start, slot);
 		unsigned long cbToBeEncrypted = SignedAttributes.GetEncodedLength();
-		unsigned char* pbToBeEncrypted = (unsigned char*) alloca(sizeof(unsigned char)*cbToBeEncrypted);
+		unsigned char* pbToBeEncrypted = (unsigned char*) Arena.Alloc(cbToBeEncrypted);
 		if(!SignedAttributes.GetEncoded(pbToBeEncrypted)) return FALSE;
+		S_PROBE2(signedattrs__done, slot, cbToBeEncrypted);
 
-		if(!SHA1(
+		if(!Digest(
+			nDigest,
 			pbToBeEncrypted,
 			cbToBeEncrypted,
-			Sha1Digest_ptr)) return FALSE;
+			pbDigest)) return FALSE;
 
-		Padding(Sha1Digest, sizeof Sha1Digest, Padded);
+		Padding(pbDigestInfo, cbDigestInfo, Padded);
 
 		if (SignML(wKid, Padded, RsaEncryption, slot) != C_OK) return FALSE;
 		int x=0;
@@ -475,10 +668,7 @@ static int SignDataML(
 	CAsn1Tagged SignedAttrs(&SignedAttributes, 0);
 	SignerInfo1.Add(&SignedAttrs);
 	// Signature algorithm
-	CAsn1Sequence SignatureAlgorithmIdentifier(2);
-	CAsn1Object RSAOID("1.2.840.113549.1.1.1");
-	SignatureAlgorithmIdentifier.Add(&RSAOID);
-	SignatureAlgorithmIdentifier.Add(&Null);
+	CAsn1ConstData SignatureAlgorithmIdentifier(Asn1AlgRsaEncryption);
 	SignerInfo1.Add(&SignatureAlgorithmIdentifier);
 	
 	// Signature value
@@ -495,3 +685,53 @@ static int SignDataML(
 	return TRUE;
 }
 
+// L'hashAlgorithm di ESSCertIDv2 e' omesso perche' sha256 e' il default;
+// issuer e serial number dell'issuerSerial vengono dall'IssuerAndSerialNumber.
+static int EncodeSigningCertificateV2(
+		CAsn1Arena* pArena,
+		const unsigned char* pbCertContext, unsigned long cbCertContext,
+		const unsigned char* pbIAS, unsigned long cbIAS,
+		unsigned char** ppbAttr, unsigned long* pcbAttr
+		)
+{
+	unsigned char CertHash256[SHA256HashSize];
+	if (!SHA256(pbCertContext, cbCertContext, CertHash256)) return FALSE;
+
+	_DER_ITEM_vector vIAS = der_parse(pbIAS, cbIAS);
+	_DER_ITEM_vector vIASItems;
+	if (vIAS.size() == 1 && vIAS[0].tag == DER_SEQUENCE)
+		vIASItems = der_parse(vIAS[0].value, vIAS[0].len);
+	if (vIASItems.size() != 2
+		|| vIASItems[0].tag != DER_SEQUENCE
+		|| vIASItems[1].tag != DER_INTEGER)
+		return FALSE;
+	CAsn1RawData IssuerName(vIASItems[0].fvalue, (unsigned long)vIASItems[0].flen, FALSE, TRUE);
+	CAsn1RawData IssuerSerialNumber(vIASItems[1].fvalue, (unsigned long)vIASItems[1].flen, FALSE);
+
+	CAsn1Sequence SigningCertificateV2_attr(2, pArena);
+	CAsn1ConstData SigningCertificateV2OID(Asn1OidSigningCertificateV2);
+	CAsn1Set SigningCertificateV2Value(1, pArena);
+	CAsn1Sequence SigningCertificateV2(1, pArena);
+	CAsn1Sequence EssCertIDs(1, pArena);
+	CAsn1Sequence EssCertIDv2(2, pArena);
+	CAsn1OctetString CertHashOctets(CertHash256, SHA256HashSize, TRUE, pArena);
+	CAsn1Sequence IssuerSerial(2, pArena);
+	CAsn1Sequence GeneralNames(1, pArena);
+	CAsn1Tagged DirectoryName(&IssuerName, 4);
+
+	GeneralNames.Add(&DirectoryName);
+	IssuerSerial.Add(&GeneralNames);
+	IssuerSerial.Add(&IssuerSerialNumber);
+	EssCertIDv2.Add(&CertHashOctets);
+	EssCertIDv2.Add(&IssuerSerial);
+	EssCertIDs.Add(&EssCertIDv2);
+	SigningCertificateV2.Add(&EssCertIDs);
+	SigningCertificateV2Value.Add(&SigningCertificateV2);
+	SigningCertificateV2_attr.Add(&SigningCertificateV2OID);
+	SigningCertificateV2_attr.Add(&SigningCertificateV2Value);
+
+	*pcbAttr = SigningCertificateV2_attr.GetEncodedLength();
+	*ppbAttr = (unsigned char*) pArena->Alloc(*pcbAttr);
+	return SigningCertificateV2_attr.GetEncoded(*ppbAttr);
+}
+
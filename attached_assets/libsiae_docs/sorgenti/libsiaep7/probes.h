@@ -0,0 +1,56 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*****************************************************************************
+  Punti di osservazione statici (USDT) per bpftrace, perf e SystemTap.
+
+  Se e' disponibile <sys/sdt.h> ogni probe e' un'istruzione nop finche'
+  nessuno strumento vi si collega (gli argomenti restano in registri o in
+  memoria, senza chiamate); altrimenti, o con -DLIBSIAE_NO_SDT, le macro
+  non generano codice ma valutano gli argomenti come (void), cosi' le
+  variabili usate solo dai probe non danno avvisi di variabile inutilizzata.
+
+  Provider libsiae:
+    apdu__start(slot, header)            header = CLA INS P1 P2
+    apdu__done(slot, header, sw, rv)     sw = 0 se la carta non ha risposto,
+                                         rv = codice SCARD_xxx del trasporto
+    call__entry(name, slot)              funzioni pubbliche *ML
+    call__return(name, slot, rv)         (non per i rifiuti immediati dovuti
+                                         ad argomenti o slot non validi)
+    sha1__start(len)
+    sha1__done(len)
+    sha1multi__start(n)                  n messaggi in SHA1Multi
+    sha1multi__done(n)
+    sha256__start(len)
+    sha256__done(len)
+    signedattrs__start(slot)             codifica degli attributi firmati
+    signedattrs__done(slot, len)         in SignDataML
+    file__read(name, len)                file da firmare in PKCS7SignML
+    file__write(name, len, ok)           MemWriteFile
+
+  Es.: bpftrace -e 'usdt:/usr/lib/libsiae.so:libsiae:apdu__start
+                      { @t[tid]=nsecs }
+                    usdt:/usr/lib/libsiae.so:libsiae:apdu__done /@t[tid]/
+                      { @us[(arg1>>16)&0xff]=hist((nsecs-@t[tid])/1000); }'
+*****************************************************************************/
+
+#if !defined(HAVE_SYS_SDT_H) && !defined(LIBSIAE_NO_SDT) && defined(__has_include)
+#	if __has_include(<sys/sdt.h>)
+#		define HAVE_SYS_SDT_H 1
+#	endif
+#endif
+
+#if defined(HAVE_SYS_SDT_H) && !defined(LIBSIAE_NO_SDT)
+#	include <sys/sdt.h>
+#	define S_PROBE1(name,a)          DTRACE_PROBE1(libsiae,name,a)
+#	define S_PROBE2(name,a,b)        DTRACE_PROBE2(libsiae,name,a,b)
+#	define S_PROBE3(name,a,b,c)      DTRACE_PROBE3(libsiae,name,a,b,c)
+#	define S_PROBE4(name,a,b,c,d)    DTRACE_PROBE4(libsiae,name,a,b,c,d)
+#else
+#	define S_PROBE1(name,a)          ((void)(a))
+#	define S_PROBE2(name,a,b)        ((void)(a),(void)(b))
+#	define S_PROBE3(name,a,b,c)      ((void)(a),(void)(b),(void)(c))
+#	define S_PROBE4(name,a,b,c,d)    ((void)(a),(void)(b),(void)(c),(void)(d))
+#endif
+
+#endif // PROBES_H
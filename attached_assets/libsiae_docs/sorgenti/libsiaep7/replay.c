@@ -0,0 +1,434 @@
+/*****************************************************************************
+        Registrazione delle sessioni APDU e trasporto di riproduzione
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+#include "internals.h"
+#ifndef WIN32
+#	include <sys/types.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+static void PutWord(BYTE *p, WORD v)
+{
+  p[0]=(BYTE)(v&0xff); p[1]=(BYTE)(v>>8);
+}
+
+static void PutDword(BYTE *p, DWORD v)
+{
+  p[0]=(BYTE)(v&0xff); p[1]=(BYTE)(v>>8); p[2]=(BYTE)(v>>16); p[3]=(BYTE)(v>>24);
+}
+
+static WORD GetWord(const BYTE *p)
+{
+  return (WORD)(p[0]|(p[1]<<8));
+}
+
+static DWORD GetDword(const BYTE *p)
+{
+  return (DWORD)p[0]|((DWORD)p[1]<<8)|((DWORD)p[2]<<16)|((DWORD)p[3]<<24);
+}
+
+/* Registrazione */
+
+static FILE *volatile recordFile=NULL;
+static SYS_INT64 recordStart=0;
+static SYS_MUTEX recordLock;           /* tenuto durante la scrittura su file */
+static SYS_ATOMIC recordLockState=0;
+static SYS_ATOMIC recordEnvChecked=0;
+
+/* La registrazione contiene i dati scambiati con la carta: il file e' */
+/* leggibile solo dall'utente                                        */
+static FILE *CreateRecordFile(const char *szFileName)
+{
+#ifdef WIN32
+  return fopen(szFileName,"wb");
+#else
+  FILE *f;
+  int fd=open(szFileName,O_WRONLY|O_CREAT|O_TRUNC,0600);
+  if (fd<0) return NULL;
+  fchmod(fd,0600);
+  f=fdopen(fd,"wb");
+  if (f==NULL) close(fd);
+  return f;
+#endif
+}
+
+int CALLINGCONV StartApduRecording(const char *szFileName)
+{
+  FILE *f, *old;
+  BYTE hdr[APDU_TRACE_HEADER];
+  SysAtomicStore(&recordEnvChecked,TRUE);
+  if ((szFileName==NULL)||(*szFileName=='\0')) return C_GENERIC_ERROR;
+  f=CreateRecordFile(szFileName);
+  if (f==NULL) return C_GENERIC_ERROR;
+  memset(hdr,0,sizeof(hdr));
+  memcpy(hdr,APDU_TRACE_MAGIC,8);
+  PutWord(hdr+8,APDU_TRACE_VERSION);
+  if (fwrite(hdr,1,sizeof(hdr),f)!=sizeof(hdr)) {
+    fclose(f);
+    return C_GENERIC_ERROR;
+  }
+  SysMutexInitOnce(&recordLock,&recordLockState);
+  SysMutexLock(&recordLock);
+  old=recordFile;
+  recordStart=SysTimeUs();
+  SysAtomicStorePtr((void *volatile *)&recordFile,f);
+  SysMutexUnlock(&recordLock);
+  if (old!=NULL) fclose(old);
+  S_TRACE("StartApduRecording: %s\n", szFileName);
+  return C_OK;
+}
+
+int CALLINGCONV StopApduRecording()
+{
+  FILE *f;
+  SysMutexInitOnce(&recordLock,&recordLockState);
+  SysMutexLock(&recordLock);
+  f=recordFile;
+  SysAtomicStorePtr((void *volatile *)&recordFile,NULL);
+  SysMutexUnlock(&recordLock);
+  if (f==NULL) return C_NOT_INITIALIZED;
+  fclose(f);
+  return C_OK;
+}
+
+BOOL ApduRecording()
+{
+  const char *env;
+  if ((SysAtomicLoad(&recordEnvChecked)==FALSE)&&SysAtomicCAS(&recordEnvChecked,FALSE,TRUE)) {
+    env=getenv("LIBSIAE_APDU_RECORD");
+    if ((env!=NULL)&&(*env!='\0')) StartApduRecording(env);
+  }
+  return SysAtomicLoadPtr((void *volatile *)&recordFile)!=NULL;
+}
+
+/* Il file viene svuotato dopo ogni record: la sessione resta */
+/* leggibile anche se il processo termina in modo anomalo.    */
+/* Come nella traccia, delle APDU che trasportano PIN o PUK   */
+/* (VERIFY, CHANGE REFERENCE DATA, RESET RETRY COUNTER) si    */
+/* registra l'intestazione con Lc e i dati azzerati: la       */
+/* riproduzione le riconosce comunque dall'intestazione.      */
+void RecordApdu(int nSlot, const BYTE *pSend, DWORD lSend, const BYTE *pRecv, DWORD lRecv,
+                long rv, SYS_INT64 tStart, SYS_INT64 tEnd)
+{
+  static const BYTE zeros[64]={0};
+  BYTE rec[APDU_TRACE_RECORD];
+  SYS_INT64 t;
+  DWORD i, n;
+  int secret=(lSend>5)&&((pSend[1]==0x20)||(pSend[1]==0x24)||(pSend[1]==0x2C));
+  SysMutexInitOnce(&recordLock,&recordLockState);
+  SysMutexLock(&recordLock);
+  if (recordFile!=NULL) {
+    t=tStart-recordStart;
+    PutWord(rec,(WORD)nSlot);
+    PutWord(rec+2,(WORD)lSend);
+    PutWord(rec+4,(WORD)lRecv);
+    PutWord(rec+6,0);
+    PutDword(rec+8,(DWORD)(t&0xffffffff));
+    PutDword(rec+12,(DWORD)(t>>32));
+    PutDword(rec+16,(DWORD)(tEnd-tStart));
+    PutDword(rec+20,(DWORD)rv);
+    fwrite(rec,1,sizeof(rec),recordFile);
+    if (secret) {
+      fwrite(pSend,1,5,recordFile);
+      for (i=5; i<lSend; i+=n) {
+        n=((lSend-i)>sizeof(zeros))?(DWORD)sizeof(zeros):(lSend-i);
+        fwrite(zeros,1,n,recordFile);
+      }
+    }
+    else fwrite(pSend,1,lSend,recordFile);
+    if (lRecv>0) fwrite(pRecv,1,lRecv,recordFile);
+    fflush(recordFile);
+  }
+  SysMutexUnlock(&recordLock);
+}
+
+/* Riproduzione */
+
+typedef struct _REPLAY_RECORD {
+  DWORD dur;
+  LONG rv;
+  WORD lSend;
+  WORD lRecv;
+  const BYTE *pSend;
+  const BYTE *pRecv;
+} REPLAY_RECORD;
+
+typedef struct _REPLAY_SLOT {
+  REPLAY_RECORD *recs;
+  int n;
+  int next;                 /* prossimo record da servire */
+} REPLAY_SLOT;
+
+static BYTE *replayData=NULL;
+static REPLAY_SLOT *replaySlots=NULL;
+static SYS_ATOMIC nReplaySlots=0;
+static BOOL replayTimed=FALSE;
+static SYS_SPINLOCK replayLock=0;
+static SYS_ATOMIC replayConnections=0;
+static SYS_ATOMIC replayEnvChecked=0;
+static SYS_ATOMIC replayContexts=0;
+static SYS_ATOMIC replayCancel=0;
+
+static void FreeReplay(BYTE *data, REPLAY_SLOT *slots, int n)
+{
+  int i;
+  if (slots!=NULL)
+    for (i=0; i<n; i++) free(slots[i].recs);
+  free(slots);
+  free(data);
+}
+
+/* Scorre i record del file; con slots==NULL conta soltanto i record */
+/* di ogni slot in counts. Ritorna FALSE se il file e' troncato.     */
+static BOOL ParseRecords(const BYTE *data, long size, int *counts, REPLAY_SLOT *slots)
+{
+  long off=APDU_TRACE_HEADER;
+  const BYTE *p;
+  REPLAY_RECORD *r;
+  int slot;
+  while (off<size) {
+    if (off+APDU_TRACE_RECORD>size) return FALSE;
+    p=data+off;
+    slot=GetWord(p);
+    if ((slot>=MAX_SLOTS)||(off+APDU_TRACE_RECORD+GetWord(p+2)+GetWord(p+4)>size)) return FALSE;
+    if (slots==NULL) counts[slot]++;
+    else {
+      r=&slots[slot].recs[slots[slot].n++];
+      r->lSend=GetWord(p+2);
+      r->lRecv=GetWord(p+4);
+      r->dur=GetDword(p+16);
+      r->rv=(LONG)GetDword(p+20);
+      r->pSend=p+APDU_TRACE_RECORD;
+      r->pRecv=r->pSend+r->lSend;
+    }
+    off+=APDU_TRACE_RECORD+GetWord(p+2)+GetWord(p+4);
+  }
+  return TRUE;
+}
+
+int CALLINGCONV LoadApduReplay(const char *szFileName, BOOL bTimed)
+{
+  FILE *f;
+  long size;
+  BYTE *data=NULL;
+  REPLAY_SLOT *slots=NULL;
+  int *counts=NULL;
+  int i, n=0, rv=C_GENERIC_ERROR;
+
+  SysAtomicStore(&replayEnvChecked,TRUE);
+  if ((szFileName==NULL)||(*szFileName=='\0')) return C_GENERIC_ERROR;
+  if (SysAtomicLoad(&replayConnections)>0) return C_GENERIC_ERROR;
+  f=fopen(szFileName,"rb");
+  if (f==NULL) return C_GENERIC_ERROR;
+  fseek(f,0,SEEK_END);
+  size=ftell(f);
+  fseek(f,0,SEEK_SET);
+  if (size>=APDU_TRACE_HEADER) data=(BYTE*)malloc(size);
+  if ((data==NULL)||(fread(data,1,size,f)!=(size_t)size)) goto CleanUp;
+  if ((memcmp(data,APDU_TRACE_MAGIC,8)!=0)||(GetWord(data+8)!=APDU_TRACE_VERSION)) goto CleanUp;
+
+  counts=(int*)calloc(MAX_SLOTS,sizeof(int));
+  if (counts==NULL) goto CleanUp;
+  if (!ParseRecords(data,size,counts,NULL)) goto CleanUp;
+  for (i=0; i<MAX_SLOTS; i++)
+    if (counts[i]>0) n=i+1;
+  if (n==0) goto CleanUp;
+  slots=(REPLAY_SLOT*)calloc(n,sizeof(REPLAY_SLOT));
+  if (slots==NULL) goto CleanUp;
+  for (i=0; i<n; i++)
+    if (counts[i]>0) {
+      slots[i].recs=(REPLAY_RECORD*)malloc(counts[i]*sizeof(REPLAY_RECORD));
+      if (slots[i].recs==NULL) goto CleanUp;
+    }
+  ParseRecords(data,size,NULL,slots);
+
+  SysSpinLock(&replayLock);
+  FreeReplay(replayData,replaySlots,(int)SysAtomicLoad(&nReplaySlots));
+  replayData=data;
+  replaySlots=slots;
+  replayTimed=bTimed;
+  SysAtomicStore(&nReplaySlots,n);
+  SysSpinUnlock(&replayLock);
+  data=NULL;
+  slots=NULL;
+  rv=C_OK;
+CleanUp:
+  fclose(f);
+  if (counts!=NULL) free(counts);
+  FreeReplay(data,slots,n);
+  S_TRACE("LoadApduReplay: %s, slots=%d, rv=%d\n", szFileName, n, rv);
+  return rv;
+}
+
+/* Record da servire per il comando s, NULL se non ce n'e' uno adatto */
+static REPLAY_RECORD *NextRecord(REPLAY_SLOT *pSlot, LPCBYTE s, DWORD sl)
+{
+  REPLAY_RECORD *r;
+  int k, i, hdr=-1, found=-1;
+  for (k=0; (k<pSlot->n)&&(found<0); k++) {
+    i=(pSlot->next+k)%pSlot->n;
+    r=&pSlot->recs[i];
+    if ((sl<4)||(r->lSend<4)||(memcmp(r->pSend,s,4)!=0)) continue;
+    if ((k==0)||((r->lSend==sl)&&(memcmp(r->pSend,s,sl)==0))) found=i;
+    else if (hdr<0) hdr=i;
+  }
+  if (found<0) found=hdr;
+  if (found<0) return NULL;
+  pSlot->next=(found+1)%pSlot->n;
+  return &pSlot->recs[found];
+}
+
+static int ReplayReaderIndex(LPCSTR szReader)
+{
+  size_t l=strlen(REPLAY_READER_PREFIX);
+  int n;
+  if ((szReader==NULL)||(strncmp(szReader,REPLAY_READER_PREFIX,l)!=0)) return -1;
+  n=atoi(szReader+l);
+  if (n<0) return -1;
+  /* replaySlots puo' essere sostituito da LoadApduReplay */
+  SysSpinLock(&replayLock);
+  if ((n>=SysAtomicLoad(&nReplaySlots))||(replaySlots[n].n==0)) n=-1;
+  SysSpinUnlock(&replayLock);
+  return n;
+}
+
+static LONG ReplayEstablishContext(SIAE_TRANSPORT *t, SCARDCONTEXT *phContext)
+{
+  const char *env, *timed;
+  if ((SysAtomicLoad(&replayEnvChecked)==FALSE)&&SysAtomicCAS(&replayEnvChecked,FALSE,TRUE)) {
+    env=getenv("LIBSIAE_REPLAY");
+    timed=getenv("LIBSIAE_REPLAY_TIMED");
+    if ((env!=NULL)&&(*env!='\0'))
+      LoadApduReplay(env,(timed!=NULL)&&(atoi(timed)!=0));
+  }
+  if (SysAtomicLoad(&nReplaySlots)==0) return SCARD_E_NO_SERVICE;
+  *phContext=(SCARDCONTEXT)SysAtomicAdd(&replayContexts,1);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayReleaseContext(SIAE_TRANSPORT *t, SCARDCONTEXT hContext)
+{
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayListReaders(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPSTR mszReaders, LPDWORD pcchReaders)
+{
+  char name[MAX_READER_NAME];
+  DWORD size=1, l=0;
+  int i, n=(int)SysAtomicLoad(&nReplaySlots);
+  if (n==0) return SCARD_E_NO_READERS_AVAILABLE;
+  for (i=0; i<n; i++) size+=sprintf(name,REPLAY_READER_PREFIX "%d",i)+1;
+  if (mszReaders!=NULL) {
+    if (*pcchReaders<size) {
+      *pcchReaders=size;
+      return SCARD_E_INSUFFICIENT_BUFFER;
+    }
+    for (i=0; i<n; i++) l+=sprintf(mszReaders+l,REPLAY_READER_PREFIX "%d",i)+1;
+    mszReaders[l]='\0';
+  }
+  *pcchReaders=size;
+  return SCARD_S_SUCCESS;
+}
+
+/* I lettori della sessione registrata hanno sempre la carta inserita */
+static LONG ReplayGetStatusChange(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, DWORD dwTimeout, SCARD_READERSTATE *rgReaderStates, DWORD cReaders)
+{
+  DWORD i, st, waited=0;
+  BOOL changed;
+  for (;;) {
+    changed=FALSE;
+    for (i=0; i<cReaders; i++) {
+      if (strcmp(rgReaderStates[i].szReader,"\\\\?PnP?\\Notification")==0) st=0x10000;
+      else if (ReplayReaderIndex(rgReaderStates[i].szReader)<0) st=SCARD_STATE_UNKNOWN|SCARD_STATE_IGNORE;
+      else st=0x10000|SCARD_STATE_PRESENT;
+      if ((rgReaderStates[i].dwCurrentState&~SCARD_STATE_CHANGED)!=st) {
+        st|=SCARD_STATE_CHANGED;
+        changed=TRUE;
+      }
+      rgReaderStates[i].dwEventState=st;
+    }
+    if (changed) return SCARD_S_SUCCESS;
+    if (SysAtomicCAS(&replayCancel,(long)hContext,0)) return SCARD_E_CANCELLED;
+    if ((dwTimeout!=INFINITE)&&(waited>=dwTimeout)) return SCARD_E_TIMEOUT;
+    SysSleep(10);
+    waited+=10;
+  }
+}
+
+static LONG ReplayCancel(SIAE_TRANSPORT *t, SCARDCONTEXT hContext)
+{
+  SysAtomicStore(&replayCancel,(long)hContext);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayConnect(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPCSTR szReader, SCARDHANDLE *phCard)
+{
+  int n=ReplayReaderIndex(szReader);
+  if (n<0) return SCARD_E_UNKNOWN_READER;
+  SysAtomicAdd(&replayConnections,1);
+  *phCard=(SCARDHANDLE)(n+1);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayReconnect(SIAE_TRANSPORT *t, SCARDHANDLE hCard)
+{
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayDisconnect(SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition)
+{
+  SysAtomicAdd(&replayConnections,-1);
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayBeginTransaction(SIAE_TRANSPORT *t, SCARDHANDLE hCard)
+{
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayEndTransaction(SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition)
+{
+  return SCARD_S_SUCCESS;
+}
+
+static LONG ReplayTransmit(SIAE_TRANSPORT *t, SCARDHANDLE hCard, LPCBYTE pbSend, DWORD cbSend, LPBYTE pbRecv, LPDWORD pcbRecv)
+{
+  REPLAY_RECORD *r;
+  int n=(int)hCard-1;
+  DWORD dur=0;
+  LONG rv=SCARD_S_SUCCESS;
+
+  if ((n<0)||(n>=SysAtomicLoad(&nReplaySlots))) return SCARD_E_INVALID_HANDLE;
+  SysSpinLock(&replayLock);
+  r=NextRecord(&replaySlots[n],pbSend,cbSend);
+  if (r==NULL) rv=SCARD_E_UNEXPECTED;
+  else if (r->rv!=SCARD_S_SUCCESS) {
+    rv=r->rv;
+    *pcbRecv=0;
+  }
+  else if (r->lRecv>*pcbRecv) rv=SCARD_E_INSUFFICIENT_BUFFER;
+  else {
+    memcpy(pbRecv,r->pRecv,r->lRecv);
+    *pcbRecv=r->lRecv;
+  }
+  if ((r!=NULL)&&replayTimed) dur=r->dur;
+  SysSpinUnlock(&replayLock);
+  if (r==NULL) S_TRACE_ERROR("ReplayTransmit: slot %d, no recorded response\n", n);
+  if (dur>0) SysSleepUs((long)dur);
+  return rv;
+}
+
+SIAE_TRANSPORT replayTransport={
+  REPLAY_TRANSPORT_NAME, NULL,
+  ReplayEstablishContext, ReplayReleaseContext, ReplayListReaders,
+  ReplayGetStatusChange, ReplayCancel,
+  ReplayConnect, ReplayReconnect, ReplayDisconnect,
+  ReplayBeginTransaction, ReplayEndTransaction, ReplayTransmit
+};
@@ -0,0 +1,63 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "transport.h"
+#include "sysdep.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************
+  Registrazione e riproduzione delle sessioni APDU.
+
+  Durante la registrazione ogni scambio con la carta (comando, risposta,
+  codice di ritorno del trasporto, istante e durata) viene aggiunto a un
+  file binario. La registrazione si avvia con StartApduRecording o con la
+  variabile d'ambiente LIBSIAE_APDU_RECORD=<file>.
+
+  Il trasporto "replay" serve le risposte registrate senza lettore: lo
+  slot n diventa il lettore "SIAE Replay n" e riceve, nell'ordine, le
+  risposte registrate per lo slot n. Un comando riceve la risposta del
+  record successivo se questo ha la stessa intestazione (CLA INS P1 P2),
+  altrimenti quella del primo record seguente con lo stesso comando o, in
+  mancanza, con la stessa intestazione: i dati che cambiano ad ogni
+  esecuzione, come data e ora del sigillo, non interrompono la
+  riproduzione. Alla fine della sessione si riparte dall'inizio. In modalita' temporizzata ogni
+  risposta arriva dopo la durata registrata, altrimenti subito.
+  Il file si indica con LoadApduReplay o con LIBSIAE_REPLAY=<file> (e
+  LIBSIAE_REPLAY_TIMED=1 per la modalita' temporizzata).
+
+  Formato del file (interi little endian):
+    intestazione  "SIAEAPDU", versione (2 byte), 6 byte riservati
+    record        slot (2), lunghezza comando (2), lunghezza risposta (2),
+                  riservato (2), istante in us dall'avvio (8), durata in
+                  us (4), codice di ritorno del trasporto (4), seguiti da
+                  comando e risposta
+*****************************************************************************/
+
+#define REPLAY_TRANSPORT_NAME  "replay"
+#define REPLAY_READER_PREFIX   "SIAE Replay "
+#define APDU_TRACE_MAGIC       "SIAEAPDU"
+#define APDU_TRACE_VERSION     1
+#define APDU_TRACE_HEADER      16
+#define APDU_TRACE_RECORD      24
+
+int CALLINGCONV StartApduRecording(const char *szFileName);
+int CALLINGCONV StopApduRecording();
+
+/* Carica il file da riprodurre; possibile solo quando il trasporto */
+/* "replay" non ha connessioni aperte                               */
+int CALLINGCONV LoadApduReplay(const char *szFileName, BOOL bTimed);
+
+/* Uso interno */
+BOOL ApduRecording();
+void RecordApdu(int nSlot, const BYTE *pSend, DWORD lSend, const BYTE *pRecv, DWORD lRecv,
+                long rv, SYS_INT64 tStart, SYS_INT64 tEnd);
+extern SIAE_TRANSPORT replayTransport;
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // REPLAY_H
@@ -6,9 +6,15 @@ provvedere a scrivere funzioni equivalenti cambiando ambiente di sviluppo.
 #include "scardhal.h"
 
 #include "internals.h"
+#include "sysdep.h"
+#include "transport.h"
+#include "replay.h"
+#include "stats.h"
+#include "probes.h"
 
 #include "global.h"
 #include "sha1.h"
+#include "sha256.h"
 #include "md5.h"
 
 #include <stdlib.h>
@@ -22,109 +28,551 @@ int defSlot=-1; /* Slot di default */
 #define ATR_LEN 0x15
 
 /* hContMLt  una variabile globale e rappresenta il contesto PC/SC */
-/* della applicazione */
+/* della applicazione, aperto con il trasporto hContextTp */
 static SCARDCONTEXT hContext=0;
+static SIAE_TRANSPORT *hContextTp=NULL;
 
-/* hCard  l'handle che individua univocamente il canale PC/SC */
-/* aperto con una smart card */
-static SCARDHANDLE  hCard=0;
+/* Trasporto in uso: viene fissato al primo utilizzo e puo' essere */
+/* cambiato con SelectTransport solo quando nessuno slot e'        */
+/* inizializzato                                                   */
+static SIAE_TRANSPORT *volatile transport=NULL;
+
+/* Stato di ciascuno slot. Ogni slot ha un proprio contesto PC/SC (con */
+/* pcsc-lite le chiamate sullo stesso contesto vengono serializzate) e  */
+/* un mutex ricorsivo che il thread acquisisce con BeginTransactionML e */
+/* rilascia con EndTransactionML: operazioni su slot diversi procedono  */
+/* in parallelo, quelle sullo stesso slot una dopo l'altra.             */
+typedef struct _SLOT_CONTEXT {
+  SYS_MUTEX     lock;
+  SIAE_TRANSPORT *tp;        /* trasporto con cui e' stato aperto hContext */
+  SCARDCONTEXT  hContext;
+  SCARDHANDLE   hCard;
+  int           nTransactions;
+  SELECT_STATE  select;      /* DF/EF selezionato                        */
+  SESSION_CACHE session;     /* metadati della carta letti al primo uso  */
+  int           readBlock;   /* dimensione del blocco di READ BINARY     */
+  char          reader[MAX_READER_NAME];
+  SYS_ATOMIC    state;       /* SLOT_STATE_xxx secondo il monitor        */
+  SYS_ATOMIC    forget;      /* carta rimossa, da scartare alla prossima */
+                             /* transazione                              */
+  void *volatile stats;      /* statistiche, gestite da stats.c          */
+} SLOT_CONTEXT;
+
+/* Registro degli slot: gli slot vengono allocati a blocchi di SLOT_CHUNK */
+/* al primo utilizzo e non vengono mai liberati. L'indirizzo di uno slot  */
+/* (e del suo mutex) resta quindi valido e la ricerca per indice non      */
+/* richiede lock. L'indice dei blocchi cresce raddoppiando: il nuovo      */
+/* indice viene pubblicato con uno scambio atomico e quelli precedenti,   */
+/* che un lettore potrebbe ancora consultare, restano allocati.           */
+#define SLOT_CHUNK  16
+
+typedef struct _SLOT_INDEX {
+  struct _SLOT_INDEX *prev;  /* indice sostituito                        */
+  int           size;        /* numero di blocchi indirizzabili          */
+  SLOT_CONTEXT *volatile chunks[1];
+} SLOT_INDEX;
+
+static SLOT_INDEX *volatile slotIndex=NULL;
+static SYS_SPINLOCK slotIndexLock=0;  /* crescita dell'indice e nuovi blocchi */
+
+/* halLock protegge lo stato condiviso tra gli slot: contesto PC/SC    */
+/* globale, tabella dei lettori, readerTuning, defSlot. Chi deve       */
+/* acquisire anche il lock di uno slot lo acquisisce per primo.        */
+static SYS_MUTEX halLock;
+static SYS_ATOMIC halLockState=0;
 
-SCARDHANDLE hCards[MAX_READERS];
-int hCardsTransactions[MAX_READERS];
 /* initialized  una variabile booleana globale che viene utilizzata */
 /* per tenere traccia dell'inizializzazione della libreria */
-static BOOL initialized=FALSE;
+static SYS_ATOMIC initialized=FALSE;
 
 /* Variabili e funzioni ad uso interno */
+
+/* Tabella dei lettori: pszReaderNames contiene la multistringa restituita */
+/* da SCardListReaders (cch e' la dimensione del buffer), readerTable i    */
+/* puntatori ai singoli nomi. La tabella viene riletta solo quando il      */
+/* lettore fittizio PnP segnala che l'elenco dei lettori e' cambiato.      */
+#define PNP_READER "\\\\?PnP?\\Notification"
 static LPTSTR pszReaderNames=NULL;
 static DWORD cch=0;
+static LPTSTR *readerTable=NULL;
+static int nReaderTable=0;
+static int readerTableSize=0;
+/* Indice dei lettori per nome: tabella hash ad indirizzamento aperto di */
+/* readerHashSize (potenza di 2) elementi, -1 per gli elementi liberi    */
+static int *readerHash=NULL;
+static int readerHashSize=0;
+static BOOL readerTableValid=FALSE;
+static DWORD pnpState=SCARD_STATE_UNAWARE;
+static BOOL pnpSupported=TRUE;
+
+/* numero di slot inizializzati */
+static SYS_ATOMIC instances=0;
+
+/* Dimensioni di blocco provate per la READ BINARY, dalla piu' grande alla */
+/* piu' piccola. Quando un lettore (o la carta) non gestisce una          */
+/* dimensione si passa alla successiva; EXCHANGE_BUFFER funziona sempre.  */
+static const int ReadBlockSizes[]={MAX_READ_BLOCK,248,EXCHANGE_BUFFER};
+#define READ_BLOCK_SIZES ((int)(sizeof(ReadBlockSizes)/sizeof(ReadBlockSizes[0])))
+
+/* Dimensioni di blocco gia' determinate, per nome di lettore: restano */
+/* valide per tutta la vita del processo, anche dopo FinalizeML        */
+typedef struct _READER_TUNING {
+  char name[MAX_READER_NAME];
+  int  block;
+} READER_TUNING;
+static READER_TUNING *readerTuning=NULL;
+static int nReaderTuning=0;
+static int readerTuningSize=0;
+
+static void FireSlotEvent(int nSlot, int nEvent);
+static void ApplyEvents(SLOT_CONTEXT *pSlot);
+static void ProbeReadBlock(SLOT_CONTEXT *pSlot, int nSlot);
+
+/* Scarta tutto cio' che la libreria sa della carta inserita nello slot: */
+/* da chiamare quando la carta viene resettata, rimossa o disconnessa.   */
+static void ForgetCard(SLOT_CONTEXT *pSlot)
+{
+  pSlot->select.valid=FALSE;
+  pSlot->select.forgotten++;
+  memset(&pSlot->session,0,sizeof(pSlot->session));
+}
+
+/* Status word dopo le quali il file corrente e' certamente invariato */
+static int SelectPreserved(WORD sw)
+{
+  switch (sw>>8) {
+  case 0x90: case 0x61:       /* esito positivo                        */
+  case 0x62: case 0x63:       /* avvertimenti, PIN errato              */
+  case 0x6C:                  /* Le errato                             */
+    return TRUE;
+  }
+  return sw==0x6700;          /* lunghezza errata (blocchi di lettura) */
+}
+
+/* Slot nSlot; NULL se l'indice non e' valido o lo slot non e' mai stato */
+/* usato                                                                 */
+static SYS_INLINE SLOT_CONTEXT *GetSlot(int nSlot)
+{
+  SLOT_INDEX *idx;
+  SLOT_CONTEXT *chunk;
+  if ((unsigned int)nSlot>=MAX_SLOTS) return NULL;
+  idx=(SLOT_INDEX*)SysAtomicLoadPtr((void*volatile*)&slotIndex);
+  if ((idx==NULL)||(nSlot/SLOT_CHUNK>=idx->size)) return NULL;
+  chunk=(SLOT_CONTEXT*)SysAtomicLoadPtr((void*volatile*)&idx->chunks[nSlot/SLOT_CHUNK]);
+  return (chunk!=NULL)?&chunk[nSlot%SLOT_CHUNK]:NULL;
+}
+
+/* Limite superiore (escluso) degli indici degli slot allocati */
+static int SlotLimit()
+{
+  SLOT_INDEX *idx=(SLOT_INDEX*)SysAtomicLoadPtr((void*volatile*)&slotIndex);
+  return (idx!=NULL)?idx->size*SLOT_CHUNK:0;
+}
+
+/* Come GetSlot, ma alloca il blocco che contiene lo slot se necessario */
+static SLOT_CONTEXT *AllocSlot(int nSlot)
+{
+  SLOT_INDEX *idx, *grown;
+  SLOT_CONTEXT *chunk;
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  int i, c, size;
+  if ((pSlot!=NULL)||((unsigned int)nSlot>=MAX_SLOTS)) return pSlot;
+  c=nSlot/SLOT_CHUNK;
+  chunk=(SLOT_CONTEXT*)calloc(SLOT_CHUNK,sizeof(SLOT_CONTEXT));
+  if (chunk==NULL) return NULL;
+  for (i=0; i<SLOT_CHUNK; i++) SysMutexInit(&chunk[i].lock);
+  /* la sezione critica alloca soltanto memoria: i lettori non la attendono */
+  SysSpinLock(&slotIndexLock);
+  idx=slotIndex;
+  if ((idx==NULL)||(c>=idx->size)) {
+    for (size=(idx!=NULL)?2*idx->size:4; size<=c; size*=2);
+    grown=(SLOT_INDEX*)calloc(1,sizeof(SLOT_INDEX)+(size-1)*sizeof(SLOT_CONTEXT*));
+    if (grown!=NULL) {
+      grown->prev=idx;
+      grown->size=size;
+      if (idx!=NULL)
+        memcpy((void*)grown->chunks,(void*)idx->chunks,idx->size*sizeof(SLOT_CONTEXT*));
+      SysAtomicStorePtr((void*volatile*)&slotIndex,grown);
+    }
+    idx=grown;
+  }
+  if ((idx!=NULL)&&(idx->chunks[c]==NULL)) {
+    SysAtomicStorePtr((void*volatile*)&idx->chunks[c],chunk);
+    chunk=NULL;
+  }
+  SysSpinUnlock(&slotIndexLock);
+  if (chunk!=NULL) {
+    /* il blocco e' stato allocato nel frattempo da un altro thread */
+    for (i=0; i<SLOT_CHUNK; i++) SysMutexDestroy(&chunk[i].lock);
+    free(chunk);
+  }
+  return GetSlot(nSlot);
+}
+
+/* halLock viene creato al primo utilizzo */
+static void InitHalLock()
+{
+  SysMutexInitOnce(&halLock,&halLockState);
+}
 
-static int instances=0;
+/* Accesso allo stato dello slot da parte di libsiaecard.c: va usato */
+/* all'interno di BeginTransactionML/EndTransactionML, che hanno gia' */
+/* verificato l'indice                                                */
+SELECT_STATE *SlotSelectState(int nSlot)
+{
+  return &GetSlot(nSlot)->select;
+}
 
+SESSION_CACHE *SlotSession(int nSlot)
+{
+  return &GetSlot(nSlot)->session;
+}
+
+/* Per stats.c: NULL se lo slot non e' mai stato usato */
+void *volatile *SlotStatsRef(int nSlot)
+{
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  return (pSlot!=NULL)?&pSlot->stats:NULL;
+}
 
 int CALLINGCONV IsInitialized()
 {
-  return initialized;
+  return (int)SysAtomicLoad(&initialized);
 }
 
 void SetInitialized(BOOL bVal) // 28-11-2002, Peppe: serve per forzare ad initialized la libreria dall'esterno
 {
-	initialized = bVal;
+	SysAtomicStore(&initialized, bVal);
 }
 
-static SCARDHANDLE Connect(int nReader) 
+/* Dimensione di partenza: LIBSIAE_READ_BLOCK consente di limitarla */
+/* per i lettori che non tollerano blocchi grandi                    */
+static int DefaultReadBlock()
+{
+  const char *env=getenv("LIBSIAE_READ_BLOCK");
+  int n;
+  if ((env==NULL)||(*env=='\0')) return MAX_READ_BLOCK;
+  n=atoi(env);
+  if (n<1) return EXCHANGE_BUFFER;
+  return (n>MAX_READ_BLOCK)?MAX_READ_BLOCK:n;
+}
+
+static READER_TUNING *FindTuning(const char *name, int bCreate)
+{
+  int i;
+  for (i=0; i<nReaderTuning; i++)
+    if (strcmp(readerTuning[i].name,name)==0) return &readerTuning[i];
+  if (!bCreate) return NULL;
+  if (nReaderTuning==readerTuningSize) {
+    READER_TUNING *t=(READER_TUNING*)realloc(readerTuning,(readerTuningSize+16)*sizeof(READER_TUNING));
+    if (t==NULL) return NULL;
+    readerTuning=t;
+    readerTuningSize+=16;
+  }
+  strcpy(readerTuning[nReaderTuning].name,name);
+  readerTuning[nReaderTuning].block=DefaultReadBlock();
+  return &readerTuning[nReaderTuning++];
+}
+
+static void SetSlotReadBlock(SLOT_CONTEXT *pSlot, int nSize)
+{
+  READER_TUNING *t;
+  pSlot->readBlock=nSize;
+  SysMutexLock(&halLock);
+  t=FindTuning(pSlot->reader,TRUE);
+  if (t!=NULL) t->block=nSize;
+  SysMutexUnlock(&halLock);
+  S_TRACE("SetSlotReadBlock: \"%s\", block=%d\n", pSlot->reader, nSize);
+}
+
+static SIAE_TRANSPORT *CurrentTransport()
+{
+  SIAE_TRANSPORT *t=(SIAE_TRANSPORT*)SysAtomicLoadPtr((void*volatile*)&transport);
+  if (t!=NULL) return t;
+  t=FindTransport(getenv("LIBSIAE_TRANSPORT"));
+  if (t==NULL) t=FindTransport("pcsc");
+  S_TRACE("CurrentTransport: %s\n", t->name);
+  SysAtomicCASPtr((void*volatile*)&transport,NULL,t);
+  return (SIAE_TRANSPORT*)SysAtomicLoadPtr((void*volatile*)&transport);
+}
+
+/* Il contesto PC/SC viene stabilito al primo utilizzo e mantenuto per */
+/* tutta la vita del processo; viene ristabilito solo se il servizio   */
+/* PC/SC lo invalida (ad esempio riavvio di pcscd o di SCardSvr).      */
+/* Questa e le funzioni seguenti, fino a ReaderName, vanno chiamate    */
+/* con halLock acquisito.                                              */
+static BOOL EnsureContext()
+{
+  SIAE_TRANSPORT *t=CurrentTransport();
+  long rv;
+  if ((hContext!=0)&&(hContextTp==t)) return TRUE;
+  if (hContext!=0) hContextTp->ReleaseContext(hContextTp,hContext);
+  hContext=0;
+  hContextTp=t;
+  rv=t->EstablishContext(t,&hContext);
+  S_TRACE("SCardEstablishContext: %d\n", rv);
+  if (rv!=SCARD_S_SUCCESS) {
+    hContext=0;
+    return FALSE;
+  }
+  readerTableValid=FALSE;
+  pnpState=SCARD_STATE_UNAWARE;
+  pnpSupported=TRUE;
+  return TRUE;
+}
+
+/* Gestisce gli errori che indicano un contesto non piu' utilizzabile */
+static void CheckContextError(long rv)
+{
+  switch (rv) {
+  case SCARD_E_INVALID_HANDLE:
+  case SCARD_E_NO_SERVICE:
+  case SCARD_E_SERVICE_STOPPED:
+    S_TRACE_ERROR("CheckContextError: %d, dropping context\n", rv);
+    /* gli handle aperti con il vecchio contesto vanno comunque chiusi */
+    /* da FinalizeML; qui si abbandona solo il contesto                */
+    hContext=0;
+    readerTableValid=FALSE;
+    break;
+  }
+}
+
+/* Elabora lo stato del lettore fittizio PnP restituito da */
+/* SCardGetStatusChange                                    */
+static void UpdatePnP(long rv, SCARD_READERSTATE *pRs)
+{
+  if (rv==SCARD_E_TIMEOUT) return; /* nessun cambiamento */
+  if (rv!=SCARD_S_SUCCESS) {
+    CheckContextError(rv);
+    readerTableValid=FALSE;
+    return;
+  }
+  if (pRs->dwEventState&SCARD_STATE_UNKNOWN) {
+    /* il resource manager non gestisce le notifiche PnP */
+    S_TRACE("UpdatePnP: PnP notification not supported\n");
+    pnpSupported=FALSE;
+    return;
+  }
+  if (pRs->dwEventState&SCARD_STATE_CHANGED) {
+    if (pnpState!=SCARD_STATE_UNAWARE) readerTableValid=FALSE;
+    pnpState=pRs->dwEventState&~SCARD_STATE_CHANGED;
+  }
+}
+
+static void PollPnP()
+{
+  SCARD_READERSTATE rs;
+  long rv;
+  if (!pnpSupported||(hContext==0)) return;
+  memset(&rs,0,sizeof(rs));
+  rs.szReader=PNP_READER;
+  rs.dwCurrentState=pnpState;
+  rv=hContextTp->GetStatusChange(hContextTp,hContext,0,&rs,1);
+  UpdatePnP(rv,&rs);
+}
+
+/* Hash FNV-1a del nome del lettore */
+static unsigned int HashReader(const char *name)
+{
+  unsigned int h=2166136261u;
+  while (*name!='\0') h=(h^(BYTE)*name++)*16777619u;
+  return h;
+}
+
+/* Ricostruisce readerTable e readerHash a partire da pszReaderNames */
+static BOOL IndexReaders()
+{
+  LPTSTR p;
+  int n=0, size, i;
+  unsigned int h;
+  for (p=pszReaderNames; *p!='\0'; p+=strlen(p)+1) n++;
+  if (n>MAX_SLOTS) n=MAX_SLOTS;
+  if (n>readerTableSize) {
+    LPTSTR *t=(LPTSTR*)realloc(readerTable,n*sizeof(LPTSTR));
+    if (t==NULL) return FALSE;
+    readerTable=t;
+    readerTableSize=n;
+  }
+  for (size=16; size<2*n; size*=2);
+  if (size>readerHashSize) {
+    int *t=(int*)realloc(readerHash,size*sizeof(int));
+    if (t==NULL) return FALSE;
+    readerHash=t;
+    readerHashSize=size;
+  }
+  for (i=0; i<readerHashSize; i++) readerHash[i]=-1;
+  for (p=pszReaderNames; nReaderTable<n; p+=strlen(p)+1) {
+    S_TRACE("LoadReaders: %d = %s\n", nReaderTable, p);
+    for (h=HashReader(p)&(readerHashSize-1); readerHash[h]>=0; h=(h+1)&(readerHashSize-1));
+    readerHash[h]=nReaderTable;
+    readerTable[nReaderTable++]=p;
+  }
+  return TRUE;
+}
+
+/* Rilegge l'elenco dei lettori riutilizzando il buffer pszReaderNames */
+static BOOL LoadReaders()
+{
+  long rv;
+  DWORD n;
+  readerTableValid=FALSE;
+  nReaderTable=0;
+  if (!EnsureContext()) return FALSE;
+  /* Lo stato PnP si registra prima dell'elenco: un lettore collegato nel */
+  /* frattempo provochera' una nuova lettura                              */
+  if (pnpState==SCARD_STATE_UNAWARE) PollPnP();
+
+  n=cch;
+  rv=(pszReaderNames!=NULL)?hContextTp->ListReaders(hContextTp,hContext,pszReaderNames,&n):SCARD_E_INSUFFICIENT_BUFFER;
+  if (rv==SCARD_E_INSUFFICIENT_BUFFER) {
+    n=0;
+    rv=hContextTp->ListReaders(hContextTp,hContext,NULL,&n);
+    if (rv==SCARD_S_SUCCESS) {
+      if (pszReaderNames!=NULL) free(pszReaderNames);
+      pszReaderNames=(LPTSTR)malloc(n);
+      cch=(pszReaderNames!=NULL)?n:0;
+      if (pszReaderNames==NULL) return FALSE;
+      rv=hContextTp->ListReaders(hContextTp,hContext,pszReaderNames,&n);
+    }
+  }
+  S_TRACE("LoadReaders: SCardListReaders: %d\n", rv);
+  if (rv==SCARD_E_NO_READERS_AVAILABLE) {
+    readerTableValid=TRUE;
+    return TRUE;
+  }
+  if (rv!=SCARD_S_SUCCESS) {
+    CheckContextError(rv);
+    return FALSE;
+  }
+  if (!IndexReaders()) {
+    nReaderTable=0;
+    return FALSE;
+  }
+  readerTableValid=TRUE;
+  return TRUE;
+}
+
+/* Nome del lettore n-esimo (zero based) secondo la tabella corrente, */
+/* NULL se non esiste                                                 */
+static LPCSTR ReaderName(int n)
+{
+  if (!readerTableValid&&!LoadReaders()) return NULL;
+  if ((n<0)||(n>=nReaderTable)) {
+    /* senza notifiche PnP un lettore nuovo si scopre solo rileggendo */
+    if (pnpSupported||!LoadReaders()||(n>=nReaderTable)) return NULL;
+  }
+  return readerTable[n];
+}
+
+/* Indice (zero based) del lettore di nome name, -1 se non esiste */
+static int FindReader(const char *name)
+{
+  unsigned int h;
+  int i;
+  if (!readerTableValid&&!LoadReaders()) return -1;
+  for (i=0; i<2; i++) {
+    if (nReaderTable>0)
+      for (h=HashReader(name)&(readerHashSize-1); readerHash[h]>=0; h=(h+1)&(readerHashSize-1))
+        if (strcmp(readerTable[readerHash[h]],name)==0) return readerHash[h];
+    /* senza notifiche PnP un lettore nuovo si scopre solo rileggendo */
+    if (pnpSupported||!LoadReaders()) break;
+  }
+  return -1;
+}
+
+/* Errori che invalidano il contesto PC/SC dello slot */
+static int IsContextError(long rv)
+{
+  return (rv==SCARD_E_INVALID_HANDLE)||(rv==SCARD_E_NO_SERVICE)||
+         (rv==SCARD_E_SERVICE_STOPPED);
+}
+
+static SCARDHANDLE Connect(SLOT_CONTEXT *pSlot) 
 {
   /* Connessione con la carta */
-  /* nReader  il numero del lettore (zero based) */
+  /* pSlot  lo slot, il cui nome del lettore e' gia' stato risolto */
   /* la funzione ritorna l'handle della connessione */
   /* in caso di errore il valore di ritorno  0 */
-  LPTSTR readerNames=NULL;
-  DWORD cch=0;
+  SIAE_TRANSPORT *t=CurrentTransport();
   SCARDHANDLE hCard=0;
   long rv=0;
-  DWORD dwAP=0;
-  S_TRACE("Connect(): %d\n", nReader);
-
-  if (hContext==0) return 0;
-  rv=SCardListReaders(hContext,NULL,NULL,&cch);
-  S_TRACE("SCardListReaders(NULL): %d\n", rv);
-  readerNames = (LPTSTR)malloc(cch);
-  if (readerNames == NULL) return 0;
-  rv=SCardListReaders(hContext,NULL,readerNames,&cch);
-  if (rv==SCARD_S_SUCCESS)
-  {
-    int q=0;
-    LPTSTR pReader=readerNames;
-    do {
-      if (q==nReader) {
-        rv=SCardConnect(hContext,pReader,SCARD_SHARE_SHARED,
-          SCARD_PROTOCOL_T1,&hCard,&dwAP);
-		if (rv!=SCARD_S_SUCCESS){
-			S_TRACE("SCardConnect: %d\n", rv);
-			hCard=0;
-		}
-		else
-			S_TRACE("SCardConnect: hContext: 0x%08X, hCard:0x%08X\n", hContext,hCard);
-        break;
-      }else
-        pReader+=strlen(pReader)+1;
-      q++;
-    } while ((*pReader!='\0')&&(q<=nReader));
+  S_TRACE("Connect(): \"%s\"\n", pSlot->reader);
+
+  /* il contesto dello slot, come quello globale, sopravvive a Finalize */
+  /* e viene sostituito solo se nel frattempo e' cambiato il trasporto  */
+  if ((pSlot->hContext!=0)&&(pSlot->tp!=t)) {
+    pSlot->tp->ReleaseContext(pSlot->tp,pSlot->hContext);
+    pSlot->hContext=0;
+  }
+  if (pSlot->hContext==0) {
+    pSlot->tp=t;
+    rv=t->EstablishContext(t,&pSlot->hContext);
+    S_TRACE("SCardEstablishContext: %d\n", rv);
+    if (rv!=SCARD_S_SUCCESS) {
+      pSlot->hContext=0;
+      return 0;
+    }
+  }
+  rv=t->Connect(t,pSlot->hContext,pSlot->reader,&hCard);
+  if (rv!=SCARD_S_SUCCESS){
+    S_TRACE_ERROR("SCardConnect: %d\n", rv);
+    if (IsContextError(rv)) {
+      t->ReleaseContext(t,pSlot->hContext);
+      pSlot->hContext=0;
+    }
+    hCard=0;
   }
   else
-	  S_TRACE("SCardListReaders: %d\n", rv);
-  free(readerNames);
+    S_TRACE("SCardConnect: hContext: 0x%08X, hCard:0x%08X\n", pSlot->hContext,hCard);
   return hCard;
 }
 
+/* BeginTransactionML acquisisce il lock dello slot, che resta al thread */
+/* chiamante fino alla EndTransactionML corrispondente                   */
 int CALLINGCONV BeginTransactionML(int nSlot)
 {
+	SLOT_CONTEXT *pSlot;
 	LONG rv = SCARD_E_UNEXPECTED;
+	SYS_INT64 tStart;
 	S_TRACE("    BeginTransactionML: %d\n", nSlot);
-	if (hCardsTransactions[nSlot] == 0)
+	pSlot = GetSlot(nSlot);
+	if (pSlot == NULL) return C_GENERIC_ERROR;
+	SysMutexLock(&pSlot->lock);
+	ApplyEvents(pSlot);
+	if ((pSlot->nTransactions == 0) && (pSlot->hCard != 0))
 	{
-		rv = SCardBeginTransaction(hCards[nSlot]);
+		tStart = SysTimeUs();
+		rv = pSlot->tp->BeginTransaction(pSlot->tp, pSlot->hCard);
+		StatsTransaction(nSlot, SysTimeUs() - tStart);
 		S_TRACE("    BeginTransactionML: SCardBeginTransaction: %d\n", rv);
 	}
-	hCardsTransactions[nSlot] += 1;
-	S_TRACE("    BeginTransactionML: counter=%d\n", hCardsTransactions[nSlot]);
+	pSlot->nTransactions += 1;
+	S_TRACE("    BeginTransactionML: counter=%d\n", pSlot->nTransactions);
 
 	return C_OK;
 }
 
 int CALLINGCONV EndTransactionML(int nSlot)
 {
+	SLOT_CONTEXT *pSlot;
 	LONG rv = SCARD_S_SUCCESS;
-	S_TRACE("    EndTransactionML: %d, counter=%d\n", nSlot, hCardsTransactions[nSlot]);
-	if (hCardsTransactions[nSlot] > 0)
+	pSlot = GetSlot(nSlot);
+	if (pSlot == NULL) return C_GENERIC_ERROR;
+	/* il lock e' ricorsivo: se il thread non ha una transazione aperta */
+	/* attende che il proprietario la chiuda e trova il contatore a 0   */
+	SysMutexLock(&pSlot->lock);
+	S_TRACE("    EndTransactionML: %d, counter=%d\n", nSlot, pSlot->nTransactions);
+	if (pSlot->nTransactions > 0)
 	{
-		hCardsTransactions[nSlot] -= 1;
-		if (hCardsTransactions[nSlot] == 0)
+		pSlot->nTransactions -= 1;
+		if ((pSlot->nTransactions == 0) && (pSlot->hCard != 0))
 		{
-			rv = SCardEndTransaction(hCards[nSlot], SCARD_LEAVE_CARD);
+			rv = pSlot->tp->EndTransaction(pSlot->tp, pSlot->hCard, SCARD_LEAVE_CARD);
 			S_TRACE("    EndTransactionML: SCardEndTransaction: %d\n", rv);
 		}
+		SysMutexUnlock(&pSlot->lock); /* acquisito da BeginTransactionML */
 	}
+	SysMutexUnlock(&pSlot->lock);
 	return C_OK;
 }
 
@@ -147,63 +595,99 @@ int CALLINGCONV EndTransaction()
 /* - Sancisce l'inizio di una transazione PC/SC              */
 int CALLINGCONV Initialize(int nSlot)
 {
-  long rv=SCARD_S_SUCCESS;
-  DWORD rL=0;
-  DWORD dwState=0;
-  DWORD dwProtocol=0;
-  BYTE *pbAtr=NULL;
-  DWORD cByte=0;
+  SLOT_CONTEXT *pSlot;
+  READER_TUNING *t;
+  LPCSTR pReader;
+  int rv=C_OK;
+  int bProbe=FALSE;
+  SYS_INT64 tStart=SysTimeUs();
   S_TRACE("\n\n\n");
   S_TRACE("Initialize: nSlot=%d\n", nSlot);
-  if (instances==0) {
-    /* Alla prima Initialize preparo il contesto PC/SC */
-    rv=SCardEstablishContext(SCARD_SCOPE_USER,NULL,NULL,&hContext);
-    if (rv!=SCARD_S_SUCCESS) {
-      initialized=FALSE;
-      hContext=0;
-	  S_TRACE("SCardEstablishContext: %d\n", rv);
-      return C_CONTEXT_ERROR;
-    }
-    /* Reinizializzo l'array di handle dei lettori */
-    memset(hCards,0,sizeof(hCards) * sizeof(hCards[0]));
-	memset(hCardsTransactions,0,sizeof(hCardsTransactions) * sizeof(hCardsTransactions[0]));
+  S_PROBE2(call__entry,"Initialize",nSlot);
+  pSlot=AllocSlot(nSlot);
+  if (pSlot==NULL) return C_GENERIC_ERROR;
+  InitHalLock();
+  SysMutexLock(&pSlot->lock);
+  if (pSlot->hCard!=0) {
+    rv=C_ALREADY_INITIALIZED;
+    goto CleanUp;
   }
-  if (hCards[nSlot]!=0) return C_ALREADY_INITIALIZED;
+
+  /* Nome del lettore e dimensione di blocco dalle tabelle condivise; */
+  /* il contesto globale e' condiviso con isCardIn e sopravvive a     */
+  /* Finalize                                                         */
+  SysMutexLock(&halLock);
+  if (!EnsureContext()) rv=C_CONTEXT_ERROR;
   else {
-    hCards[nSlot]=Connect(nSlot);
-    if (hCards[nSlot]!=0) {
-      // SCardBeginTransaction(hCards[nSlot]);
-      if (instances==0) defSlot=nSlot;
-      instances++; /* Incremento il reference counter */
-      initialized=TRUE;
-      return C_OK;
-    } else return C_NO_CARD;
+    PollPnP();
+    pReader=ReaderName(nSlot);
+    if (pReader==NULL) {
+      S_TRACE_ERROR("Initialize: reader %d not found\n", nSlot);
+      rv=C_NO_CARD;
+    }
+    else {
+      strncpy(pSlot->reader,pReader,MAX_READER_NAME-1);
+      pSlot->reader[MAX_READER_NAME-1]='\0';
+      t=FindTuning(pSlot->reader,FALSE);
+      pSlot->readBlock=(t!=NULL)?t->block:DefaultReadBlock();
+      bProbe=(t==NULL);
+    }
+  }
+  SysMutexUnlock(&halLock);
+  if (rv!=C_OK) goto CleanUp;
+
+  /* la connessione avviene fuori da halLock: gli altri slot non attendono */
+  pSlot->hCard=Connect(pSlot);
+  pSlot->nTransactions=0;
+  ForgetCard(pSlot);
+  if (pSlot->hCard==0) {
+    rv=C_NO_CARD;
+    goto CleanUp;
   }
+  if (bProbe) ProbeReadBlock(pSlot,nSlot);
+  // SCardBeginTransaction(pSlot->hCard);
+  SysMutexLock(&halLock);
+  if (SysAtomicAdd(&instances,1)==1) defSlot=nSlot; /* Incremento il reference counter */
+  SysAtomicStore(&initialized,TRUE);
+  SysMutexUnlock(&halLock);
+
+CleanUp:
+  SysMutexUnlock(&pSlot->lock);
+  StatsCall(nSlot,STATS_CALL_INITIALIZE,tStart,(rv==C_ALREADY_INITIALIZED)?C_OK:rv);
+  S_PROBE3(call__return,"Initialize",nSlot,rv);
+  return rv;
 }
 
 /* La funzione Finalize effettua le seguenti operazioni: */
 /* - Termina la transazione PC/SC                        */
 /* - Chiude il canale PC/SC con la carta                 */
-/* - Rilascia il contesto PC/SC hContMLt                 */
 int CALLINGCONV FinalizeML(int nSlot)
 {
-	LONG rv;
+  SLOT_CONTEXT *pSlot;
+  LONG rv;
   S_TRACE("FinalizeML: nSlot=%d\n", nSlot);
-  
-  if (hCards[nSlot]==0) return C_NOT_INITIALIZED;
-  //rv = SCardEndTransaction(hCards[nSlot],SCARD_LEAVE_CARD);
+  S_PROBE2(call__entry,"FinalizeML",nSlot);
+
+  pSlot=GetSlot(nSlot);
+  if (pSlot==NULL) return C_NOT_INITIALIZED;
+  SysMutexLock(&pSlot->lock);
+  if (pSlot->hCard==0) {
+    SysMutexUnlock(&pSlot->lock);
+    return C_NOT_INITIALIZED;
+  }
+  //rv = SCardEndTransaction(pSlot->hCard,SCARD_LEAVE_CARD);
   //S_TRACE("FinalizeML: SCardEndTransaction %d\n", rv);
-  rv = SCardDisconnect(hCards[nSlot],SCARD_RESET_CARD);
+  rv = pSlot->tp->Disconnect(pSlot->tp,pSlot->hCard,SCARD_RESET_CARD);
   S_TRACE("FinalizeML: SCardDisconnect %d\n", rv);
 
-  hCards[nSlot]=0;
-  instances--;
-  if (instances==0) {
-    rv = SCardReleaseContext(hContext);
-	S_TRACE("FinalizeML: SCardReleaseContext %d\n", rv);
-    hContext=0;
-    initialized=FALSE;
-  }
+  pSlot->hCard=0;
+  ForgetCard(pSlot);
+  /* i contesti PC/SC restano aperti per le chiamate successive */
+  SysMutexLock(&halLock);
+  if (SysAtomicAdd(&instances,-1)==0) SysAtomicStore(&initialized,FALSE);
+  SysMutexUnlock(&halLock);
+  SysMutexUnlock(&pSlot->lock);
+  S_PROBE3(call__return,"FinalizeML",nSlot,C_OK);
   S_TRACE("\n\n\n");
   return C_OK;
 }
@@ -229,74 +713,233 @@ int CALLINGCONV Hash(int mec,BYTE *toHash, int Len, BYTE *Hashed)
     case HASH_MD5:
       x=MD5(toHash,Len,Hashed);
     break;
+    case HASH_SHA256:
+      x=SHA256(toHash,Len,Hashed);
+    break;
     default:
     return C_GENERIC_ERROR;
   }
   return C_OK;
 }
 
-/* La funzione SendAPDU invia una APDU alla smart card */
-int CALLINGCONV SendAPDUML(int nSlot, DWORD cmd, BYTE Lc, BYTE *pLe,
-                    BYTE *inBuffer, BYTE *outBuffer, WORD *pSW)
+/* Stato dietro HASH_CONTEXT */
+typedef union _HASH_STATE {
+  SHA1Context sha1;
+  SHA256Context sha256;
+  MD5_CTX md5;
+} HASH_STATE;
+
+/* Errore di compilazione se HASH_CONTEXT non puo' contenere HASH_STATE */
+typedef char HashStateFits[(sizeof(HASH_STATE)<=sizeof(((HASH_CONTEXT*)0)->u.state))?1:-1];
+
+/* SHA1Input, SHA256Input e MD5Update accettano un unsigned int per volta */
+#define HASH_CHUNK 0x40000000
+
+int CALLINGCONV HashInit(HASH_CONTEXT *pCtx, int mec)
 {
-  long rv=SCARD_S_SUCCESS;
-  SCARDHANDLE hCard = hCards[nSlot];
-  DWORD dwProto = 0;
-  DWORD tLen=256;
-  BYTE tmpBuf[256];
-  BYTE pSendBuffer[256];
-  DWORD lSB; /*lunghezza del buffer da inviare alla carta*/
-  pSendBuffer[0]=(BYTE)((cmd&0xff000000)>>24);
-  pSendBuffer[1]=(BYTE)((cmd&0x00ff0000)>>16);
-  pSendBuffer[2]=(BYTE)((cmd&0x0000ff00)>>8);
-  pSendBuffer[3]=(BYTE) (cmd&0x000000ff);
-  lSB=4;
-  if (Lc!=0) {
-    pSendBuffer[4]=Lc;
-    memcpy(pSendBuffer+5,inBuffer,Lc);
-    lSB+=Lc+1;
+  HASH_STATE *s;
+  if (pCtx==NULL) return C_GENERIC_ERROR;
+  memset(pCtx,0,sizeof(HASH_CONTEXT));
+  s=(HASH_STATE*)pCtx->u.state;
+  switch (mec)
+  {
+    case HASH_SHA1:
+      SHA1Reset(&s->sha1);
+    break;
+    case HASH_SHA256:
+      SHA256Reset(&s->sha256);
+    break;
+    case HASH_MD5:
+      MD5Init(&s->md5);
+    break;
+    default:
+    return C_GENERIC_ERROR;
   }
+  pCtx->mec=mec;
+  return C_OK;
+}
 
-  if (pSendBuffer[1]!=0xa4) {
-    pSendBuffer[lSB]=(pLe!=NULL)?*pLe:0;
-    lSB++;
+int CALLINGCONV HashUpdate(HASH_CONTEXT *pCtx, const BYTE *pData, SIAE_UINT64 nLen)
+{
+  HASH_STATE *s;
+  unsigned int n;
+  int rv=shaSuccess;
+  if ((pCtx==NULL)||((pData==NULL)&&(nLen>0))) return C_GENERIC_ERROR;
+  if ((pCtx->mec!=HASH_SHA1)&&(pCtx->mec!=HASH_SHA256)&&(pCtx->mec!=HASH_MD5))
+    return C_GENERIC_ERROR;
+  s=(HASH_STATE*)pCtx->u.state;
+  while (nLen>0) {
+    n=(nLen>HASH_CHUNK)?HASH_CHUNK:(unsigned int)nLen;
+    switch (pCtx->mec)
+    {
+      case HASH_SHA1:
+        rv=SHA1Input(&s->sha1,pData,n);
+      break;
+      case HASH_SHA256:
+        rv=SHA256Input(&s->sha256,pData,n);
+      break;
+      case HASH_MD5:
+        MD5Update(&s->md5,(unsigned char*)pData,n);
+      break;
+    }
+    if (rv!=shaSuccess) return C_GENERIC_ERROR;
+    pData+=n;
+    nLen-=n;
+  }
+  return C_OK;
+}
+
+/* Dopo HashFinal il contesto va reinizializzato con HashInit */
+int CALLINGCONV HashFinal(HASH_CONTEXT *pCtx, BYTE *Hashed)
+{
+  HASH_STATE *s;
+  int rv=shaSuccess;
+  if ((pCtx==NULL)||(Hashed==NULL)) return C_GENERIC_ERROR;
+  s=(HASH_STATE*)pCtx->u.state;
+  switch (pCtx->mec)
+  {
+    case HASH_SHA1:
+      rv=SHA1Result(&s->sha1,Hashed);
+    break;
+    case HASH_SHA256:
+      rv=SHA256Result(&s->sha256,Hashed);
+    break;
+    case HASH_MD5:
+      MD5Final(Hashed,&s->md5);
+    break;
+    default:
+    return C_GENERIC_ERROR;
   }
+  memset(pCtx,0,sizeof(HASH_CONTEXT));
+  return (rv==shaSuccess)?C_OK:C_GENERIC_ERROR;
+}
+
+/* Delle APDU che trasportano PIN o PUK (VERIFY, CHANGE REFERENCE DATA, */
+/* RESET RETRY COUNTER) la traccia riporta solo l'intestazione         */
+static void TraceApdu(const BYTE *pSend, DWORD lSend)
+{
+  if ((lSend>5)&&((pSend[1]==0x20)||(pSend[1]==0x24)||(pSend[1]==0x2C))) {
+    S_TRACE_BUFFER("   SendAPDUML: APDU (dati omessi):", pSend, 5);
+    return;
+  }
+  S_TRACE_BUFFER("   SendAPDUML: APDU:", pSend, lSend);
+}
+
+/* Trasmette una APDU gia' codificata. In caso di reset della carta si */
+/* riconnette e ritenta; in caso di rimozione ritorna C_NO_CARD.       */
+/* Va chiamata con il lock dello slot acquisito.                       */
+static int TransmitSlot(SLOT_CONTEXT *pSlot, int nSlot, const BYTE *pSend, DWORD lSend, BYTE *pRecv, DWORD *pRecvLen)
+{
+  long rv=SCARD_S_SUCCESS;
+  SIAE_TRANSPORT *t = pSlot->tp;
+  SCARDHANDLE hCard = pSlot->hCard;
+  DWORD maxLen = *pRecvLen;
+  DWORD header = ((DWORD)pSend[0]<<24)|((DWORD)pSend[1]<<16)|((DWORD)pSend[2]<<8)|pSend[3];
+  WORD sw;
+  SYS_INT64 tStart, tEnd;
 
+  if (hCard==0) return C_NOT_INITIALIZED;
 retryTransmit:
-  S_TRACE("    SendAPDUML: SCardTransmit: APDUHEADER=0x%08X \n", cmd);
-  S_TRACE_BUFFER("   SendAPDUML: APDU:", pSendBuffer, lSB);
-  tLen=256;
-  rv=SCardTransmit(hCard,SCARD_PCI_T1,pSendBuffer,lSB,NULL,tmpBuf,&tLen);
-  S_TRACE("    SendAPDUML: SCardTransmit rv=0x%08X \n", rv);
-  if (rv == SCARD_S_SUCCESS)
-	  S_TRACE_BUFFER("   SendAPDUML: RESPONSE:", tmpBuf, tLen);
+  if (TRACE_ENABLED(TRACE_LEVEL_APDU)) TraceApdu(pSend, lSend);
+  *pRecvLen=maxLen;
+  S_PROBE2(apdu__start,nSlot,header);
+  tStart=SysTimeUs();
+  rv=t->Transmit(t,hCard,pSend,lSend,pRecv,pRecvLen);
+  tEnd=SysTimeUs();
+  sw=((rv==SCARD_S_SUCCESS)&&(*pRecvLen>=2))?(WORD)((pRecv[*pRecvLen-2]<<8)|pRecv[*pRecvLen-1]):0;
+  S_PROBE4(apdu__done,nSlot,header,sw,rv);
+  if (ApduRecording())
+    RecordApdu(nSlot,pSend,lSend,pRecv,(rv==SCARD_S_SUCCESS)?*pRecvLen:0,rv,tStart,tEnd);
+  StatsApdu(nSlot,pSend,tEnd-tStart,((sw>>8)!=0x90)&&((sw>>8)!=0x61));
+  S_TRACE_APDU("    SendAPDUML: SCardTransmit rv=0x%08X \n", rv);
   if (rv!=SCARD_S_SUCCESS) {
-    if (pLe!=NULL) *pLe=0;
     switch (rv) {
 	case SCARD_W_RESET_CARD:
-		S_TRACE("    SendAPDUML: SCardTransmit error: %d (SCARD_W_RESET_CARD)\n", rv);
-		rv = SCardReconnect(hCard, SCARD_SHARE_SHARED, SCARD_PROTOCOL_T1, SCARD_LEAVE_CARD, &dwProto);
+		S_TRACE_ERROR("    SendAPDUML: SCardTransmit error: %d (SCARD_W_RESET_CARD)\n", rv);
+		/* dopo il reset la carta ha di nuovo selezionato l'MF e potrebbe */
+		/* anche essere stata sostituita                                  */
+		ForgetCard(pSlot);
+		FireSlotEvent(nSlot, SLOT_EVENT_RESET);
+		rv = t->Reconnect(t, hCard);
 		S_TRACE("    SendAPDUML: SCardReconnect rv=%d\n", rv);
-		if (hCardsTransactions[nSlot] > 0)
+		if (pSlot->nTransactions > 0)
 		{
-			rv = SCardBeginTransaction(hCard);
+			rv = t->BeginTransaction(t, hCard);
 			S_TRACE("    SendAPDUML: SCardBeginTransaction rv=%d\n", rv);
 		}
 		if (rv == SCARD_S_SUCCESS)
 		{
 			S_TRACE("    SendAPDUML: retrying transmit...\n");
+			StatsReset(nSlot);
 			goto retryTransmit;
 		}
     case SCARD_E_NO_SMARTCARD:
     case SCARD_E_NOT_READY:
     case SCARD_E_READER_UNAVAILABLE:
     case SCARD_W_REMOVED_CARD:
+      ForgetCard(pSlot);
     return C_NO_CARD;
     default:
-		S_TRACE("SCardTransmit: %d, hCard: 0x%08X\n", rv, hCard);
+		S_TRACE_ERROR("SCardTransmit: %d, hCard: 0x%08X\n", rv, hCard);
+      pSlot->select.valid=FALSE;
     return C_GENERIC_ERROR;
     }
-  } else *pSW=(tmpBuf[tLen-2]<<8)|tmpBuf[tLen-1];
+  }
+  S_TRACE_BUFFER("   SendAPDUML: RESPONSE:", pRecv, *pRecvLen);
+  /* dopo una SELECT (anche inviata con SendAPDU) o una status word     */
+  /* inattesa il file corrente non e' piu' noto; SelectML ripristina il */
+  /* modello dopo le proprie SELECT riuscite                            */
+  if ((pSend[1]==0xa4)||(*pRecvLen<2)||!SelectPreserved(sw))
+    pSlot->select.valid=FALSE;
+  if (*pRecvLen<2) return C_GENERIC_ERROR;
+  return C_OK;
+}
+
+static int TransmitML(int nSlot, const BYTE *pSend, DWORD lSend, BYTE *pRecv, DWORD *pRecvLen)
+{
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  int rv;
+  if (pSlot==NULL) return C_NOT_INITIALIZED;
+  /* di norma il lock e' gia' del chiamante, da BeginTransactionML */
+  SysMutexLock(&pSlot->lock);
+  rv=TransmitSlot(pSlot,nSlot,pSend,lSend,pRecv,pRecvLen);
+  SysMutexUnlock(&pSlot->lock);
+  return rv;
+}
+
+/* La funzione SendAPDU invia una APDU alla smart card */
+int CALLINGCONV SendAPDUML(int nSlot, DWORD cmd, BYTE Lc, BYTE *pLe,
+                    BYTE *inBuffer, BYTE *outBuffer, WORD *pSW)
+{
+  int rv=C_OK;
+  DWORD tLen=256;
+  BYTE tmpBuf[258];
+  BYTE pSendBuffer[256];
+  DWORD lSB; /*lunghezza del buffer da inviare alla carta*/
+  pSendBuffer[0]=(BYTE)((cmd&0xff000000)>>24);
+  pSendBuffer[1]=(BYTE)((cmd&0x00ff0000)>>16);
+  pSendBuffer[2]=(BYTE)((cmd&0x0000ff00)>>8);
+  pSendBuffer[3]=(BYTE) (cmd&0x000000ff);
+  lSB=4;
+  if (Lc!=0) {
+    pSendBuffer[4]=Lc;
+    memcpy(pSendBuffer+5,inBuffer,Lc);
+    lSB+=Lc+1;
+  }
+
+  if (pSendBuffer[1]!=0xa4) {
+    pSendBuffer[lSB]=(pLe!=NULL)?*pLe:0;
+    lSB++;
+  }
+
+  S_TRACE_APDU("    SendAPDUML: SCardTransmit: APDUHEADER=0x%08X \n", cmd);
+  tLen=sizeof(tmpBuf);
+  rv=TransmitML(nSlot,pSendBuffer,lSB,tmpBuf,&tLen);
+  if (rv!=C_OK) {
+    if (pLe!=NULL) *pLe=0;
+    return rv;
+  }
+  *pSW=(tmpBuf[tLen-2]<<8)|tmpBuf[tLen-1];
   if (tLen>2) {
     if (outBuffer!=NULL)
       memcpy(outBuffer,tmpBuf,(*pLe>tLen-2)?(tLen-2):*pLe);
@@ -306,52 +949,559 @@ retryTransmit:
   return C_OK;
 }
 
+/* READ BINARY di *pLen byte (al massimo MAX_READ_BLOCK) dall'EF corrente. */
+/* Oltre 256 byte la lunghezza attesa viene codificata in formato esteso.  */
+int ReadBinaryBlockML(int nSlot, WORD Offset, BYTE *Buffer, int *pLen, WORD *pSW)
+{
+  int rv=C_OK;
+  int le=*pLen;
+  DWORD tLen=MAX_READ_BLOCK+2;
+  BYTE tmpBuf[MAX_READ_BLOCK+2];
+  BYTE pSendBuffer[7];
+  DWORD lSB=4;
+
+  if ((le<=0)||(le>MAX_READ_BLOCK)) return C_GENERIC_ERROR;
+  pSendBuffer[0]=(BYTE)((APDU_READBINARY&0xff000000)>>24);
+  pSendBuffer[1]=(BYTE)((APDU_READBINARY&0x00ff0000)>>16);
+  pSendBuffer[2]=(BYTE)(Offset>>8);
+  pSendBuffer[3]=(BYTE)(Offset&0xff);
+  if (le<=256) pSendBuffer[lSB++]=(BYTE)le;   /* 256 si codifica 0x00 */
+  else {
+    pSendBuffer[lSB++]=0;
+    pSendBuffer[lSB++]=(BYTE)(le>>8);
+    pSendBuffer[lSB++]=(BYTE)(le&0xff);
+  }
+
+  S_TRACE_APDU("    ReadBinaryBlockML: offset=%d, Le=%d\n", Offset, le);
+  rv=TransmitML(nSlot,pSendBuffer,lSB,tmpBuf,&tLen);
+  if (rv!=C_OK) {
+    *pLen=0;
+    return rv;
+  }
+  *pSW=(tmpBuf[tLen-2]<<8)|tmpBuf[tLen-1];
+  tLen-=2;
+  if ((int)tLen>le) tLen=le;
+  memcpy(Buffer,tmpBuf,tLen);
+  *pLen=(int)tLen;
+  return C_OK;
+}
+
+int GetReadBlockML(int nSlot)
+{
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  if ((pSlot==NULL)||(pSlot->readBlock<=0)) return EXCHANGE_BUFFER;
+  return pSlot->readBlock;
+}
+
+/* Passa alla dimensione di blocco inferiore a quella corrente; ritorna */
+/* FALSE se lo slot usa gia' la dimensione minima.                     */
+int LowerReadBlockML(int nSlot)
+{
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  int cur=GetReadBlockML(nSlot);
+  int i;
+  if (pSlot==NULL) return FALSE;
+  for (i=0; i<READ_BLOCK_SIZES; i++)
+    if (ReadBlockSizes[i]<cur) {
+      SetSlotReadBlock(pSlot,ReadBlockSizes[i]);
+      return TRUE;
+    }
+  return FALSE;
+}
+
+/* Alla prima connessione a un lettore si legge l'EF GDO, presente sotto */
+/* l'MF di ogni carta SIAE, con blocchi via via piu' piccoli finche'     */
+/* lettore e carta non li accettano: le letture successive partono gia'  */
+/* dalla dimensione giusta. Se l'EF non si puo' leggere resta quella di  */
+/* partenza e ReadBinaryML la riduce quando serve. In ogni caso il       */
+/* lettore non viene piu' provato.                                       */
+static void ProbeReadBlock(SLOT_CONTEXT *pSlot, int nSlot)
+{
+  static const BYTE selMF[]={0x00,0xa4,0x00,0x00,0x02,(BYTE)(FID_MF>>8),(BYTE)(FID_MF&0xff)};
+  static const BYTE selGdo[]={0x00,0xa4,0x00,0x00,0x02,(BYTE)(FID_EF_GDO>>8),(BYTE)(FID_EF_GDO&0xff)};
+  BYTE buf[MAX_READ_BLOCK+2];
+  DWORD l;
+  WORD sw=0;
+  int rv, q, block;
+
+  BeginTransactionML(nSlot);
+  l=sizeof(buf);
+  rv=TransmitSlot(pSlot,nSlot,selMF,sizeof(selMF),buf,&l);
+  if ((rv==C_OK)&&(buf[l-2]==0x90)) {
+    l=sizeof(buf);
+    rv=TransmitSlot(pSlot,nSlot,selGdo,sizeof(selGdo),buf,&l);
+  }
+  if ((rv==C_OK)&&(buf[l-2]==0x90)) {
+    do {
+      block=GetReadBlockML(nSlot);
+      q=block;
+      rv=ReadBinaryBlockML(nSlot,0,buf,&q,&sw);
+    } while (READ_BLOCK_REJECTED(rv,sw,block)&&LowerReadBlockML(nSlot));
+  }
+  else S_TRACE_ERROR("ProbeReadBlock: EF GDO not available (rv=%d)\n", rv);
+  SetSlotReadBlock(pSlot,GetReadBlockML(nSlot));
+  EndTransactionML(nSlot);
+}
+
+/* Imposta la dimensione del blocco di READ BINARY per il lettore dello */
+/* slot; con nSize==0 si torna alla determinazione automatica.          */
+int CALLINGCONV SetReadBlockSizeML(int nSize, int nSlot)
+{
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  int rv=C_OK;
+  if (pSlot==NULL) return C_NOT_INITIALIZED;
+  if ((nSize<0)||(nSize>MAX_READ_BLOCK)) return C_WRONG_LENGTH;
+  SysMutexLock(&pSlot->lock);
+  if (pSlot->hCard==0) rv=C_NOT_INITIALIZED;
+  else SetSlotReadBlock(pSlot,(nSize==0)?DefaultReadBlock():nSize);
+  SysMutexUnlock(&pSlot->lock);
+  return rv;
+}
+
+int CALLINGCONV SetReadBlockSize(int nSize)
+{
+  return SetReadBlockSizeML(nSize,defSlot);
+}
+
 int CALLINGCONV SendAPDU(DWORD cmd, BYTE Lc, BYTE *pLe,
                     BYTE *inBuffer, BYTE *outBuffer, WORD *pSW)
 {
-  return SendAPDUML(hCards[defSlot],cmd,Lc,pLe,inBuffer,outBuffer,pSW);
+  return SendAPDUML(defSlot,cmd,Lc,pLe,inBuffer,outBuffer,pSW);
 }
 
+/* isCardIn usa il contesto e la tabella dei lettori condivisi: lo stato */
+/* del lettore e quello del lettore fittizio PnP si ottengono con una    */
+/* sola SCardGetStatusChange. Se l'elenco dei lettori e' cambiato la     */
+/* tabella viene riletta e l'interrogazione ripetuta. La chiamata non   */
+/* blocca e viene eseguita con halLock acquisito.                        */
 int CALLINGCONV isCardIn(int n)
 {
-  SCARDCONTEXT lContext;
-  char *readerNames;
-  char *p;
-  DWORD cch;
-  int d,b;
+  SCARD_READERSTATE rs[2];
+  LPCSTR reader;
+  DWORD nrs;
   long ris;
-  SCARD_READERSTATE rs;
-  ris=SCARD_S_SUCCESS;
-  lContext=0;
-  readerNames=NULL;
-  d=0; b=0; cch=0; 
-  ris=SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &lContext);
-  if ((lContext==0)||(ris!=SCARD_S_SUCCESS)) return b;
-  if (lContext!=0) {
-    ris=SCardListReaders(lContext,NULL,NULL,&cch);
-    readerNames = (LPTSTR)malloc(cch);
-    ris=SCardListReaders(lContext,NULL,readerNames,&cch);
-    if (readerNames != NULL) {
-      p=readerNames;
-      while ((*p!='\0')&&(d<n)&&(readerNames!=NULL)) {
-        p+=strlen(p)+1;
-        d++;
-      }
-      if (d==n) {
-        rs.szReader=p;
-        rs.pvUserData=NULL;
-        rs.dwCurrentState=SCARD_STATE_UNAWARE;
-        /*
-        SCARD_READERSTATE rs={
-          p, NULL, SCARD_STATE_UNAWARE, NULL, NULL
-        };*/
-        ris=SCardGetStatusChange(lContext, 0 , &rs, 1);
-        if (ris!=SCARD_S_SUCCESS) return FALSE;
-        b=(rs.dwEventState&SCARD_STATE_PRESENT);
+  int retry;
+  int b=0;
+
+  InitHalLock();
+  SysMutexLock(&halLock);
+  for (retry=0; retry<2; retry++) {
+    if (!EnsureContext()) break;
+    reader=ReaderName(n);
+    if (reader==NULL) {
+      /* il lettore potrebbe essere appena stato collegato */
+      if (retry==0&&pnpSupported) {
+        PollPnP();
+        if (!readerTableValid) continue;
       }
+      break;
+    }
+    memset(rs,0,sizeof(rs));
+    rs[0].szReader=reader;
+    rs[0].dwCurrentState=SCARD_STATE_UNAWARE;
+    nrs=1;
+    if (pnpSupported) {
+      rs[1].szReader=PNP_READER;
+      rs[1].dwCurrentState=pnpState;
+      nrs=2;
+    }
+    ris=hContextTp->GetStatusChange(hContextTp, hContext, 0, rs, nrs);
+    if ((ris!=SCARD_S_SUCCESS)&&(ris!=SCARD_E_TIMEOUT)) {
+      CheckContextError(ris);
+      readerTableValid=FALSE;
+      continue;
     }
+    if (nrs==2) UpdatePnP(SCARD_S_SUCCESS,&rs[1]);
+    if (rs[0].dwEventState&SCARD_STATE_UNKNOWN) readerTableValid=FALSE;
+    if (!readerTableValid) continue;
+    b=(rs[0].dwEventState&SCARD_STATE_PRESENT);
+    break;
   }
-  if (readerNames!=NULL) free(readerNames);
-  if (lContext!=0) SCardReleaseContext(lContext);
+  SysMutexUnlock(&halLock);
   return b;
 }
+
+/* Indice dello slot corrispondente al lettore szReader secondo l'elenco */
+/* corrente dei lettori, -1 se il lettore non e' collegato. L'indice di */
+/* un lettore puo' cambiare quando vengono collegati o scollegati altri */
+/* lettori, il nome no.                                                 */
+int CALLINGCONV GetSlotByName(const char *szReader)
+{
+  int n=-1;
+  if (szReader==NULL) return -1;
+  InitHalLock();
+  SysMutexLock(&halLock);
+  if (EnsureContext()) {
+    PollPnP();
+    n=FindReader(szReader);
+  }
+  SysMutexUnlock(&halLock);
+  S_TRACE("GetSlotByName: \"%s\" = %d\n", szReader, n);
+  return n;
+}
+
+/* Nome del lettore dello slot: per uno slot inizializzato e' quello a  */
+/* cui lo slot e' connesso, altrimenti quello dell'elenco corrente.     */
+/* In *pLen la dimensione del buffer, compreso il terminatore.          */
+int CALLINGCONV GetSlotReaderName(int nSlot, char *szReader, int *pLen)
+{
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  char name[MAX_READER_NAME];
+  LPCSTR pReader;
+  int l;
+
+  if ((pLen==NULL)||((unsigned int)nSlot>=MAX_SLOTS)) return C_GENERIC_ERROR;
+  name[0]='\0';
+  if (pSlot!=NULL) {
+    SysMutexLock(&pSlot->lock);
+    if (pSlot->hCard!=0) strcpy(name,pSlot->reader);
+    SysMutexUnlock(&pSlot->lock);
+  }
+  if (name[0]=='\0') {
+    InitHalLock();
+    SysMutexLock(&halLock);
+    pReader=EnsureContext()?ReaderName(nSlot):NULL;
+    if (pReader!=NULL) {
+      strncpy(name,pReader,MAX_READER_NAME-1);
+      name[MAX_READER_NAME-1]='\0';
+    }
+    SysMutexUnlock(&halLock);
+  }
+  if (name[0]=='\0') return C_GENERIC_ERROR;
+  l=(int)strlen(name)+1;
+  if ((szReader==NULL)||(*pLen<l)) {
+    *pLen=l;
+    return (szReader==NULL)?C_OK:C_WRONG_LEN;
+  }
+  memcpy(szReader,name,l);
+  *pLen=l;
+  return C_OK;
+}
+
+/*****************************************************************************
+  Monitor della presenza delle carte: un thread con un proprio contesto
+  PC/SC attende in SCardGetStatusChange su tutti i lettori e sul lettore
+  fittizio PnP, aggiorna lo stato di ciascuno slot e notifica gli
+  eventi alle callback registrate. Le callback vengono eseguite nel thread
+  del monitor (SLOT_EVENT_RESET nel thread che ha rilevato il reset) e
+  devono quindi ritornare rapidamente.
+*****************************************************************************/
+
+#define MAX_SLOT_CALLBACKS 8
+
+typedef struct _SLOT_CALLBACK {
+  t_SlotCallback pfn;
+  void          *pUserData;
+} SLOT_CALLBACK;
+
+static SLOT_CALLBACK slotCallbacks[MAX_SLOT_CALLBACKS];
+static SYS_SPINLOCK  slotCallbacksLock=0;
+
+/* monitorLock e' un mutex perche' viene tenuto durante le chiamate   */
+/* PC/SC e la creazione del thread; va acquisito dopo halLock         */
+static SYS_MUTEX     monitorLock;
+static SYS_ATOMIC    monitorLockState=0;
+static SYS_ATOMIC    monitorStop=0;
+static BOOL          monitorRunning=FALSE;
+static SYS_THREAD    monitorThread;
+static SCARDCONTEXT  monitorContext=0;
+static SIAE_TRANSPORT *monitorTp=NULL;
+
+/* L'attesa in SCardGetStatusChange e' limitata: una SCardCancel arrivata */
+/* prima che il thread entri nell'attesa andrebbe persa, quindi monitorStop */
+/* viene ricontrollato almeno una volta per intervallo                     */
+#define MONITOR_TIMEOUT 1000
+
+static void InitMonitorLock()
+{
+  SysMutexInitOnce(&monitorLock,&monitorLockState);
+}
+
+static void FireSlotEvent(int nSlot, int nEvent)
+{
+  SLOT_CALLBACK cb[MAX_SLOT_CALLBACKS];
+  int i;
+  S_TRACE("FireSlotEvent: slot=%d, event=%d\n", nSlot, nEvent);
+  /* le callback vengono chiamate fuori dal lock, su una copia della tabella */
+  SysSpinLock(&slotCallbacksLock);
+  memcpy(cb,slotCallbacks,sizeof(cb));
+  SysSpinUnlock(&slotCallbacksLock);
+  for (i=0; i<MAX_SLOT_CALLBACKS; i++)
+    if (cb[i].pfn!=NULL) cb[i].pfn(nSlot,nEvent,cb[i].pUserData);
+}
+
+/* Applica nel thread chiamante le rimozioni rilevate dal monitor */
+static void ApplyEvents(SLOT_CONTEXT *pSlot)
+{
+  if (SysAtomicLoad(&pSlot->forget)) {
+    SysMutexLock(&pSlot->lock);
+    if (SysAtomicExchange(&pSlot->forget,0)) ForgetCard(pSlot);
+    SysMutexUnlock(&pSlot->lock);
+  }
+}
+
+void ApplySlotEvents(int nSlot)
+{
+  SLOT_CONTEXT *pSlot=GetSlot(nSlot);
+  if (pSlot!=NULL) ApplyEvents(pSlot);
+}
+
+static void UpdateSlotState(int nSlot, DWORD dwEvent)
+{
+  SLOT_CONTEXT *pSlot=AllocSlot(nSlot);
+  long old;
+  long st=SLOT_STATE_KNOWN;
+  int ev1=0, ev2=0;
+
+  if (pSlot==NULL) return;
+  old=SysAtomicLoad(&pSlot->state);
+
+  if (!(dwEvent&(SCARD_STATE_UNKNOWN|SCARD_STATE_UNAVAILABLE|SCARD_STATE_IGNORE))) {
+    st|=SLOT_STATE_READER;
+    if (dwEvent&SCARD_STATE_PRESENT) st|=SLOT_STATE_PRESENT;
+    if (dwEvent&SCARD_STATE_MUTE) st|=SLOT_STATE_MUTE;
+    /* pcsc-lite e Windows riportano nella parola alta un contatore degli */
+    /* eventi: permette di riconoscere una carta sostituita tra due       */
+    /* notifiche                                                          */
+    st|=(long)((dwEvent>>16)&0x7fff)<<16;
+  }
+  SysAtomicStore(&pSlot->state,st);
+  if (!(old&SLOT_STATE_KNOWN)) return;
+
+  if ((old&SLOT_STATE_PRESENT)&&!(st&SLOT_STATE_PRESENT)) ev1=SLOT_EVENT_REMOVED;
+  else if (!(old&SLOT_STATE_PRESENT)&&(st&SLOT_STATE_PRESENT)) ev1=SLOT_EVENT_INSERTED;
+  else if ((old&SLOT_STATE_PRESENT)&&(st&SLOT_STATE_PRESENT)&&
+           (SLOT_STATE_EVENTS(old)!=SLOT_STATE_EVENTS(st))) {
+    ev1=SLOT_EVENT_REMOVED;
+    ev2=SLOT_EVENT_INSERTED;
+  }
+  if (ev1==SLOT_EVENT_REMOVED) SysAtomicStore(&pSlot->forget,1);
+  if (ev1!=0) FireSlotEvent(nSlot,ev1);
+  if (ev2!=0) FireSlotEvent(nSlot,ev2);
+}
+
+static SYS_THREAD_PROC(MonitorThread, arg)
+{
+  SCARD_READERSTATE *rs=NULL;
+  SLOT_CONTEXT *pSlot;
+  LPSTR names=NULL;
+  LPSTR p;
+  DWORD n=0;
+  DWORD nrs=0;
+  DWORD pnp=SCARD_STATE_UNAWARE;
+  DWORD timeout;
+  BOOL reload=TRUE;
+  BOOL usePnP=TRUE;
+  long rv;
+  int i, nReaders=0;
+
+  S_TRACE("MonitorThread: started\n");
+  while (!SysAtomicLoad(&monitorStop)) {
+    if (reload) {
+      /* Nuovo elenco dei lettori: gli slot non piu' presenti perdono */
+      /* il lettore e l'eventuale carta                               */
+      if (names!=NULL) free(names);
+      names=NULL;
+      nReaders=0;
+      n=0;
+      rv=monitorTp->ListReaders(monitorTp,monitorContext,NULL,&n);
+      if ((rv==SCARD_S_SUCCESS)&&((names=(LPSTR)malloc(n))!=NULL))
+        rv=monitorTp->ListReaders(monitorTp,monitorContext,names,&n);
+      /* n e' la lunghezza della multistringa: i lettori sono meno di n */
+      if (rs!=NULL) free(rs);
+      rs=(SCARD_READERSTATE*)calloc(((rv==SCARD_S_SUCCESS)?n:0)+1,sizeof(SCARD_READERSTATE));
+      if (rs==NULL) {
+        SysSleep(1000);
+        continue;
+      }
+      if ((rv==SCARD_S_SUCCESS)&&(names!=NULL))
+        for (p=names; (*p!='\0')&&(nReaders<MAX_SLOTS); p+=strlen(p)+1) {
+          rs[nReaders].szReader=p;
+          rs[nReaders].dwCurrentState=SCARD_STATE_UNAWARE;
+          nReaders++;
+        }
+      for (i=nReaders; i<SlotLimit(); i++) {
+        pSlot=GetSlot(i);
+        if ((pSlot!=NULL)&&(SysAtomicLoad(&pSlot->state)&SLOT_STATE_READER))
+          UpdateSlotState(i,SCARD_STATE_UNKNOWN);
+      }
+      reload=FALSE;
+    }
+    nrs=nReaders;
+    timeout=MONITOR_TIMEOUT; /* senza PnP l'elenco dei lettori si rilegge a ogni intervallo */
+    if (usePnP) {
+      rs[nrs].szReader=PNP_READER;
+      rs[nrs].dwCurrentState=pnp;
+      nrs++;
+    }
+    if (nrs==0) {
+      SysSleep(1000);
+      reload=TRUE;
+      continue;
+    }
+
+    rv=monitorTp->GetStatusChange(monitorTp,monitorContext,timeout,rs,nrs);
+    if (SysAtomicLoad(&monitorStop)) break;
+    if (rv==SCARD_E_TIMEOUT) {
+      if (!usePnP) reload=TRUE;
+      continue;
+    }
+    if (rv!=SCARD_S_SUCCESS) {
+      S_TRACE_ERROR("MonitorThread: SCardGetStatusChange: 0x%08X\n", rv);
+      if ((rv==SCARD_E_NO_SERVICE)||(rv==SCARD_E_SERVICE_STOPPED)||(rv==SCARD_E_INVALID_HANDLE)) {
+        /* servizio PC/SC riavviato: si ristabilisce il contesto del monitor */
+        SysMutexLock(&monitorLock);
+        monitorTp->ReleaseContext(monitorTp,monitorContext);
+        if (monitorTp->EstablishContext(monitorTp,&monitorContext)!=SCARD_S_SUCCESS)
+          monitorContext=0;
+        SysMutexUnlock(&monitorLock);
+        pnp=SCARD_STATE_UNAWARE;
+      }
+      SysSleep(500);
+      reload=TRUE;
+      continue;
+    }
+
+    for (i=0; i<nReaders; i++) {
+      if (!(rs[i].dwEventState&SCARD_STATE_CHANGED)) continue;
+      UpdateSlotState(i,rs[i].dwEventState);
+      rs[i].dwCurrentState=rs[i].dwEventState&~SCARD_STATE_CHANGED;
+    }
+    if (usePnP&&(rs[nReaders].dwEventState&SCARD_STATE_UNKNOWN)) {
+      S_TRACE("MonitorThread: PnP notification not supported\n");
+      usePnP=FALSE;
+    }
+    else if (usePnP&&(rs[nReaders].dwEventState&SCARD_STATE_CHANGED)) {
+      if (pnp!=SCARD_STATE_UNAWARE) reload=TRUE;
+      pnp=rs[nReaders].dwEventState&~SCARD_STATE_CHANGED;
+    }
+  }
+  if (names!=NULL) free(names);
+  if (rs!=NULL) free(rs);
+  S_TRACE("MonitorThread: stopped\n");
+  return SYS_THREAD_RETURN;
+}
+
+/* Avvia il monitor; chiamata implicitamente da RegisterSlotCallback e */
+/* GetSlotState                                                         */
+int CALLINGCONV StartSlotMonitor()
+{
+  int rv=C_OK;
+  InitMonitorLock();
+  SysMutexLock(&monitorLock);
+  if (!monitorRunning) {
+    monitorTp=CurrentTransport();
+    if (monitorTp->EstablishContext(monitorTp,&monitorContext)!=SCARD_S_SUCCESS) {
+      monitorContext=0;
+      rv=C_CONTEXT_ERROR;
+    } else {
+      SysAtomicStore(&monitorStop,0);
+      if (SysThreadCreate(&monitorThread,MonitorThread,NULL)) monitorRunning=TRUE;
+      else {
+        monitorTp->ReleaseContext(monitorTp,monitorContext);
+        monitorContext=0;
+        rv=C_GENERIC_ERROR;
+      }
+    }
+  }
+  SysMutexUnlock(&monitorLock);
+  S_TRACE("StartSlotMonitor: rv=%d\n", rv);
+  return rv;
+}
+
+/* Arresta il monitor; va chiamata prima di scaricare la libreria */
+int CALLINGCONV StopSlotMonitor()
+{
+  int i;
+  InitMonitorLock();
+  SysMutexLock(&monitorLock);
+  if (!monitorRunning) {
+    SysMutexUnlock(&monitorLock);
+    return C_OK;
+  }
+  SysAtomicStore(&monitorStop,1);
+  if (monitorContext!=0) monitorTp->Cancel(monitorTp,monitorContext);
+  SysMutexUnlock(&monitorLock);
+
+  SysThreadJoin(monitorThread);
+
+  SysMutexLock(&monitorLock);
+  if (monitorContext!=0) monitorTp->ReleaseContext(monitorTp,monitorContext);
+  monitorContext=0;
+  monitorRunning=FALSE;
+  for (i=0; i<SlotLimit(); i++) {
+    SLOT_CONTEXT *pSlot=GetSlot(i);
+    if (pSlot!=NULL) SysAtomicStore(&pSlot->state,0);
+  }
+  SysMutexUnlock(&monitorLock);
+  S_TRACE("StopSlotMonitor\n");
+  return C_OK;
+}
+
+int CALLINGCONV RegisterSlotCallback(t_SlotCallback pfn, void *pUserData)
+{
+  int i, rv=C_GENERIC_ERROR;
+  if (pfn==NULL) return C_GENERIC_ERROR;
+  SysSpinLock(&slotCallbacksLock);
+  for (i=0; i<MAX_SLOT_CALLBACKS; i++)
+    if (slotCallbacks[i].pfn==NULL) {
+      slotCallbacks[i].pfn=pfn;
+      slotCallbacks[i].pUserData=pUserData;
+      rv=C_OK;
+      break;
+    }
+  SysSpinUnlock(&slotCallbacksLock);
+  if (rv!=C_OK) return rv;
+  return StartSlotMonitor();
+}
+
+int CALLINGCONV UnregisterSlotCallback(t_SlotCallback pfn, void *pUserData)
+{
+  int i, rv=C_GENERIC_ERROR;
+  SysSpinLock(&slotCallbacksLock);
+  for (i=0; i<MAX_SLOT_CALLBACKS; i++)
+    if ((slotCallbacks[i].pfn==pfn)&&(slotCallbacks[i].pUserData==pUserData)) {
+      slotCallbacks[i].pfn=NULL;
+      slotCallbacks[i].pUserData=NULL;
+      rv=C_OK;
+      break;
+    }
+  SysSpinUnlock(&slotCallbacksLock);
+  return rv;
+}
+
+/* Stato dello slot (SLOT_STATE_xxx) secondo il monitor; non blocca. */
+/* Finche' il monitor non ha rilevato lo slot SLOT_STATE_KNOWN e' 0. */
+int CALLINGCONV GetSlotState(int nSlot)
+{
+  SLOT_CONTEXT *pSlot;
+  if ((unsigned int)nSlot>=MAX_SLOTS) return 0;
+  if (!monitorRunning) StartSlotMonitor();
+  pSlot=GetSlot(nSlot);
+  return (pSlot!=NULL)?(int)SysAtomicLoad(&pSlot->state):0;
+}
+
+/* Cambia il trasporto: i contesti aperti con il trasporto precedente */
+/* vengono chiusi subito (quello globale) o alla prossima Initialize  */
+/* (quelli degli slot)                                                */
+int CALLINGCONV SelectTransport(const char *szName)
+{
+  SIAE_TRANSPORT *t=FindTransport(szName);
+  int rv=C_OK;
+  S_TRACE("SelectTransport: %s\n", (szName!=NULL)?szName:"(null)");
+  if (t==NULL) return C_UNKNOWN_OBJECT;
+  InitHalLock();
+  SysMutexLock(&halLock);
+  InitMonitorLock();
+  SysMutexLock(&monitorLock);
+  if ((SysAtomicLoad(&instances)>0)||monitorRunning) rv=C_GENERIC_ERROR;
+  else {
+    SysAtomicStorePtr((void*volatile*)&transport,t);
+    if (hContext!=0) hContextTp->ReleaseContext(hContextTp,hContext);
+    hContext=0;
+    readerTableValid=FALSE;
+  }
+  SysMutexUnlock(&monitorLock);
+  SysMutexUnlock(&halLock);
+  return rv;
+}
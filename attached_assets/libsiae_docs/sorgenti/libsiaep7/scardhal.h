@@ -27,6 +27,26 @@ int CALLINGCONV FinalizeML(int nSlot);
 int CALLINGCONV Hash(int mec,BYTE *toHash, int Len, BYTE *Hashed);
 int CALLINGCONV SendAPDU(DWORD cmd, BYTE Lc, BYTE *pLe, BYTE *inBuffer, BYTE *outBuffer, WORD *pSW);
 int CALLINGCONV SendAPDUML(int hCard, DWORD cmd, BYTE Lc, BYTE *pLe, BYTE *inBuffer, BYTE *outBuffer, WORD *pSW);
+int CALLINGCONV SetReadBlockSize(int nSize);
+int CALLINGCONV SetReadBlockSizeML(int nSize, int nSlot);
+
+/* Registro degli slot: ricerca per nome del lettore */
+int CALLINGCONV GetSlotByName(const char *szReader);
+int CALLINGCONV GetSlotReaderName(int nSlot, char *szReader, int *pLen);
+
+/* Monitor della presenza delle carte */
+int CALLINGCONV StartSlotMonitor();
+int CALLINGCONV StopSlotMonitor();
+int CALLINGCONV RegisterSlotCallback(t_SlotCallback pfn, void *pUserData);
+int CALLINGCONV UnregisterSlotCallback(t_SlotCallback pfn, void *pUserData);
+int CALLINGCONV GetSlotState(int nSlot);
+
+/* Uso interno: READ BINARY con blocco adattato al lettore */
+int ReadBinaryBlockML(int nSlot, WORD Offset, BYTE *Buffer, int *pLen, WORD *pSW);
+int GetReadBlockML(int nSlot);
+int LowerReadBlockML(int nSlot);
+/* Uso interno: applica le rimozioni di carta rilevate dal monitor */
+void ApplySlotEvents(int nSlot);
 
 
 #ifdef __cplusplus
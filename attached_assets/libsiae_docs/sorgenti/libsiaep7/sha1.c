@@ -29,7 +29,12 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "sha1.h"
+#include "sha1x86.h"
+#include "probes.h"
+#include "sysdep.h"
 
 /*
  *  Define the SHA1 circular left shift macro
@@ -37,9 +42,133 @@
 #define SHA1CircularShift(bits,word) \
                 (((word) << (bits)) | ((word) >> (32-(bits))))
 
+/*
+ *  Round functions and one unrolled round. W[] holds only the last
+ *  16 words of the schedule; SHA1Word(t) computes word t in place.
+ *  The caller rotates the roles of A..E instead of moving values.
+ */
+#define SHA1Ch(b,c,d)       ((d) ^ ((b) & ((c) ^ (d))))
+#define SHA1Parity(b,c,d)   ((b) ^ (c) ^ (d))
+#define SHA1Maj(b,c,d)      (((b) & (c)) | ((d) & ((b) | (c))))
+
+#define SHA1Word(t) \
+    (W[(t)&15] = SHA1CircularShift(1, W[((t)+13)&15] ^ W[((t)+8)&15] ^ \
+                                      W[((t)+2)&15] ^ W[(t)&15]))
+#define SHA1W(t)    (((t) < 16) ? W[t] : SHA1Word(t))
+
+#define SHA1Round(a,b,c,d,e,f,k,t) \
+    e += SHA1CircularShift(5,a) + f(b,c,d) + (k) + SHA1W(t); \
+    b = SHA1CircularShift(30,b);
+
+#define SHA1Round5(f,k,t) \
+    SHA1Round(A,B,C,D,E,f,k,(t)) \
+    SHA1Round(E,A,B,C,D,f,k,(t)+1) \
+    SHA1Round(D,E,A,B,C,f,k,(t)+2) \
+    SHA1Round(C,D,E,A,B,f,k,(t)+3) \
+    SHA1Round(B,C,D,E,A,f,k,(t)+4)
+
 /* Local Function Prototyptes */
 void SHA1PadMessage(SHA1Context *);
 void SHA1ProcessMessageBlock(SHA1Context *);
+static void SHA1ProcessBlocks(uint32_t H[5], const uint8_t *block, unsigned count);
+static void SHA1ProcessBlocksPortable(uint32_t H[5], const uint8_t *block, unsigned count);
+
+/*
+ *  Compression kernel: the fastest one the CPU supports (see
+ *  sha1x86.c), unless LIBSIAE_SHA1_KERNEL limits it to "ssse3" or
+ *  "portable". It is chosen when the library is loaded (see
+ *  SHA1SelectKernels); the check on first use only matters for
+ *  callers that run before the constructors.
+ */
+static SHA1_BLOCKS_FN volatile sha1Kernel = NULL;
+static const char *volatile sha1KernelName = "portable";
+
+/* Same for the multi-buffer kernel used by SHA1Multi (none: SHA1()) */
+static SHA1_MULTI_FN volatile sha1MultiKernel = NULL;
+static volatile int sha1MultiLanes = -1;
+static const char *volatile sha1MultiKernelName = "portable";
+
+static const char *SHA1KernelLimit(void)
+{
+    const char *szMax = getenv("LIBSIAE_SHA1_KERNEL");
+
+    if ((szMax != NULL) && (*szMax == 0))
+    {
+        szMax = NULL;
+    }
+    return szMax;
+}
+
+static SHA1_BLOCKS_FN SHA1Kernel(void)
+{
+    SHA1_BLOCKS_FN fn = sha1Kernel;
+    const char *szMax, *szName = "portable";
+
+    if (fn == NULL)
+    {
+        szMax = SHA1KernelLimit();
+        if ((szMax == NULL) || (strcmp(szMax, "portable") != 0))
+        {
+            fn = SHA1X86Kernel(szMax, &szName);
+        }
+        if (fn == NULL)
+        {
+            fn = SHA1ProcessBlocksPortable;
+            szName = "portable";
+        }
+        sha1KernelName = szName;
+        sha1Kernel = fn;
+    }
+    return fn;
+}
+
+static SHA1_MULTI_FN SHA1MultiKernel(int *pnLanes)
+{
+    SHA1_MULTI_FN fn = NULL;
+    const char *szMax, *szName = "portable";
+    int nLanes = 1;
+
+    if (sha1MultiLanes < 0)
+    {
+        szMax = SHA1KernelLimit();
+        if ((szMax == NULL) || (strcmp(szMax, "portable") != 0))
+        {
+            fn = SHA1X86MultiKernel(szMax, &nLanes, &szName);
+        }
+        if (fn == NULL)
+        {
+            nLanes = 1;
+            szName = "portable";
+        }
+        sha1MultiKernelName = szName;
+        sha1MultiKernel = fn;
+        sha1MultiLanes = nLanes;
+    }
+    *pnLanes = sha1MultiLanes;
+    return sha1MultiKernel;
+}
+
+SYS_CONSTRUCTOR(SHA1SelectKernels)
+{
+    int nLanes;
+
+    SHA1Kernel();
+    SHA1MultiKernel(&nLanes);
+}
+
+const char *SHA1KernelName(void)
+{
+    SHA1Kernel();
+    return sha1KernelName;
+}
+
+const char *SHA1MultiKernelName(void)
+{
+    int nLanes;
+
+    SHA1MultiKernel(&nLanes);
+    return sha1MultiKernelName;
+}
 
 /*
  *  SHA1Reset
@@ -181,13 +310,12 @@ int SHA1Input(    SHA1Context    *context,
     {
          return context->Corrupted;
     }
-    while(length-- && !context->Corrupted)
-    {
-    context->Message_Block[context->Message_Block_Index++] =
-                    (*message_array & 0xFF);
 
-    context->Length_Low += 8;
-    if (context->Length_Low == 0)
+    /*
+     *  The length is updated once for the whole array
+     */
+    context->Length_Low += length << 3;
+    if (context->Length_Low < (length << 3))
     {
         context->Length_High++;
         if (context->Length_High == 0)
@@ -196,13 +324,53 @@ int SHA1Input(    SHA1Context    *context,
             context->Corrupted = 1;
         }
     }
+    if (length >> 29)
+    {
+        context->Length_High += length >> 29;
+        if (context->Length_High < (length >> 29))
+        {
+            context->Corrupted = 1;
+        }
+    }
+    if (context->Corrupted)
+    {
+        return shaSuccess;
+    }
 
-    if (context->Message_Block_Index == 64)
+    /*
+     *  Complete the pending block, then compress the full blocks
+     *  directly from the caller's buffer and keep the tail
+     */
+    if (context->Message_Block_Index > 0)
     {
+        unsigned n = 64 - (unsigned)context->Message_Block_Index;
+        if (n > length)
+        {
+            n = length;
+        }
+        memcpy(context->Message_Block + context->Message_Block_Index,
+               message_array, n);
+        context->Message_Block_Index += n;
+        message_array += n;
+        length -= n;
+        if (context->Message_Block_Index < 64)
+        {
+            return shaSuccess;
+        }
         SHA1ProcessMessageBlock(context);
     }
 
-    message_array++;
+    if (length >= 64)
+    {
+        SHA1ProcessBlocks(context->Intermediate_Hash, message_array, length / 64);
+        message_array += length & ~63u;
+        length &= 63;
+    }
+
+    if (length > 0)
+    {
+        memcpy(context->Message_Block, message_array, length);
+        context->Message_Block_Index = length;
     }
 
     return shaSuccess;
@@ -230,6 +398,32 @@ int SHA1Input(    SHA1Context    *context,
  *
  */
 void SHA1ProcessMessageBlock(SHA1Context *context)
+{
+    SHA1ProcessBlocks(context->Intermediate_Hash, context->Message_Block, 1);
+    context->Message_Block_Index = 0;
+}
+
+/*
+ *  SHA1ProcessBlocks
+ *
+ *  Description:
+ *      This function will process count consecutive 512-bit blocks
+ *      read directly from the buffer, updating the intermediate hash.
+ *
+ */
+static void SHA1ProcessBlocks(uint32_t H[5], const uint8_t *block, unsigned count)
+{
+    SHA1Kernel()(H, block, count);
+}
+
+/*
+ *  SHA1ProcessBlocksPortable
+ *
+ *  Description:
+ *      The compression function in plain C, for any processor.
+ *
+ */
+static void SHA1ProcessBlocksPortable(uint32_t H[5], const uint8_t *block, unsigned count)
 {
     const uint32_t K[] =    {       /* Constants defined in SHA-1   */
                             0x5A827999,
@@ -238,82 +432,51 @@ void SHA1ProcessMessageBlock(SHA1Context *context)
                             0xCA62C1D6
                             };
     int           t;                 /* Loop counter                */
-    uint32_t      temp;              /* Temporary word value        */
-    uint32_t      W[80];             /* Word sequence               */
+    uint32_t      W[16];             /* Word sequence (circular)    */
     uint32_t      A, B, C, D, E;     /* Word buffers                */
 
-    /*
-     *  Initialize the first 16 words in the array W
-     */
-    for(t = 0; t < 16; t++)
-    {
-        W[t] = context->Message_Block[t * 4] << 24;
-        W[t] |= context->Message_Block[t * 4 + 1] << 16;
-        W[t] |= context->Message_Block[t * 4 + 2] << 8;
-        W[t] |= context->Message_Block[t * 4 + 3];
-    }
-
-    for(t = 16; t < 80; t++)
-    {
-       W[t] = SHA1CircularShift(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
-    }
-
-    A = context->Intermediate_Hash[0];
-    B = context->Intermediate_Hash[1];
-    C = context->Intermediate_Hash[2];
-    D = context->Intermediate_Hash[3];
-    E = context->Intermediate_Hash[4];
-
-    for(t = 0; t < 20; t++)
-    {
-        temp =  SHA1CircularShift(5,A) +
-                ((B & C) | ((~B) & D)) + E + W[t] + K[0];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-
-        B = A;
-        A = temp;
-    }
-
-    for(t = 20; t < 40; t++)
-    {
-        temp = SHA1CircularShift(5,A) + (B ^ C ^ D) + E + W[t] + K[1];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-        B = A;
-        A = temp;
-    }
-
-    for(t = 40; t < 60; t++)
+    for(; count > 0; count--, block += 64)
     {
-        temp = SHA1CircularShift(5,A) +
-               ((B & C) | (B & D) | (C & D)) + E + W[t] + K[2];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-        B = A;
-        A = temp;
-    }
+        for(t = 0; t < 16; t++)
+        {
+            W[t] = ((uint32_t)block[t * 4] << 24) |
+                   ((uint32_t)block[t * 4 + 1] << 16) |
+                   ((uint32_t)block[t * 4 + 2] << 8) |
+                   (uint32_t)block[t * 4 + 3];
+        }
 
-    for(t = 60; t < 80; t++)
-    {
-        temp = SHA1CircularShift(5,A) + (B ^ C ^ D) + E + W[t] + K[3];
-        E = D;
-        D = C;
-        C = SHA1CircularShift(30,B);
-        B = A;
-        A = temp;
+        A = H[0];
+        B = H[1];
+        C = H[2];
+        D = H[3];
+        E = H[4];
+
+        SHA1Round5(SHA1Ch, K[0], 0)
+        SHA1Round5(SHA1Ch, K[0], 5)
+        SHA1Round5(SHA1Ch, K[0], 10)
+        SHA1Round5(SHA1Ch, K[0], 15)
+
+        SHA1Round5(SHA1Parity, K[1], 20)
+        SHA1Round5(SHA1Parity, K[1], 25)
+        SHA1Round5(SHA1Parity, K[1], 30)
+        SHA1Round5(SHA1Parity, K[1], 35)
+
+        SHA1Round5(SHA1Maj, K[2], 40)
+        SHA1Round5(SHA1Maj, K[2], 45)
+        SHA1Round5(SHA1Maj, K[2], 50)
+        SHA1Round5(SHA1Maj, K[2], 55)
+
+        SHA1Round5(SHA1Parity, K[3], 60)
+        SHA1Round5(SHA1Parity, K[3], 65)
+        SHA1Round5(SHA1Parity, K[3], 70)
+        SHA1Round5(SHA1Parity, K[3], 75)
+
+        H[0] += A;
+        H[1] += B;
+        H[2] += C;
+        H[3] += D;
+        H[4] += E;
     }
-
-    context->Intermediate_Hash[0] += A;
-    context->Intermediate_Hash[1] += B;
-    context->Intermediate_Hash[2] += C;
-    context->Intermediate_Hash[3] += D;
-    context->Intermediate_Hash[4] += E;
-
-    context->Message_Block_Index = 0;
 }
 
 /*
@@ -391,10 +554,200 @@ void SHA1PadMessage(SHA1Context *context)
 int SHA1(const unsigned char *toHash, int Len, unsigned char *Hashed)
 {
   SHA1Context sha;
+  int rv=0;
+  S_PROBE1(sha1__start,Len);
   if (SHA1Reset(&sha)==0) {
     if (SHA1Input(&sha,toHash,Len)==0) {
-      if (SHA1Result(&sha, Hashed)==0) return 1;
+      if (SHA1Result(&sha, Hashed)==0) rv=1;
     }
   }
-  return 0;
+  S_PROBE1(sha1__done,Len);
+  return rv;
+}
+
+/*
+ *  Multi-buffer state of one lane: the full blocks still to be read
+ *  from the message, then one or two blocks of tail and padding
+ */
+typedef struct SHA1Lane
+{
+    const uint8_t *next;            /* next block                   */
+    unsigned       full;            /* full message blocks left     */
+    unsigned       left;            /* all blocks left, 0 if idle   */
+    int            msg;             /* message index                */
+    uint8_t        pad[128];        /* tail and padding             */
+} SHA1Lane;
+
+static void SHA1LaneStart(SHA1Lane *lane, int msg, const uint8_t *message, unsigned length)
+{
+    unsigned tail = length & 63;
+    unsigned padBlocks = (tail < 56) ? 1 : 2;
+    uint8_t *p = lane->pad + padBlocks * 64 - 8;
+
+    lane->msg = msg;
+    lane->full = length / 64;
+    lane->left = lane->full + padBlocks;
+    lane->next = (lane->full > 0) ? message : lane->pad;
+
+    memcpy(lane->pad, message + (length & ~63u), tail);
+    lane->pad[tail] = 0x80;
+    memset(lane->pad + tail + 1, 0, padBlocks * 64 - tail - 1);
+    p[3] = (uint8_t)(length >> 29);
+    p[4] = (uint8_t)(length >> 21);
+    p[5] = (uint8_t)(length >> 13);
+    p[6] = (uint8_t)(length >> 5);
+    p[7] = (uint8_t)(length << 3);
+}
+
+static void SHA1LaneAdvance(SHA1Lane *lane)
+{
+    lane->left--;
+    if (lane->full > 0)
+    {
+        lane->full--;
+        lane->next = (lane->full > 0) ? lane->next + 64 : lane->pad;
+    }
+    else
+    {
+        lane->next += 64;
+    }
+}
+
+static void SHA1LaneDigest(uint32_t H[5][SHA1_MAX_LANES], int j, uint8_t Message_Digest[SHA1HashSize])
+{
+    int i;
+
+    for(i = 0; i < SHA1HashSize; ++i)
+    {
+        Message_Digest[i] = (uint8_t)(H[i>>2][j] >> 8 * ( 3 - ( i & 0x03 ) ));
+    }
+}
+
+/*
+ *  SHA1Multi
+ *
+ *  Description:
+ *      Computes the digests of n independent messages, like n calls
+ *      to SHA1(). With a multi-buffer kernel up to 16 messages are
+ *      hashed at once, one per lane; a lane starts the next message
+ *      as soon as its own is done, so messages of different lengths
+ *      keep the lanes busy. Once no message is left to start and
+ *      most lanes are idle, the remaining ones are finished one at a
+ *      time with the single-message kernel.
+ *
+ *  Returns:
+ *      1 on success, 0 if a parameter is not valid.
+ *
+ */
+int SHA1Multi(const unsigned char *toHash[], const int Len[], int n,
+              unsigned char Hashed[][SHA1HashSize])
+{
+    static const uint8_t idle[64] = { 0 };
+    const uint8_t *block[SHA1_MAX_LANES];
+    uint32_t H[5][SHA1_MAX_LANES], h[5];
+    SHA1Lane lane[SHA1_MAX_LANES];
+    SHA1_MULTI_FN fn;
+    int nLanes, nActive, nNext, i, j;
+
+    if ((n < 0) || ((n > 0) && ((toHash == NULL) || (Len == NULL) || (Hashed == NULL))))
+    {
+        return 0;
+    }
+    for(i = 0; i < n; i++)
+    {
+        if ((Len[i] < 0) || ((Len[i] > 0) && (toHash[i] == NULL)))
+        {
+            return 0;
+        }
+    }
+
+    fn = SHA1MultiKernel(&nLanes);
+    if ((fn == NULL) || (n < 2))
+    {
+        for(i = 0; i < n; i++)
+        {
+            SHA1(toHash[i], Len[i], Hashed[i]);
+        }
+        return 1;
+    }
+
+    S_PROBE1(sha1multi__start, n);
+    memset(H, 0, sizeof(H));
+    nActive = 0;
+    nNext = 0;
+    for(j = 0; j < nLanes; j++)
+    {
+        lane[j].left = 0;
+    }
+
+    for(;;)
+    {
+        /* Start the next messages on the idle lanes */
+        for(j = 0; (j < nLanes) && (nNext < n); j++)
+        {
+            if (lane[j].left == 0)
+            {
+                SHA1LaneStart(&lane[j], nNext, toHash[nNext], (unsigned)Len[nNext]);
+                H[0][j] = 0x67452301;
+                H[1][j] = 0xEFCDAB89;
+                H[2][j] = 0x98BADCFE;
+                H[3][j] = 0x10325476;
+                H[4][j] = 0xC3D2E1F0;
+                nNext++;
+                nActive++;
+            }
+        }
+        if ((nNext == n) && (nActive * 2 < nLanes))
+        {
+            break;
+        }
+
+        for(j = 0; j < nLanes; j++)
+        {
+            block[j] = (lane[j].left > 0) ? lane[j].next : idle;
+        }
+        fn(H, block);
+
+        for(j = 0; j < nLanes; j++)
+        {
+            if (lane[j].left > 0)
+            {
+                SHA1LaneAdvance(&lane[j]);
+                if (lane[j].left == 0)
+                {
+                    SHA1LaneDigest(H, j, Hashed[lane[j].msg]);
+                    nActive--;
+                }
+            }
+        }
+    }
+
+    /* Finish the few messages left one at a time */
+    for(j = 0; j < nLanes; j++)
+    {
+        if (lane[j].left > 0)
+        {
+            for(i = 0; i < 5; i++)
+            {
+                h[i] = H[i][j];
+            }
+            if (lane[j].full > 0)
+            {
+                SHA1ProcessBlocks(h, lane[j].next, lane[j].full);
+                lane[j].left -= lane[j].full;
+                lane[j].next = lane[j].pad;
+            }
+            SHA1ProcessBlocks(h, lane[j].next, lane[j].left);
+            for(i = 0; i < 5; i++)
+            {
+                H[i][j] = h[i];
+            }
+            SHA1LaneDigest(H, j, Hashed[lane[j].msg]);
+        }
+    }
+
+    /* the padding blocks hold message tails, clear them out */
+    memset(lane, 0, sizeof(lane));
+    S_PROBE1(sha1multi__done, n);
+    return 1;
 }
@@ -76,6 +76,19 @@ int SHA1Result( SHA1Context *,
                 uint8_t Message_Digest[SHA1HashSize]);
 
 int SHA1(const unsigned char *toHash, int Len, unsigned char *Hashed);
+
+/*
+ *  Digests of n independent messages at once: Hashed[i] receives the
+ *  SHA-1 of the Len[i] bytes at toHash[i]
+ */
+int SHA1Multi(const unsigned char *toHash[], const int Len[], int n,
+              unsigned char Hashed[][SHA1HashSize]);
+
+/* Name of the compression kernel in use: "sha-ni", "ssse3", "portable" */
+const char *SHA1KernelName(void);
+
+/* Kernel used by SHA1Multi: "avx512", "avx2", "ssse3", "portable" */
+const char *SHA1MultiKernelName(void);
 #endif
 
 #ifdef __cplusplus
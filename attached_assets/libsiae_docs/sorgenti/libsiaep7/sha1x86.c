@@ -0,0 +1,596 @@
+/*
+ *  sha1x86.c
+ *
+ *  Description:
+ *      SHA-1 compression kernels for x86 processors. Each kernel
+ *      processes count consecutive 512-bit blocks and updates the
+ *      intermediate hash exactly like SHA1ProcessBlocks in sha1.c.
+ *
+ *      The kernels are compiled with per-function target attributes
+ *      (GCC, Clang) so that the rest of the library keeps the base
+ *      instruction set; SHA1X86Kernel checks CPUID before returning
+ *      one of them.
+ *
+ */
+
+#include "sha1x86.h"
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && \
+    !defined(LIBSIAE_NO_SHA1_X86)
+#define SHA1_X86 1
+#endif
+
+#ifdef SHA1_X86
+
+#include <string.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA1_TARGET(isa)
+#else
+#include <cpuid.h>
+#define SHA1_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/*
+ *  SHA1ProcessBlocksShaNi
+ *
+ *  Description:
+ *      Uses the SHA extensions: SHA1RNDS4 performs four rounds,
+ *      SHA1NEXTE derives E for the next four, SHA1MSG1/SHA1MSG2
+ *      compute the message schedule. ABCD is kept in a single
+ *      register with A in the most significant lane.
+ *
+ */
+SHA1_TARGET("sha,ssse3,sse4.1")
+static void SHA1ProcessBlocksShaNi(uint32_t H[5], const uint8_t *block, unsigned count)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+
+    ABCD = _mm_loadu_si128((const __m128i *)H);
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    E0 = _mm_set_epi32((int)H[4], 0, 0, 0);
+
+    for(; count > 0; count--, block += 64)
+    {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        /* Rounds 0-3 */
+        MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 0)), MASK);
+        E0 = _mm_add_epi32(E0, MSG0);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+        /* Rounds 4-7 */
+        MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+        /* Rounds 8-11 */
+        MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 32)), MASK);
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        /* Rounds 12-15 */
+        MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 48)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+/*
+ *  Rounds 16-67 follow the same pattern with the roles of E0/E1 and
+ *  MSG0..MSG3 rotating: Ea takes the four schedule words in Ma, Mb
+ *  is completed with them, Mc starts its next step and Md absorbs Ma.
+ */
+#define SHA1NI_ROUNDS4(Ea,Eb,Ma,Mb,Mc,Md,f) \
+        Ea = _mm_sha1nexte_epu32(Ea, Ma); \
+        Eb = ABCD; \
+        Mb = _mm_sha1msg2_epu32(Mb, Ma); \
+        ABCD = _mm_sha1rnds4_epu32(ABCD, Ea, f); \
+        Mc = _mm_sha1msg1_epu32(Mc, Ma); \
+        Md = _mm_xor_si128(Md, Ma);
+
+        SHA1NI_ROUNDS4(E0, E1, MSG0, MSG1, MSG3, MSG2, 0)   /* 16-19 */
+        SHA1NI_ROUNDS4(E1, E0, MSG1, MSG2, MSG0, MSG3, 1)   /* 20-23 */
+        SHA1NI_ROUNDS4(E0, E1, MSG2, MSG3, MSG1, MSG0, 1)   /* 24-27 */
+        SHA1NI_ROUNDS4(E1, E0, MSG3, MSG0, MSG2, MSG1, 1)   /* 28-31 */
+        SHA1NI_ROUNDS4(E0, E1, MSG0, MSG1, MSG3, MSG2, 1)   /* 32-35 */
+        SHA1NI_ROUNDS4(E1, E0, MSG1, MSG2, MSG0, MSG3, 1)   /* 36-39 */
+        SHA1NI_ROUNDS4(E0, E1, MSG2, MSG3, MSG1, MSG0, 2)   /* 40-43 */
+        SHA1NI_ROUNDS4(E1, E0, MSG3, MSG0, MSG2, MSG1, 2)   /* 44-47 */
+        SHA1NI_ROUNDS4(E0, E1, MSG0, MSG1, MSG3, MSG2, 2)   /* 48-51 */
+        SHA1NI_ROUNDS4(E1, E0, MSG1, MSG2, MSG0, MSG3, 2)   /* 52-55 */
+        SHA1NI_ROUNDS4(E0, E1, MSG2, MSG3, MSG1, MSG0, 2)   /* 56-59 */
+        SHA1NI_ROUNDS4(E1, E0, MSG3, MSG0, MSG2, MSG1, 3)   /* 60-63 */
+        SHA1NI_ROUNDS4(E0, E1, MSG0, MSG1, MSG3, MSG2, 3)   /* 64-67 */
+#undef SHA1NI_ROUNDS4
+
+        /* Rounds 68-71 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        /* Rounds 72-75 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+        /* Rounds 76-79 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+        E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    }
+
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    _mm_storeu_si128((__m128i *)H, ABCD);
+    H[4] = (uint32_t)_mm_extract_epi32(E0, 3);
+}
+
+/*
+ *  Scalar rounds for the SSSE3 kernel, reading W[t]+K[t] from WK[]
+ */
+#define SHA1CircularShift(bits,word) \
+                (((word) << (bits)) | ((word) >> (32-(bits))))
+
+#define SHA1Ch(b,c,d)       ((d) ^ ((b) & ((c) ^ (d))))
+#define SHA1Parity(b,c,d)   ((b) ^ (c) ^ (d))
+#define SHA1Maj(b,c,d)      (((b) & (c)) | ((d) & ((b) | (c))))
+
+#define SHA1Round(a,b,c,d,e,f,t) \
+    e += SHA1CircularShift(5,a) + f(b,c,d) + WK[t]; \
+    b = SHA1CircularShift(30,b);
+
+#define SHA1Round5(f,t) \
+    SHA1Round(A,B,C,D,E,f,(t)) \
+    SHA1Round(E,A,B,C,D,f,(t)+1) \
+    SHA1Round(D,E,A,B,C,f,(t)+2) \
+    SHA1Round(C,D,E,A,B,f,(t)+3) \
+    SHA1Round(B,C,D,E,A,f,(t)+4)
+
+/*
+ *  SHA1ProcessBlocksSsse3
+ *
+ *  Description:
+ *      Computes the message schedule four words at a time in SSE
+ *      registers, sixteen words ahead of the scalar rounds, so that
+ *      the vector unit works while the rounds run and every round
+ *      just adds W[t]+K[t] from WK[].
+ *
+ *      W[t..t+3] = ROTL1(W[t-3..t] ^ W[t-8..t-5] ^ W[t-14..t-11] ^
+ *      W[t-16..t-13]), but W[t] is not known yet when W[t+3] is
+ *      computed: the last lane is first computed with 0 in its place
+ *      and then corrected with ROTL1(W[t]), since the rotation
+ *      distributes over xor.
+ *
+ */
+#define SHA1Rotl1(x) _mm_or_si128(_mm_slli_epi32(x, 1), _mm_srli_epi32(x, 31))
+
+#define SHA1K(g)    (((g) < 5) ? 0x5A827999 : ((g) < 10) ? 0x6ED9EBA1 : \
+                     ((g) < 15) ? 0x8F1BBCDC : 0xCA62C1D6)
+
+/* Words 4g..4g+3; W[g&3] still holds words 4g-16..4g-13 */
+#define SHA1Schedule4(g) \
+    x = _mm_xor_si128(_mm_srli_si128(W[((g)-1)&3], 4), W[((g)-2)&3]); \
+    x = _mm_xor_si128(x, _mm_alignr_epi8(W[((g)-3)&3], W[(g)&3], 8)); \
+    x = SHA1Rotl1(_mm_xor_si128(x, W[(g)&3])); \
+    W[(g)&3] = _mm_xor_si128(x, SHA1Rotl1(_mm_slli_si128(x, 12))); \
+    _mm_storeu_si128((__m128i *)(WK + 4 * (g)), \
+                     _mm_add_epi32(W[(g)&3], _mm_set1_epi32((int)SHA1K(g))));
+
+/* Twenty rounds from t, scheduling the groups needed sixteen words later */
+#define SHA1Rounds20(f,t) \
+    SHA1Round5(f,t) \
+    if ((t)/4 + 4 < 20) { SHA1Schedule4((t)/4 + 4) } \
+    SHA1Round5(f,(t)+5) \
+    if ((t)/4 + 5 < 20) { SHA1Schedule4((t)/4 + 5) } \
+    if ((t)/4 + 6 < 20) { SHA1Schedule4((t)/4 + 6) } \
+    SHA1Round5(f,(t)+10) \
+    if ((t)/4 + 7 < 20) { SHA1Schedule4((t)/4 + 7) } \
+    SHA1Round5(f,(t)+15) \
+    if ((t)/4 + 8 < 20) { SHA1Schedule4((t)/4 + 8) }
+
+SHA1_TARGET("ssse3")
+static void SHA1ProcessBlocksSsse3(uint32_t H[5], const uint8_t *block, unsigned count)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    __m128i       W[4];              /* Last 16 words of the schedule */
+    uint32_t      WK[80];            /* W[t]+K[t]                     */
+    uint32_t      A, B, C, D, E;     /* Word buffers                  */
+    __m128i       x;
+    int           i;
+
+    for(; count > 0; count--, block += 64)
+    {
+        for(i = 0; i < 4; i++)
+        {
+            W[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16 * i)), MASK);
+            _mm_storeu_si128((__m128i *)(WK + 4 * i),
+                             _mm_add_epi32(W[i], _mm_set1_epi32((int)SHA1K(0))));
+        }
+
+        A = H[0];
+        B = H[1];
+        C = H[2];
+        D = H[3];
+        E = H[4];
+
+        SHA1Rounds20(SHA1Ch, 0)
+        SHA1Rounds20(SHA1Parity, 20)
+        SHA1Rounds20(SHA1Maj, 40)
+        SHA1Rounds20(SHA1Parity, 60)
+
+        H[0] += A;
+        H[1] += B;
+        H[2] += C;
+        H[3] += D;
+        H[4] += E;
+    }
+
+    /* the schedule contains message words, clear it out */
+    memset(WK, 0, sizeof(WK));
+}
+
+/*
+ *  Multi-buffer kernels
+ *
+ *  Description:
+ *      Compress one 512-bit block from each of 4, 8 or 16 independent
+ *      messages: lane j of every vector register holds a word of
+ *      message j, so the rounds of all messages run together. H[i][j]
+ *      is word i of the intermediate hash of lane j.
+ *
+ *      The body is written once in terms of the V_ macros, which are
+ *      redefined for each instruction set before SHA1MB_KERNEL. Each
+ *      block is loaded sixteen bytes per lane and transposed four
+ *      lanes at a time within each 128-bit part of the register, so
+ *      lane j of part k is message 4k+j.
+ *
+ */
+#define SHA1MB_W(t) \
+    (((t) < 16) ? W[t] : \
+     (T = V_XOR(V_XOR(W[((t)+13)&15], W[((t)+8)&15]), V_XOR(W[((t)+2)&15], W[(t)&15])), \
+      W[(t)&15] = V_ROTL(T, 1)))
+
+#define SHA1MB_ROUND(a,b,c,d,e,f,k,t) \
+    e = V_ADD(V_ADD(V_ADD(V_ROTL(a, 5), f(b,c,d)), V_ADD(e, k)), SHA1MB_W(t)); \
+    b = V_ROTL(b, 30);
+
+#define SHA1MB_ROUND5(f,k,t) \
+    SHA1MB_ROUND(A,B,C,D,E,f,k,(t)) \
+    SHA1MB_ROUND(E,A,B,C,D,f,k,(t)+1) \
+    SHA1MB_ROUND(D,E,A,B,C,f,k,(t)+2) \
+    SHA1MB_ROUND(C,D,E,A,B,f,k,(t)+3) \
+    SHA1MB_ROUND(B,C,D,E,A,f,k,(t)+4)
+
+/* Words 4q..4q+3 of every lane */
+#define SHA1MB_LOAD4(q) \
+    R0 = V_SHUF(V_ROW(block, 0, 16 * (q)), MASK); \
+    R1 = V_SHUF(V_ROW(block, 1, 16 * (q)), MASK); \
+    R2 = V_SHUF(V_ROW(block, 2, 16 * (q)), MASK); \
+    R3 = V_SHUF(V_ROW(block, 3, 16 * (q)), MASK); \
+    T0 = V_UNPACKLO32(R0, R1); \
+    T1 = V_UNPACKLO32(R2, R3); \
+    T2 = V_UNPACKHI32(R0, R1); \
+    T3 = V_UNPACKHI32(R2, R3); \
+    W[4 * (q)]     = V_UNPACKLO64(T0, T1); \
+    W[4 * (q) + 1] = V_UNPACKHI64(T0, T1); \
+    W[4 * (q) + 2] = V_UNPACKLO64(T2, T3); \
+    W[4 * (q) + 3] = V_UNPACKHI64(T2, T3);
+
+#define SHA1MB_KERNEL(name) \
+static void name(uint32_t H[5][SHA1_MAX_LANES], const uint8_t *block[]) \
+{ \
+    const V_TYPE MASK = V_BSWAP_MASK; \
+    const V_TYPE K0 = V_SET1(0x5A827999); \
+    const V_TYPE K1 = V_SET1(0x6ED9EBA1); \
+    const V_TYPE K2 = V_SET1(0x8F1BBCDC); \
+    const V_TYPE K3 = V_SET1(0xCA62C1D6); \
+    V_TYPE A, B, C, D, E, W[16], R0, R1, R2, R3, T0, T1, T2, T3, T; \
+ \
+    SHA1MB_LOAD4(0) \
+    SHA1MB_LOAD4(1) \
+    SHA1MB_LOAD4(2) \
+    SHA1MB_LOAD4(3) \
+ \
+    A = V_LOAD(H[0]); \
+    B = V_LOAD(H[1]); \
+    C = V_LOAD(H[2]); \
+    D = V_LOAD(H[3]); \
+    E = V_LOAD(H[4]); \
+ \
+    SHA1MB_ROUND5(V_CH, K0, 0)  SHA1MB_ROUND5(V_CH, K0, 5) \
+    SHA1MB_ROUND5(V_CH, K0, 10) SHA1MB_ROUND5(V_CH, K0, 15) \
+    SHA1MB_ROUND5(V_PARITY, K1, 20) SHA1MB_ROUND5(V_PARITY, K1, 25) \
+    SHA1MB_ROUND5(V_PARITY, K1, 30) SHA1MB_ROUND5(V_PARITY, K1, 35) \
+    SHA1MB_ROUND5(V_MAJ, K2, 40) SHA1MB_ROUND5(V_MAJ, K2, 45) \
+    SHA1MB_ROUND5(V_MAJ, K2, 50) SHA1MB_ROUND5(V_MAJ, K2, 55) \
+    SHA1MB_ROUND5(V_PARITY, K3, 60) SHA1MB_ROUND5(V_PARITY, K3, 65) \
+    SHA1MB_ROUND5(V_PARITY, K3, 70) SHA1MB_ROUND5(V_PARITY, K3, 75) \
+ \
+    V_STORE(H[0], V_ADD(A, V_LOAD(H[0]))); \
+    V_STORE(H[1], V_ADD(B, V_LOAD(H[1]))); \
+    V_STORE(H[2], V_ADD(C, V_LOAD(H[2]))); \
+    V_STORE(H[3], V_ADD(D, V_LOAD(H[3]))); \
+    V_STORE(H[4], V_ADD(E, V_LOAD(H[4]))); \
+}
+
+#define SHA1MB_BSWAP128 _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3)
+
+/* SSSE3, 4 lanes */
+#define V_TYPE              __m128i
+#define V_SET1(k)           _mm_set1_epi32((int)(k))
+#define V_LOAD(p)           _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p,x)        _mm_storeu_si128((__m128i *)(p), x)
+#define V_ROW(b,j,off)      V_LOAD((b)[j] + (off))
+#define V_BSWAP_MASK        SHA1MB_BSWAP128
+#define V_SHUF(x,m)         _mm_shuffle_epi8(x, m)
+#define V_UNPACKLO32(x,y)   _mm_unpacklo_epi32(x, y)
+#define V_UNPACKHI32(x,y)   _mm_unpackhi_epi32(x, y)
+#define V_UNPACKLO64(x,y)   _mm_unpacklo_epi64(x, y)
+#define V_UNPACKHI64(x,y)   _mm_unpackhi_epi64(x, y)
+#define V_ADD(x,y)          _mm_add_epi32(x, y)
+#define V_XOR(x,y)          _mm_xor_si128(x, y)
+#define V_AND(x,y)          _mm_and_si128(x, y)
+#define V_OR(x,y)           _mm_or_si128(x, y)
+#define V_ROTL(x,n)         V_OR(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+#define V_CH(b,c,d)         V_XOR(d, V_AND(b, V_XOR(c, d)))
+#define V_PARITY(b,c,d)     V_XOR(V_XOR(b, c), d)
+#define V_MAJ(b,c,d)        V_OR(V_AND(b, c), V_AND(d, V_OR(b, c)))
+
+SHA1_TARGET("ssse3")
+SHA1MB_KERNEL(SHA1MultiBlocksSsse3)
+
+#undef V_TYPE
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ROW
+#undef V_BSWAP_MASK
+#undef V_SHUF
+#undef V_UNPACKLO32
+#undef V_UNPACKHI32
+#undef V_UNPACKLO64
+#undef V_UNPACKHI64
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ROTL
+
+/* AVX2, 8 lanes */
+#define V_TYPE              __m256i
+#define V_SET1(k)           _mm256_set1_epi32((int)(k))
+#define V_LOAD(p)           _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p,x)        _mm256_storeu_si256((__m256i *)(p), x)
+#define V_ROW(b,j,off) \
+    _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)((b)[j] + (off)))), \
+                            _mm_loadu_si128((const __m128i *)((b)[(j) + 4] + (off))), 1)
+#define V_BSWAP_MASK        _mm256_broadcastsi128_si256(SHA1MB_BSWAP128)
+#define V_SHUF(x,m)         _mm256_shuffle_epi8(x, m)
+#define V_UNPACKLO32(x,y)   _mm256_unpacklo_epi32(x, y)
+#define V_UNPACKHI32(x,y)   _mm256_unpackhi_epi32(x, y)
+#define V_UNPACKLO64(x,y)   _mm256_unpacklo_epi64(x, y)
+#define V_UNPACKHI64(x,y)   _mm256_unpackhi_epi64(x, y)
+#define V_ADD(x,y)          _mm256_add_epi32(x, y)
+#define V_XOR(x,y)          _mm256_xor_si256(x, y)
+#define V_AND(x,y)          _mm256_and_si256(x, y)
+#define V_OR(x,y)           _mm256_or_si256(x, y)
+#define V_ROTL(x,n)         V_OR(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+SHA1_TARGET("avx2")
+SHA1MB_KERNEL(SHA1MultiBlocksAvx2)
+
+#undef V_TYPE
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ROW
+#undef V_BSWAP_MASK
+#undef V_SHUF
+#undef V_UNPACKLO32
+#undef V_UNPACKHI32
+#undef V_UNPACKLO64
+#undef V_UNPACKHI64
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ROTL
+#undef V_CH
+#undef V_PARITY
+#undef V_MAJ
+
+/* AVX-512, 16 lanes: native rotations and three-input logic */
+#define V_TYPE              __m512i
+#define V_SET1(k)           _mm512_set1_epi32((int)(k))
+#define V_LOAD(p)           _mm512_loadu_si512((const void *)(p))
+#define V_STORE(p,x)        _mm512_storeu_si512((void *)(p), x)
+#define V_LOAD128(b,j,off)  _mm_loadu_si128((const __m128i *)((b)[j] + (off)))
+#define V_ROW(b,j,off) \
+    _mm512_inserti32x4(_mm512_inserti32x4(_mm512_inserti32x4( \
+        _mm512_castsi128_si512(V_LOAD128(b, j, off)), \
+        V_LOAD128(b, (j) + 4, off), 1), V_LOAD128(b, (j) + 8, off), 2), V_LOAD128(b, (j) + 12, off), 3)
+#define V_BSWAP_MASK        _mm512_broadcast_i32x4(SHA1MB_BSWAP128)
+#define V_SHUF(x,m)         _mm512_shuffle_epi8(x, m)
+#define V_UNPACKLO32(x,y)   _mm512_unpacklo_epi32(x, y)
+#define V_UNPACKHI32(x,y)   _mm512_unpackhi_epi32(x, y)
+#define V_UNPACKLO64(x,y)   _mm512_unpacklo_epi64(x, y)
+#define V_UNPACKHI64(x,y)   _mm512_unpackhi_epi64(x, y)
+#define V_ADD(x,y)          _mm512_add_epi32(x, y)
+#define V_XOR(x,y)          _mm512_xor_si512(x, y)
+#define V_ROTL(x,n)         _mm512_rol_epi32(x, n)
+#define V_CH(b,c,d)         _mm512_ternarylogic_epi32(b, c, d, 0xCA)
+#define V_PARITY(b,c,d)     _mm512_ternarylogic_epi32(b, c, d, 0x96)
+#define V_MAJ(b,c,d)        _mm512_ternarylogic_epi32(b, c, d, 0xE8)
+
+SHA1_TARGET("avx512f,avx512bw")
+SHA1MB_KERNEL(SHA1MultiBlocksAvx512)
+
+#undef V_TYPE
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_LOAD128
+#undef V_ROW
+#undef V_BSWAP_MASK
+#undef V_SHUF
+#undef V_UNPACKLO32
+#undef V_UNPACKHI32
+#undef V_UNPACKLO64
+#undef V_UNPACKHI64
+#undef V_ADD
+#undef V_XOR
+#undef V_ROTL
+#undef V_CH
+#undef V_PARITY
+#undef V_MAJ
+
+#define SHA1_CPU_SSSE3      0x01
+#define SHA1_CPU_SSE41      0x02
+#define SHA1_CPU_SHA        0x04
+#define SHA1_CPU_AVX2       0x08
+#define SHA1_CPU_AVX512     0x10
+
+static void SHA1Cpuid(unsigned leaf, unsigned sub, unsigned r[4])
+{
+#if defined(_MSC_VER)
+    int v[4];
+    __cpuidex(v, (int)leaf, (int)sub);
+    r[0] = (unsigned)v[0]; r[1] = (unsigned)v[1];
+    r[2] = (unsigned)v[2]; r[3] = (unsigned)v[3];
+#else
+    if (!__get_cpuid_count(leaf, sub, &r[0], &r[1], &r[2], &r[3]))
+        r[0] = r[1] = r[2] = r[3] = 0;
+#endif
+}
+
+/* Register state saved by the operating system (XCR0) */
+static unsigned SHA1Xcr0(void)
+{
+#if defined(_MSC_VER)
+    return (unsigned)_xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return lo;
+#endif
+}
+
+static unsigned SHA1CpuFeatures(void)
+{
+    unsigned r1[4], r7[4] = { 0, 0, 0, 0 };
+    unsigned f = 0, xcr0 = 0;
+
+    SHA1Cpuid(0, 0, r1);
+    if (r1[0] >= 7) SHA1Cpuid(7, 0, r7);
+    SHA1Cpuid(1, 0, r1);
+    if ((r1[2] >> 27) & 1) xcr0 = SHA1Xcr0();   /* CPUID.1:ECX.OSXSAVE   */
+
+    if ((r1[2] >> 9) & 1) f |= SHA1_CPU_SSSE3;  /* CPUID.1:ECX[bit 9]    */
+    if ((r1[2] >> 19) & 1) f |= SHA1_CPU_SSE41; /* CPUID.1:ECX[bit 19]   */
+    if ((r7[1] >> 29) & 1) f |= SHA1_CPU_SHA;   /* CPUID.7.0:EBX[bit 29] */
+    /* AVX2 (EBX bit 5) needs XMM and YMM state enabled */
+    if (((r7[1] >> 5) & 1) && ((xcr0 & 0x06) == 0x06))
+        f |= SHA1_CPU_AVX2;
+    /* AVX512F and AVX512BW (EBX bits 16, 30) also need opmask and ZMM */
+    if (((r7[1] >> 16) & 1) && ((r7[1] >> 30) & 1) && ((xcr0 & 0xe6) == 0xe6))
+        f |= SHA1_CPU_AVX512;
+    return f;
+}
+
+/*
+ *  Kernels in increasing order of preference: LIBSIAE_SHA1_KERNEL
+ *  names the highest one allowed (an unknown name sets no limit)
+ */
+static int SHA1Allowed(const char *szMax, const char *szName)
+{
+    static const char *order[] = { "portable", "ssse3", "avx2", "avx512", "sha-ni" };
+    int i, nMax = -1, nName = -1;
+
+    if (szMax == NULL) return 1;
+    for (i = 0; i < (int)(sizeof(order) / sizeof(order[0])); i++)
+    {
+        if (strcmp(szMax, order[i]) == 0) nMax = i;
+        if (strcmp(szName, order[i]) == 0) nName = i;
+    }
+    return (nMax < 0) || (nName <= nMax);
+}
+
+SHA1_BLOCKS_FN SHA1X86Kernel(const char *szMax, const char **pszName)
+{
+    unsigned f = SHA1CpuFeatures();
+
+    if ((f & SHA1_CPU_SHA) && (f & SHA1_CPU_SSSE3) && (f & SHA1_CPU_SSE41) &&
+        SHA1Allowed(szMax, "sha-ni"))
+    {
+        *pszName = "sha-ni";
+        return SHA1ProcessBlocksShaNi;
+    }
+    if ((f & SHA1_CPU_SSSE3) && SHA1Allowed(szMax, "ssse3"))
+    {
+        *pszName = "ssse3";
+        return SHA1ProcessBlocksSsse3;
+    }
+    return NULL;
+}
+
+SHA1_MULTI_FN SHA1X86MultiKernel(const char *szMax, int *pnLanes, const char **pszName)
+{
+    unsigned f = SHA1CpuFeatures();
+
+    if ((f & SHA1_CPU_AVX512) && SHA1Allowed(szMax, "avx512"))
+    {
+        *pnLanes = 16;
+        *pszName = "avx512";
+        return SHA1MultiBlocksAvx512;
+    }
+    if ((f & SHA1_CPU_AVX2) && SHA1Allowed(szMax, "avx2"))
+    {
+        *pnLanes = 8;
+        *pszName = "avx2";
+        return SHA1MultiBlocksAvx2;
+    }
+    if ((f & SHA1_CPU_SSSE3) && SHA1Allowed(szMax, "ssse3"))
+    {
+        *pnLanes = 4;
+        *pszName = "ssse3";
+        return SHA1MultiBlocksSsse3;
+    }
+    return NULL;
+}
+
+#else
+
+SHA1_BLOCKS_FN SHA1X86Kernel(const char *szMax, const char **pszName)
+{
+    (void)szMax;
+    (void)pszName;
+    return NULL;
+}
+
+SHA1_MULTI_FN SHA1X86MultiKernel(const char *szMax, int *pnLanes, const char **pszName)
+{
+    (void)szMax;
+    (void)pnLanes;
+    (void)pszName;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SHA1X86_H
+#define SHA1X86_H
+
+#include "sha1.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  sha1x86.h
+ *
+ *  Description:
+ *      SHA-1 compression kernels for x86 processors, used by sha1.c
+ *      in place of the portable one when the CPU supports them:
+ *        "sha-ni"  SHA extensions (SHA1RNDS4, SHA1MSG1/2, ...)
+ *        "ssse3"   message schedule computed four words at a time
+ *      and multi-buffer kernels hashing several messages at once, one
+ *      per lane of a vector register:
+ *        "avx512"  16 lanes
+ *        "avx2"    8 lanes
+ *        "ssse3"   4 lanes
+ *      On other architectures no kernel is available.
+ *
+ */
+
+typedef void (*SHA1_BLOCKS_FN)(uint32_t H[5], const uint8_t *block, unsigned count);
+
+/*
+ *  One block from each lane: H[i][j] is word i of the intermediate
+ *  hash of lane j, block[j] its next 64 bytes
+ */
+#define SHA1_MAX_LANES 16
+typedef void (*SHA1_MULTI_FN)(uint32_t H[5][SHA1_MAX_LANES], const uint8_t *block[]);
+
+/*
+ *  Returns the fastest kernel supported by the CPU that is not
+ *  above szMax ("sha-ni", "ssse3"; NULL for no limit), or NULL if
+ *  only the portable kernel can be used. *pszName receives its name.
+ */
+SHA1_BLOCKS_FN SHA1X86Kernel(const char *szMax, const char **pszName);
+
+/*
+ *  Same for the multi-buffer kernels ("avx512", "avx2", "ssse3");
+ *  *pnLanes receives the number of lanes.
+ */
+SHA1_MULTI_FN SHA1X86MultiKernel(const char *szMax, int *pnLanes, const char **pszName);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // SHA1X86_H
@@ -0,0 +1,453 @@
+/*
+ *  sha256.c
+ *
+ *  Description:
+ *      This file implements the Secure Hashing Algorithm SHA-256 as
+ *      defined in FIPS PUB 180-4, with the same interface and the
+ *      same message handling as sha1.c.
+ *
+ *      The compression function is either the portable one below,
+ *      with the 64 rounds fully unrolled, or a kernel using the x86
+ *      SHA extensions (see sha256x86.c), chosen on first use.
+ *
+ *  Caveats:
+ *      Like sha1.c, this implementation only works with messages
+ *      with a length that is a multiple of the size of an 8-bit
+ *      character and less than 2^64 bits long.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "sha256.h"
+#include "sha256x86.h"
+#include "probes.h"
+#include "sysdep.h"
+
+/*
+ *  Constants defined in SHA-256
+ */
+const uint32_t SHA256K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ *  Define the SHA-256 circular right shift macro
+ */
+#define SHA256Rotr(bits,word) \
+                (((word) >> (bits)) | ((word) << (32-(bits))))
+
+/*
+ *  Functions of FIPS 180-4 section 4.1.2 and one unrolled round.
+ *  W[] holds only the last 16 words of the schedule; SHA256Word(t)
+ *  computes word t in place. The caller rotates the roles of a..h
+ *  instead of moving values.
+ */
+#define SHA256Ch(e,f,g)     ((g) ^ ((e) & ((f) ^ (g))))
+#define SHA256Maj(a,b,c)    (((a) & (b)) | ((c) & ((a) | (b))))
+#define SHA256Sigma0(x)     (SHA256Rotr(2,x) ^ SHA256Rotr(13,x) ^ SHA256Rotr(22,x))
+#define SHA256Sigma1(x)     (SHA256Rotr(6,x) ^ SHA256Rotr(11,x) ^ SHA256Rotr(25,x))
+#define SHA256sigma0(x)     (SHA256Rotr(7,x) ^ SHA256Rotr(18,x) ^ ((x) >> 3))
+#define SHA256sigma1(x)     (SHA256Rotr(17,x) ^ SHA256Rotr(19,x) ^ ((x) >> 10))
+
+#define SHA256Word(t) \
+    (W[(t)&15] += SHA256sigma1(W[((t)+14)&15]) + W[((t)+9)&15] + \
+                  SHA256sigma0(W[((t)+1)&15]))
+#define SHA256W(t)  (((t) < 16) ? W[t] : SHA256Word(t))
+
+#define SHA256Round(a,b,c,d,e,f,g,h,t) \
+    h += SHA256Sigma1(e) + SHA256Ch(e,f,g) + SHA256K[t] + SHA256W(t); \
+    d += h; \
+    h += SHA256Sigma0(a) + SHA256Maj(a,b,c);
+
+#define SHA256Round8(t) \
+    SHA256Round(a,b,c,d,e,f,g,h,(t)) \
+    SHA256Round(h,a,b,c,d,e,f,g,(t)+1) \
+    SHA256Round(g,h,a,b,c,d,e,f,(t)+2) \
+    SHA256Round(f,g,h,a,b,c,d,e,(t)+3) \
+    SHA256Round(e,f,g,h,a,b,c,d,(t)+4) \
+    SHA256Round(d,e,f,g,h,a,b,c,(t)+5) \
+    SHA256Round(c,d,e,f,g,h,a,b,(t)+6) \
+    SHA256Round(b,c,d,e,f,g,h,a,(t)+7)
+
+/* Local Function Prototyptes */
+static void SHA256PadMessage(SHA256Context *);
+static void SHA256ProcessBlocks(uint32_t H[8], const uint8_t *block, unsigned count);
+static void SHA256ProcessBlocksPortable(uint32_t H[8], const uint8_t *block, unsigned count);
+
+/*
+ *  Compression kernel: the SHA extensions if the CPU has them, unless
+ *  LIBSIAE_SHA256_KERNEL is "portable". It is chosen when the library
+ *  is loaded (see SHA256SelectKernel); the check on first use only
+ *  matters for callers that run before the constructors.
+ */
+static SHA256_BLOCKS_FN volatile sha256Kernel = NULL;
+static const char *volatile sha256KernelName = "portable";
+
+static SHA256_BLOCKS_FN SHA256Kernel(void)
+{
+    SHA256_BLOCKS_FN fn = sha256Kernel;
+    const char *szMax, *szName = "portable";
+
+    if (fn == NULL)
+    {
+        szMax = getenv("LIBSIAE_SHA256_KERNEL");
+        if ((szMax == NULL) || (strcmp(szMax, "portable") != 0))
+        {
+            fn = SHA256X86Kernel(&szName);
+        }
+        if (fn == NULL)
+        {
+            fn = SHA256ProcessBlocksPortable;
+            szName = "portable";
+        }
+        sha256KernelName = szName;
+        sha256Kernel = fn;
+    }
+    return fn;
+}
+
+SYS_CONSTRUCTOR(SHA256SelectKernel)
+{
+    SHA256Kernel();
+}
+
+const char *SHA256KernelName(void)
+{
+    SHA256Kernel();
+    return sha256KernelName;
+}
+
+/*
+ *  SHA256Reset
+ *
+ *  Description:
+ *      This function will initialize the SHA256Context in preparation
+ *      for computing a new SHA-256 message digest.
+ *
+ *  Parameters:
+ *      context: [in/out]
+ *          The context to reset.
+ *
+ *  Returns:
+ *      sha Error Code.
+ *
+ */
+int SHA256Reset(SHA256Context *context)
+{
+    if (!context)
+    {
+        return shaNull;
+    }
+
+    context->Length_Low             = 0;
+    context->Length_High            = 0;
+    context->Message_Block_Index    = 0;
+
+    context->Intermediate_Hash[0]   = 0x6a09e667;
+    context->Intermediate_Hash[1]   = 0xbb67ae85;
+    context->Intermediate_Hash[2]   = 0x3c6ef372;
+    context->Intermediate_Hash[3]   = 0xa54ff53a;
+    context->Intermediate_Hash[4]   = 0x510e527f;
+    context->Intermediate_Hash[5]   = 0x9b05688c;
+    context->Intermediate_Hash[6]   = 0x1f83d9ab;
+    context->Intermediate_Hash[7]   = 0x5be0cd19;
+
+    context->Computed   = 0;
+    context->Corrupted  = 0;
+
+    return shaSuccess;
+}
+
+/*
+ *  SHA256Result
+ *
+ *  Description:
+ *      This function will return the 256-bit message digest into the
+ *      Message_Digest array provided by the caller.
+ *
+ *  Parameters:
+ *      context: [in/out]
+ *          The context to use to calculate the SHA-256 hash.
+ *      Message_Digest: [out]
+ *          Where the digest is returned.
+ *
+ *  Returns:
+ *      sha Error Code.
+ *
+ */
+int SHA256Result( SHA256Context *context,
+                  uint8_t Message_Digest[SHA256HashSize])
+{
+    int i;
+
+    if (!context || !Message_Digest)
+    {
+        return shaNull;
+    }
+
+    if (context->Corrupted)
+    {
+        return context->Corrupted;
+    }
+
+    if (!context->Computed)
+    {
+        SHA256PadMessage(context);
+        /* message may be sensitive, clear it out */
+        memset(context->Message_Block, 0, sizeof(context->Message_Block));
+        context->Length_Low = 0;    /* and clear length */
+        context->Length_High = 0;
+        context->Computed = 1;
+    }
+
+    for(i = 0; i < SHA256HashSize; ++i)
+    {
+        Message_Digest[i] = (uint8_t)(context->Intermediate_Hash[i>>2]
+                            >> 8 * ( 3 - ( i & 0x03 ) ));
+    }
+
+    return shaSuccess;
+}
+
+/*
+ *  SHA256Input
+ *
+ *  Description:
+ *      This function accepts an array of octets as the next portion
+ *      of the message.
+ *
+ *  Parameters:
+ *      context: [in/out]
+ *          The SHA context to update
+ *      message_array: [in]
+ *          An array of characters representing the next portion of
+ *          the message.
+ *      length: [in]
+ *          The length of the message in message_array
+ *
+ *  Returns:
+ *      sha Error Code.
+ *
+ */
+int SHA256Input(  SHA256Context  *context,
+                  const uint8_t  *message_array,
+                  unsigned       length)
+{
+    if (!length)
+    {
+        return shaSuccess;
+    }
+
+    if (!context || !message_array)
+    {
+        return shaNull;
+    }
+
+    if (context->Computed)
+    {
+        context->Corrupted = shaStateError;
+
+        return shaStateError;
+    }
+
+    if (context->Corrupted)
+    {
+         return context->Corrupted;
+    }
+
+    context->Length_Low += length << 3;
+    if (context->Length_Low < (length << 3))
+    {
+        context->Length_High++;
+        if (context->Length_High == 0)
+        {
+            /* Message is too long */
+            context->Corrupted = 1;
+        }
+    }
+    if (length >> 29)
+    {
+        context->Length_High += length >> 29;
+        if (context->Length_High < (length >> 29))
+        {
+            context->Corrupted = 1;
+        }
+    }
+    if (context->Corrupted)
+    {
+        return shaSuccess;
+    }
+
+    /*
+     *  Complete the pending block, then compress the full blocks
+     *  directly from the caller's buffer and keep the tail
+     */
+    if (context->Message_Block_Index > 0)
+    {
+        unsigned n = 64 - (unsigned)context->Message_Block_Index;
+        if (n > length)
+        {
+            n = length;
+        }
+        memcpy(context->Message_Block + context->Message_Block_Index,
+               message_array, n);
+        context->Message_Block_Index += n;
+        message_array += n;
+        length -= n;
+        if (context->Message_Block_Index < 64)
+        {
+            return shaSuccess;
+        }
+        SHA256ProcessBlocks(context->Intermediate_Hash, context->Message_Block, 1);
+        context->Message_Block_Index = 0;
+    }
+
+    if (length >= 64)
+    {
+        SHA256ProcessBlocks(context->Intermediate_Hash, message_array, length / 64);
+        message_array += length & ~63u;
+        length &= 63;
+    }
+
+    if (length > 0)
+    {
+        memcpy(context->Message_Block, message_array, length);
+        context->Message_Block_Index = length;
+    }
+
+    return shaSuccess;
+}
+
+/*
+ *  SHA256ProcessBlocks
+ *
+ *  Description:
+ *      This function will process count consecutive 512-bit blocks
+ *      read directly from the buffer, updating the intermediate hash.
+ *
+ */
+static void SHA256ProcessBlocks(uint32_t H[8], const uint8_t *block, unsigned count)
+{
+    SHA256Kernel()(H, block, count);
+}
+
+/*
+ *  SHA256ProcessBlocksPortable
+ *
+ *  Description:
+ *      The compression function in plain C, for any processor.
+ *
+ */
+static void SHA256ProcessBlocksPortable(uint32_t H[8], const uint8_t *block, unsigned count)
+{
+    int           t;                 /* Loop counter                */
+    uint32_t      W[16];             /* Word sequence (circular)    */
+    uint32_t      a, b, c, d, e, f, g, h; /* Word buffers           */
+
+    for(; count > 0; count--, block += 64)
+    {
+        for(t = 0; t < 16; t++)
+        {
+            W[t] = ((uint32_t)block[t * 4] << 24) |
+                   ((uint32_t)block[t * 4 + 1] << 16) |
+                   ((uint32_t)block[t * 4 + 2] << 8) |
+                   (uint32_t)block[t * 4 + 3];
+        }
+
+        a = H[0];
+        b = H[1];
+        c = H[2];
+        d = H[3];
+        e = H[4];
+        f = H[5];
+        g = H[6];
+        h = H[7];
+
+        SHA256Round8(0)
+        SHA256Round8(8)
+        SHA256Round8(16)
+        SHA256Round8(24)
+        SHA256Round8(32)
+        SHA256Round8(40)
+        SHA256Round8(48)
+        SHA256Round8(56)
+
+        H[0] += a;
+        H[1] += b;
+        H[2] += c;
+        H[3] += d;
+        H[4] += e;
+        H[5] += f;
+        H[6] += g;
+        H[7] += h;
+    }
+}
+
+/*
+ *  SHA256PadMessage
+ *
+ *  Description:
+ *      Pads the message to an even 512 bits as in SHA1PadMessage:
+ *      a '1' bit, zeros, and the 64-bit message length, then
+ *      processes the last block(s).
+ *
+ */
+static void SHA256PadMessage(SHA256Context *context)
+{
+    int i = context->Message_Block_Index;
+
+    context->Message_Block[i++] = 0x80;
+    if (i > 56)
+    {
+        memset(context->Message_Block + i, 0, 64 - i);
+        SHA256ProcessBlocks(context->Intermediate_Hash, context->Message_Block, 1);
+        i = 0;
+    }
+    memset(context->Message_Block + i, 0, 56 - i);
+
+    /*
+     *  Store the message length as the last 8 octets
+     */
+    context->Message_Block[56] = (uint8_t)(context->Length_High >> 24);
+    context->Message_Block[57] = (uint8_t)(context->Length_High >> 16);
+    context->Message_Block[58] = (uint8_t)(context->Length_High >> 8);
+    context->Message_Block[59] = (uint8_t)(context->Length_High);
+    context->Message_Block[60] = (uint8_t)(context->Length_Low >> 24);
+    context->Message_Block[61] = (uint8_t)(context->Length_Low >> 16);
+    context->Message_Block[62] = (uint8_t)(context->Length_Low >> 8);
+    context->Message_Block[63] = (uint8_t)(context->Length_Low);
+
+    SHA256ProcessBlocks(context->Intermediate_Hash, context->Message_Block, 1);
+    context->Message_Block_Index = 0;
+}
+
+int SHA256(const unsigned char *toHash, int Len, unsigned char *Hashed)
+{
+  SHA256Context sha;
+  int rv=0;
+  S_PROBE1(sha256__start,Len);
+  if (SHA256Reset(&sha)==0) {
+    if (SHA256Input(&sha,toHash,Len)==0) {
+      if (SHA256Result(&sha, Hashed)==0) rv=1;
+    }
+  }
+  S_PROBE1(sha256__done,Len);
+  return rv;
+}
@@ -0,0 +1,64 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include "sha1.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  sha256.h
+ *
+ *  Description:
+ *      This is the header file for code which implements the Secure
+ *      Hashing Algorithm SHA-256 as defined in FIPS PUB 180-4.
+ *
+ *      The interface follows sha1.h; the integer types and the
+ *      shaSuccess/shaNull/... error codes are the ones defined there.
+ *
+ *      Please read the file sha256.c for more information.
+ *
+ */
+
+#define SHA256HashSize 32
+
+/*
+ *  This structure will hold context information for the SHA-256
+ *  hashing operation
+ */
+typedef struct SHA256Context
+{
+    uint32_t Intermediate_Hash[SHA256HashSize/4]; /* Message Digest */
+
+    uint32_t Length_Low;            /* Message length in bits      */
+    uint32_t Length_High;           /* Message length in bits      */
+
+    int Message_Block_Index;        /* Index into message block array */
+    uint8_t Message_Block[64];      /* 512-bit message blocks      */
+
+    int Computed;               /* Is the digest computed?         */
+    int Corrupted;             /* Is the message digest corrupted? */
+} SHA256Context;
+
+/*
+ *  Function Prototypes
+ */
+
+int SHA256Reset(  SHA256Context *);
+int SHA256Input(  SHA256Context *,
+                  const uint8_t *,
+                  unsigned int);
+int SHA256Result( SHA256Context *,
+                  uint8_t Message_Digest[SHA256HashSize]);
+
+int SHA256(const unsigned char *toHash, int Len, unsigned char *Hashed);
+
+/* Name of the compression kernel in use: "sha-ni", "portable" */
+const char *SHA256KernelName(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // SHA256_H
@@ -0,0 +1,170 @@
+/*
+ *  sha256x86.c
+ *
+ *  Description:
+ *      SHA-256 compression kernel using the x86 SHA extensions. It
+ *      processes count consecutive 512-bit blocks and updates the
+ *      intermediate hash exactly like the portable kernel in
+ *      sha256.c; as in sha1x86.c the function has its own target
+ *      attribute and is only returned after checking CPUID.
+ *
+ */
+
+#include "sha256x86.h"
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && \
+    !defined(LIBSIAE_NO_SHA256_X86)
+#define SHA256_X86 1
+#endif
+
+#ifdef SHA256_X86
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA256_TARGET(isa)
+#else
+#include <cpuid.h>
+#define SHA256_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/*
+ *  SHA256ProcessBlocksShaNi
+ *
+ *  Description:
+ *      SHA256RNDS2 performs two rounds on the state split as ABEF and
+ *      CDGH, taking W[t]+K[t] for both from the low half of its third
+ *      operand; SHA256MSG1/SHA256MSG2 compute the message schedule
+ *      four words at a time.
+ *
+ */
+SHA256_TARGET("sha,ssse3,sse4.1")
+static void SHA256ProcessBlocksShaNi(uint32_t H[8], const uint8_t *block, unsigned count)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    __m128i STATE0, STATE1, ABEF_SAVE, CDGH_SAVE;
+    __m128i MSG, TMP, MSG0, MSG1, MSG2, MSG3;
+
+    TMP = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&H[0]), 0xB1);    /* CDAB */
+    STATE1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&H[4]), 0x1B); /* EFGH */
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);                                  /* ABEF */
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);                               /* CDGH */
+
+    for(; count > 0; count--, block += 64)
+    {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+/* Four rounds with the schedule words in Mi */
+#define SHA256NI_ROUNDS4(Mi,g) \
+        MSG = _mm_add_epi32(Mi, _mm_loadu_si128((const __m128i *)(SHA256K + 4 * (g)))); \
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG); \
+        MSG = _mm_shuffle_epi32(MSG, 0x0E); \
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+/* Completes the four words after Mi in Mn: W[t] = s1(W[t-2]) + W[t-7] + ... */
+#define SHA256NI_NEXT4(Mi,Mp,Mn) \
+        TMP = _mm_alignr_epi8(Mi, Mp, 4); \
+        Mn = _mm_add_epi32(Mn, TMP); \
+        Mn = _mm_sha256msg2_epu32(Mn, Mi);
+
+        MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 0)), MASK);
+        SHA256NI_ROUNDS4(MSG0, 0)
+        MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16)), MASK);
+        SHA256NI_ROUNDS4(MSG1, 1)
+        MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+        MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 32)), MASK);
+        SHA256NI_ROUNDS4(MSG2, 2)
+        MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+        MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 48)), MASK);
+        SHA256NI_ROUNDS4(MSG3, 3)
+        SHA256NI_NEXT4(MSG3, MSG2, MSG0)
+        MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);
+
+        SHA256NI_ROUNDS4(MSG0, 4)
+        SHA256NI_NEXT4(MSG0, MSG3, MSG1)
+        MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);
+        SHA256NI_ROUNDS4(MSG1, 5)
+        SHA256NI_NEXT4(MSG1, MSG0, MSG2)
+        MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+        SHA256NI_ROUNDS4(MSG2, 6)
+        SHA256NI_NEXT4(MSG2, MSG1, MSG3)
+        MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+        SHA256NI_ROUNDS4(MSG3, 7)
+        SHA256NI_NEXT4(MSG3, MSG2, MSG0)
+        MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);
+
+        SHA256NI_ROUNDS4(MSG0, 8)
+        SHA256NI_NEXT4(MSG0, MSG3, MSG1)
+        MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);
+        SHA256NI_ROUNDS4(MSG1, 9)
+        SHA256NI_NEXT4(MSG1, MSG0, MSG2)
+        MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+        SHA256NI_ROUNDS4(MSG2, 10)
+        SHA256NI_NEXT4(MSG2, MSG1, MSG3)
+        MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+        SHA256NI_ROUNDS4(MSG3, 11)
+        SHA256NI_NEXT4(MSG3, MSG2, MSG0)
+        MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);
+
+        SHA256NI_ROUNDS4(MSG0, 12)
+        SHA256NI_NEXT4(MSG0, MSG3, MSG1)
+        MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);
+        SHA256NI_ROUNDS4(MSG1, 13)
+        SHA256NI_NEXT4(MSG1, MSG0, MSG2)
+        SHA256NI_ROUNDS4(MSG2, 14)
+        SHA256NI_NEXT4(MSG2, MSG1, MSG3)
+        SHA256NI_ROUNDS4(MSG3, 15)
+#undef SHA256NI_ROUNDS4
+#undef SHA256NI_NEXT4
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);                                     /* FEBA */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);                                  /* DCHG */
+    _mm_storeu_si128((__m128i *)&H[0], _mm_blend_epi16(TMP, STATE1, 0xF0));    /* DCBA */
+    _mm_storeu_si128((__m128i *)&H[4], _mm_alignr_epi8(STATE1, TMP, 8));       /* HGFE */
+}
+
+SHA256_BLOCKS_FN SHA256X86Kernel(const char **pszName)
+{
+    unsigned r[4] = { 0, 0, 0, 0 }, ebx7 = 0, ecx1;
+
+#if defined(_MSC_VER)
+    int v[4];
+    __cpuidex(v, 0, 0);
+    if (v[0] >= 7)
+    {
+        __cpuidex(v, 7, 0);
+        ebx7 = (unsigned)v[1];
+    }
+    __cpuidex(v, 1, 0);
+    ecx1 = (unsigned)v[2];
+#else
+    if (__get_cpuid_count(7, 0, &r[0], &r[1], &r[2], &r[3]))
+        ebx7 = r[1];
+    if (!__get_cpuid(1, &r[0], &r[1], &r[2], &r[3]))
+        r[2] = 0;
+    ecx1 = r[2];
+#endif
+
+    /* CPUID.7.0:EBX.SHA[bit 29], CPUID.1:ECX.SSSE3[bit 9], .SSE4_1[bit 19] */
+    if (((ebx7 >> 29) & 1) && ((ecx1 >> 9) & 1) && ((ecx1 >> 19) & 1))
+    {
+        *pszName = "sha-ni";
+        return SHA256ProcessBlocksShaNi;
+    }
+    return NULL;
+}
+
+#else
+
+SHA256_BLOCKS_FN SHA256X86Kernel(const char **pszName)
+{
+    (void)pszName;
+    return NULL;
+}
+
+#endif
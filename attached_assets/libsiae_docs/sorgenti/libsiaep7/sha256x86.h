@@ -0,0 +1,34 @@
+#ifndef SHA256X86_H
+#define SHA256X86_H
+
+#include "sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  sha256x86.h
+ *
+ *  Description:
+ *      SHA-256 compression kernel for x86 processors with the SHA
+ *      extensions, used by sha256.c in place of the portable one.
+ *
+ */
+
+typedef void (*SHA256_BLOCKS_FN)(uint32_t H[8], const uint8_t *block, unsigned count);
+
+/* Round constants, defined in sha256.c */
+extern const uint32_t SHA256K[64];
+
+/*
+ *  Returns the "sha-ni" kernel if the CPU supports it, otherwise NULL;
+ *  *pszName receives its name.
+ */
+SHA256_BLOCKS_FN SHA256X86Kernel(const char **pszName);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // SHA256X86_H
@@ -10,6 +10,8 @@
 #include "utility.h"
 #include "pkcs7.h"
 #include "smime.h"
+#include "stats.h"
+#include "probes.h"
 
 #include <math.h>
 #include <time.h>
@@ -291,9 +293,11 @@ int CALLINGCONV SMIMESignML(const char* pin, unsigned long slot, const char* szO
 	const char* szFrom, const char* szTo, const char* szSubject, const char* szOtherHeaders, const char* szBody, const char* szAttachments,
 	unsigned long dwFlags, int bInitialize)
 {
+	SYS_INT64 tStart = SysTimeUs();
+	S_PROBE2(call__entry, "SMIMESignML", (int)slot);
 
 	S_TRACE("packSmime(),parametri: \npin=%s, \nslot=%d, \nszOutputFilePath=%s, \nszFrom=%s, \nszTo=%s, \nszSubject=%s, \nszOtherHeaders=%s, \nszBody=\n%s, \nszAttachments=%s,\ndwFlags=0x%08X\n",
-		pin?pin:"NULL", slot,szOutputFilePath?szOutputFilePath:"NULL", szFrom?szFrom:"NULL", szTo?szTo:"NULL",
+		S_SECRET(pin), slot,szOutputFilePath?szOutputFilePath:"NULL", szFrom?szFrom:"NULL", szTo?szTo:"NULL",
 		szSubject?szSubject:"NULL", szOtherHeaders?szOtherHeaders:"NULL", szBody?szBody:"NULL", szAttachments?szAttachments:"NULL", dwFlags);
 
 	string strFrom(szFrom), strTo(szTo);
@@ -329,7 +333,7 @@ int CALLINGCONV SMIMESignML(const char* pin, unsigned long slot, const char* szO
 				strTempFile1.c_str(), 2); // binary attachment
 	if (!iRv)
 	{
-		iRv = PKCS7SignML(pin, slot, strTempFile1.c_str(), (strTempFile1 + ".p7m").c_str(), bInitialize);
+		iRv = PKCS7SignExML(pin, slot, strTempFile1.c_str(), (strTempFile1 + ".p7m").c_str(), dwFlags & PKCS7_FLAG_SHA256, bInitialize);
 		if (iRv) goto CleanUp;
 
 
@@ -348,6 +352,8 @@ CleanUp:
 	unlink(strTempFile1.c_str() );
 	unlink((strTempFile1 + ".p7m").c_str() );
 
+	StatsCall((int)slot, STATS_CALL_SMIMESIGN, tStart, iRv);
+	S_PROBE3(call__return, "SMIMESignML", (int)slot, iRv);
 	return iRv;
 
 }
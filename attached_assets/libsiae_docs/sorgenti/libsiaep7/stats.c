@@ -0,0 +1,192 @@
+/*****************************************************************************
+                 Statistiche di latenza delle APDU e delle chiamate
+*****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "libsiaecardt.h"
+#include "libsiaecard.h"
+#include "internals.h"
+#include "stats.h"
+#include "sysdep.h"
+
+#define INS(apdu) ((BYTE)(((apdu)>>16)&0xff))
+
+typedef struct _STATS_HISTOGRAM {
+  SYS_ATOMIC count;
+  SYS_ATOMIC errors;
+  SYS_ATOMIC max;
+  SYS_ATOMIC buckets[STATS_BUCKETS];
+} STATS_HISTOGRAM;
+
+typedef struct _SLOT_STATS {
+  SYS_ATOMIC resets;
+  STATS_HISTOGRAM transaction;
+  STATS_HISTOGRAM apdu[STATS_APDU_CLASSES];
+  STATS_HISTOGRAM call[STATS_CALLS];
+} SLOT_STATS;
+
+/* Allocate al primo utilizzo e mai liberate, come gli slot a cui sono */
+/* agganciate                                                          */
+static SLOT_STATS *SlotStats(int nSlot, int bCreate)
+{
+  SLOT_STATS *p;
+  void *volatile *ref=SlotStatsRef(nSlot);
+  if (ref==NULL) return NULL;
+  p=(SLOT_STATS*)SysAtomicLoadPtr(ref);
+  if ((p!=NULL)||!bCreate) return p;
+  p=(SLOT_STATS*)calloc(1,sizeof(SLOT_STATS));
+  if (p==NULL) return NULL;
+  if (!SysAtomicCASPtr(ref,NULL,p)) {
+    free(p);
+    p=(SLOT_STATS*)SysAtomicLoadPtr(ref);
+  }
+  return p;
+}
+
+/* Intervallo dell'istogramma: sotto 2*STATS_SUB_BUCKETS us uno per  */
+/* microsecondo, poi STATS_SUB_BUCKETS per ogni potenza di 2         */
+static int Bucket(SYS_INT64 us)
+{
+  unsigned long v;
+  int e, i;
+  if (us<STATS_SUB_BUCKETS) return (us<0)?0:(int)us;
+  if (us>0x7fffffff) return STATS_BUCKETS-1;
+  v=(unsigned long)us;
+  for (e=0; (v>>e)>=2*STATS_SUB_BUCKETS; e++);
+  i=(e+1)*STATS_SUB_BUCKETS+(int)((v>>e)-STATS_SUB_BUCKETS);
+  return (i<STATS_BUCKETS)?i:STATS_BUCKETS-1;
+}
+
+/* Primo valore (in microsecondi) dell'intervallo i */
+static DWORD BucketLow(int i)
+{
+  if (i<2*STATS_SUB_BUCKETS) return (DWORD)i;
+  return (DWORD)(STATS_SUB_BUCKETS+i%STATS_SUB_BUCKETS)<<(i/STATS_SUB_BUCKETS-1);
+}
+
+static void Record(STATS_HISTOGRAM *h, SYS_INT64 us, int bError)
+{
+  long m;
+  if (us<0) us=0;
+  if (us>0x7fffffff) us=0x7fffffff;
+  SysAtomicAdd(&h->buckets[Bucket(us)],1);
+  SysAtomicAdd(&h->count,1);
+  if (bError) SysAtomicAdd(&h->errors,1);
+  while ((m=SysAtomicLoad(&h->max))<(long)us)
+    if (SysAtomicCAS(&h->max,m,(long)us)) break;
+}
+
+static int ApduClass(const BYTE *pSend)
+{
+  switch (pSend[1]) {
+  case INS(APDU_SELECT):     return STATS_APDU_SELECT;
+  case INS(APDU_READBINARY): return STATS_APDU_READBINARY;
+  case INS(APDU_READRECORD): return STATS_APDU_READRECORD;
+  case INS(APDU_VERIFYPIN):  return STATS_APDU_VERIFY;
+  case INS(APDU_MSE):        return STATS_APDU_MSE;
+  case INS(APDU_SIGN):       return STATS_APDU_SIGN;
+  case INS(APDU_CMP_SIGILLO):
+    /* READ COUNTER e CMP_SIGILLO differiscono solo per P1 P2 */
+    return (pSend[3]==(BYTE)(APDU_CMP_SIGILLO&0xff))?STATS_APDU_SIGILLO:STATS_APDU_READCOUNTER;
+  }
+  return STATS_APDU_OTHER;
+}
+
+void StatsApdu(int nSlot, const BYTE *pSend, SYS_INT64 us, int bError)
+{
+  SLOT_STATS *p=SlotStats(nSlot,TRUE);
+  if (p!=NULL) Record(&p->apdu[ApduClass(pSend)],us,bError);
+}
+
+void StatsReset(int nSlot)
+{
+  SLOT_STATS *p=SlotStats(nSlot,TRUE);
+  if (p!=NULL) SysAtomicAdd(&p->resets,1);
+}
+
+void StatsTransaction(int nSlot, SYS_INT64 us)
+{
+  SLOT_STATS *p=SlotStats(nSlot,TRUE);
+  if (p!=NULL) Record(&p->transaction,us,FALSE);
+}
+
+void StatsCall(int nSlot, int nCall, SYS_INT64 tStart, int rv)
+{
+  SLOT_STATS *p=SlotStats(nSlot,TRUE);
+  if ((p!=NULL)&&(nCall>=0)&&(nCall<STATS_CALLS))
+    Record(&p->call[nCall],SysTimeUs()-tStart,rv!=C_OK);
+}
+
+static void CopyHistogram(SIAE_HISTOGRAM *pDst, STATS_HISTOGRAM *pSrc)
+{
+  int i;
+  pDst->count=(DWORD)SysAtomicLoad(&pSrc->count);
+  pDst->errors=(DWORD)SysAtomicLoad(&pSrc->errors);
+  pDst->max=(DWORD)SysAtomicLoad(&pSrc->max);
+  for (i=0; i<STATS_BUCKETS; i++)
+    pDst->buckets[i]=(DWORD)SysAtomicLoad(&pSrc->buckets[i]);
+}
+
+static void ClearHistogram(STATS_HISTOGRAM *h)
+{
+  int i;
+  SysAtomicStore(&h->count,0);
+  SysAtomicStore(&h->errors,0);
+  SysAtomicStore(&h->max,0);
+  for (i=0; i<STATS_BUCKETS; i++)
+    SysAtomicStore(&h->buckets[i],0);
+}
+
+int CALLINGCONV GetStatsML(SIAE_STATS *pStats, int nSlot)
+{
+  SLOT_STATS *p;
+  int i;
+  if ((pStats==NULL)||(nSlot<0)||(nSlot>=MAX_SLOTS)) return C_GENERIC_ERROR;
+  memset(pStats,0,sizeof(SIAE_STATS));
+  p=SlotStats(nSlot,FALSE);
+  if (p==NULL) return C_OK;
+  pStats->resets=(DWORD)SysAtomicLoad(&p->resets);
+  CopyHistogram(&pStats->transaction,&p->transaction);
+  for (i=0; i<STATS_APDU_CLASSES; i++)
+    CopyHistogram(&pStats->apdu[i],&p->apdu[i]);
+  for (i=0; i<STATS_CALLS; i++)
+    CopyHistogram(&pStats->call[i],&p->call[i]);
+  return C_OK;
+}
+
+int CALLINGCONV ResetStatsML(int nSlot)
+{
+  SLOT_STATS *p;
+  int i;
+  if ((nSlot<0)||(nSlot>=MAX_SLOTS)) return C_GENERIC_ERROR;
+  p=SlotStats(nSlot,FALSE);
+  if (p==NULL) return C_OK;
+  SysAtomicStore(&p->resets,0);
+  ClearHistogram(&p->transaction);
+  for (i=0; i<STATS_APDU_CLASSES; i++)
+    ClearHistogram(&p->apdu[i]);
+  for (i=0; i<STATS_CALLS; i++)
+    ClearHistogram(&p->call[i]);
+  return C_OK;
+}
+
+/* Ritorna l'ultimo valore dell'intervallo che contiene il percentile, */
+/* senza superare il massimo osservato                                 */
+DWORD CALLINGCONV GetStatsPercentile(const SIAE_HISTOGRAM *pHist, double dPercent)
+{
+  double target, n=0;
+  DWORD v;
+  int i;
+  if ((pHist==NULL)||(pHist->count==0)) return 0;
+  if (dPercent<0) dPercent=0;
+  if (dPercent>100) dPercent=100;
+  for (i=0; i<STATS_BUCKETS; i++) n+=pHist->buckets[i];
+  target=n*dPercent/100;
+  for (i=0, n=0; i<STATS_BUCKETS-1; i++) {
+    n+=pHist->buckets[i];
+    if ((n>=target)&&(n>0)) break;
+  }
+  v=(i<STATS_BUCKETS-1)?BucketLow(i+1)-1:pHist->max;
+  return (v<pHist->max)?v:pHist->max;
+}
@@ -0,0 +1,37 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "libsiaecard.h"
+#include "sysdep.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************
+  Statistiche di latenza per slot, sempre attive. Ogni slot ha i propri
+  istogrammi, allocati al primo utilizzo e aggiornati con operazioni
+  atomiche: chi registra una misura non attende mai e GetStatsML ne legge
+  una copia senza lock (i contatori di uno stesso istogramma possono
+  quindi differire di qualche unita' se letti durante un'operazione).
+*****************************************************************************/
+
+/* APDU trasmessa al trasporto in us microsecondi; bError se il trasporto */
+/* ha fallito o la SW non e' 90xx/61xx                                     */
+void StatsApdu(int nSlot, const BYTE *pSend, SYS_INT64 us, int bError);
+
+/* APDU ritrasmessa dopo SCARD_W_RESET_CARD */
+void StatsReset(int nSlot);
+
+/* Attesa in SCardBeginTransaction */
+void StatsTransaction(int nSlot, SYS_INT64 us);
+
+/* Chiamata STATS_CALL_xxx iniziata a tStart (SysTimeUs) e terminata ora */
+/* con risultato rv                                                      */
+void StatsCall(int nSlot, int nCall, SYS_INT64 tStart, int rv);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // STATS_H
@@ -0,0 +1,381 @@
+#ifndef SYSDEP_H
+#define SYSDEP_H
+
+/*****************************************************************************
+  Primitive di sistema usate internamente dalla libreria (thread, mutex,
+  variabili condizione, operazioni atomiche, spinlock) nelle versioni
+  Win32 e POSIX.
+*****************************************************************************/
+
+#ifdef WIN32
+#	include <windows.h>
+#else
+#	include <pthread.h>
+#	include <sched.h>
+#	include <time.h>
+#	include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYS_INLINE __inline
+
+/* Funzione eseguita al caricamento della libreria (o del programma),  */
+/* prima di qualunque chiamata: SYS_CONSTRUCTOR(nome) { ... }          */
+#ifdef _MSC_VER
+#	pragma section(".CRT$XCU",read)
+#	define SYS_CONSTRUCTOR(name) \
+	static void __cdecl name(void); \
+	__declspec(allocate(".CRT$XCU")) void (__cdecl *name##Entry)(void)=name; \
+	static void __cdecl name(void)
+#else
+#	define SYS_CONSTRUCTOR(name) \
+	static void name(void) __attribute__((constructor)); \
+	static void name(void)
+#endif
+
+/* Thread: le funzioni eseguite vanno dichiarate con SYS_THREAD_PROC */
+/* e terminano con return SYS_THREAD_RETURN;                        */
+#ifdef WIN32
+typedef HANDLE SYS_THREAD;
+#	define SYS_THREAD_PROC(name,arg) DWORD WINAPI name(LPVOID arg)
+#	define SYS_THREAD_RETURN 0
+typedef DWORD (WINAPI *SYS_THREAD_FN)(LPVOID);
+#else
+typedef pthread_t SYS_THREAD;
+#	define SYS_THREAD_PROC(name,arg) void *name(void *arg)
+#	define SYS_THREAD_RETURN NULL
+typedef void *(*SYS_THREAD_FN)(void *);
+#endif
+
+static SYS_INLINE int SysThreadCreate(SYS_THREAD *pThread, SYS_THREAD_FN fn, void *arg)
+{
+#ifdef WIN32
+  *pThread=CreateThread(NULL,0,fn,arg,0,NULL);
+  return (*pThread!=NULL);
+#else
+  return (pthread_create(pThread,NULL,fn,arg)==0);
+#endif
+}
+
+static SYS_INLINE void SysThreadJoin(SYS_THREAD thread)
+{
+#ifdef WIN32
+  WaitForSingleObject(thread,INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread,NULL);
+#endif
+}
+
+/* Variabili locali al thread; la funzione dichiarata con           */
+/* SYS_TLS_DESTRUCTOR viene chiamata alla fine di ogni thread che ha */
+/* impostato un valore diverso da NULL                               */
+#ifdef WIN32
+typedef DWORD SYS_TLS;
+#	define SYS_TLS_DESTRUCTOR(name,arg) VOID NTAPI name(PVOID arg)
+typedef VOID (NTAPI *SYS_TLS_FN)(PVOID);
+#else
+typedef pthread_key_t SYS_TLS;
+#	define SYS_TLS_DESTRUCTOR(name,arg) void name(void *arg)
+typedef void (*SYS_TLS_FN)(void *);
+#endif
+
+static SYS_INLINE int SysTlsCreate(SYS_TLS *pKey, SYS_TLS_FN fnDestructor)
+{
+#ifdef WIN32
+  *pKey=FlsAlloc(fnDestructor);
+  return (*pKey!=FLS_OUT_OF_INDEXES);
+#else
+  return (pthread_key_create(pKey,fnDestructor)==0);
+#endif
+}
+
+static SYS_INLINE void *SysTlsGet(SYS_TLS key)
+{
+#ifdef WIN32
+  return FlsGetValue(key);
+#else
+  return pthread_getspecific(key);
+#endif
+}
+
+static SYS_INLINE void SysTlsSet(SYS_TLS key, void *value)
+{
+#ifdef WIN32
+  FlsSetValue(key,value);
+#else
+  pthread_setspecific(key,value);
+#endif
+}
+
+static SYS_INLINE void SysSleep(int ms)
+{
+#ifdef WIN32
+  Sleep(ms);
+#else
+  usleep(ms*1000);
+#endif
+}
+
+/* Attesa in microsecondi (su Win32 arrotondata al millisecondo) */
+static SYS_INLINE void SysSleepUs(long us)
+{
+#ifdef WIN32
+  Sleep((DWORD)((us+999)/1000));
+#else
+  struct timespec ts;
+  ts.tv_sec=us/1000000;
+  ts.tv_nsec=(us%1000000)*1000;
+  nanosleep(&ts,NULL);
+#endif
+}
+
+/* Intero a 64 bit e tempo monotono in microsecondi */
+#ifdef WIN32
+typedef __int64 SYS_INT64;
+#else
+typedef long long SYS_INT64;
+#endif
+
+static SYS_INLINE SYS_INT64 SysTimeUs()
+{
+#ifdef WIN32
+  LARGE_INTEGER f, c;
+  QueryPerformanceFrequency(&f);
+  QueryPerformanceCounter(&c);
+  return (SYS_INT64)((c.QuadPart/f.QuadPart)*1000000+(c.QuadPart%f.QuadPart)*1000000/f.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (SYS_INT64)ts.tv_sec*1000000+ts.tv_nsec/1000;
+#endif
+}
+
+/* Mutex ricorsivo: lo stesso thread puo' acquisirlo piu' volte */
+#ifdef WIN32
+typedef CRITICAL_SECTION SYS_MUTEX;
+#else
+typedef pthread_mutex_t SYS_MUTEX;
+#endif
+
+static SYS_INLINE void SysMutexInit(SYS_MUTEX *m)
+{
+#ifdef WIN32
+  InitializeCriticalSection(m);
+#else
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(m,&attr);
+  pthread_mutexattr_destroy(&attr);
+#endif
+}
+
+static SYS_INLINE void SysMutexLock(SYS_MUTEX *m)
+{
+#ifdef WIN32
+  EnterCriticalSection(m);
+#else
+  pthread_mutex_lock(m);
+#endif
+}
+
+static SYS_INLINE void SysMutexUnlock(SYS_MUTEX *m)
+{
+#ifdef WIN32
+  LeaveCriticalSection(m);
+#else
+  pthread_mutex_unlock(m);
+#endif
+}
+
+static SYS_INLINE void SysMutexDestroy(SYS_MUTEX *m)
+{
+#ifdef WIN32
+  DeleteCriticalSection(m);
+#else
+  pthread_mutex_destroy(m);
+#endif
+}
+
+/* Variabile condizione associata a un SYS_MUTEX: SysCondWait va chiamata */
+/* con il mutex acquisito una sola volta e puo' ritornare anche senza     */
+/* segnalazione, quindi la condizione va ricontrollata in un ciclo        */
+#ifdef WIN32
+typedef CONDITION_VARIABLE SYS_COND;
+#else
+typedef pthread_cond_t SYS_COND;
+#endif
+
+static SYS_INLINE void SysCondInit(SYS_COND *c)
+{
+#ifdef WIN32
+  InitializeConditionVariable(c);
+#else
+  pthread_cond_init(c,NULL);
+#endif
+}
+
+static SYS_INLINE void SysCondWait(SYS_COND *c, SYS_MUTEX *m)
+{
+#ifdef WIN32
+  SleepConditionVariableCS(c,m,INFINITE);
+#else
+  pthread_cond_wait(c,m);
+#endif
+}
+
+/* Come SysCondWait, ma attende al massimo ms millisecondi */
+static SYS_INLINE void SysCondTimedWait(SYS_COND *c, SYS_MUTEX *m, int ms)
+{
+#ifdef WIN32
+  SleepConditionVariableCS(c,m,(DWORD)ms);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME,&ts);
+  ts.tv_sec+=ms/1000;
+  ts.tv_nsec+=(long)(ms%1000)*1000000;
+  if (ts.tv_nsec>=1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec-=1000000000;
+  }
+  pthread_cond_timedwait(c,m,&ts);
+#endif
+}
+
+static SYS_INLINE void SysCondBroadcast(SYS_COND *c)
+{
+#ifdef WIN32
+  WakeAllConditionVariable(c);
+#else
+  pthread_cond_broadcast(c);
+#endif
+}
+
+static SYS_INLINE void SysCondDestroy(SYS_COND *c)
+{
+#ifdef WIN32
+  (void)c;
+#else
+  pthread_cond_destroy(c);
+#endif
+}
+
+/* Operazioni atomiche su un long (32 bit su Win32) */
+typedef volatile long SYS_ATOMIC;
+
+static SYS_INLINE long SysAtomicLoad(SYS_ATOMIC *p)
+{
+#ifdef WIN32
+  return InterlockedCompareExchange(p,0,0);
+#else
+  return __atomic_load_n(p,__ATOMIC_ACQUIRE);
+#endif
+}
+
+static SYS_INLINE void SysAtomicStore(SYS_ATOMIC *p, long v)
+{
+#ifdef WIN32
+  InterlockedExchange(p,v);
+#else
+  __atomic_store_n(p,v,__ATOMIC_RELEASE);
+#endif
+}
+
+static SYS_INLINE long SysAtomicExchange(SYS_ATOMIC *p, long v)
+{
+#ifdef WIN32
+  return InterlockedExchange(p,v);
+#else
+  return __atomic_exchange_n(p,v,__ATOMIC_ACQ_REL);
+#endif
+}
+
+/* Ritorna il valore dopo l'incremento */
+static SYS_INLINE long SysAtomicAdd(SYS_ATOMIC *p, long v)
+{
+#ifdef WIN32
+  return InterlockedExchangeAdd(p,v)+v;
+#else
+  return __atomic_add_fetch(p,v,__ATOMIC_ACQ_REL);
+#endif
+}
+
+/* Ritorna TRUE se *p valeva cmp ed e' stato sostituito da v */
+static SYS_INLINE int SysAtomicCAS(SYS_ATOMIC *p, long cmp, long v)
+{
+#ifdef WIN32
+  return (InterlockedCompareExchange(p,v,cmp)==cmp);
+#else
+  return __atomic_compare_exchange_n(p,&cmp,v,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Operazioni atomiche su un puntatore */
+static SYS_INLINE void *SysAtomicLoadPtr(void *volatile *p)
+{
+#ifdef WIN32
+  return InterlockedCompareExchangePointer(p,NULL,NULL);
+#else
+  return __atomic_load_n(p,__ATOMIC_ACQUIRE);
+#endif
+}
+
+static SYS_INLINE void SysAtomicStorePtr(void *volatile *p, void *v)
+{
+#ifdef WIN32
+  InterlockedExchangePointer(p,v);
+#else
+  __atomic_store_n(p,v,__ATOMIC_RELEASE);
+#endif
+}
+
+/* Ritorna TRUE se *p valeva cmp ed e' stato sostituito da v */
+static SYS_INLINE int SysAtomicCASPtr(void *volatile *p, void *cmp, void *v)
+{
+#ifdef WIN32
+  return (InterlockedCompareExchangePointer(p,v,cmp)==cmp);
+#else
+  return __atomic_compare_exchange_n(p,&cmp,v,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Mutex statico creato al primo utilizzo: *state parte da 0; chi arriva */
+/* mentre un altro thread lo sta creando attende che abbia finito        */
+static SYS_INLINE void SysMutexInitOnce(SYS_MUTEX *m, SYS_ATOMIC *state)
+{
+  if (SysAtomicLoad(state)==2) return;
+  if (SysAtomicCAS(state,0,1)) {
+    SysMutexInit(m);
+    SysAtomicStore(state,2);
+  }
+  else while (SysAtomicLoad(state)!=2) SysSleep(1);
+}
+
+/* Spinlock inizializzabile staticamente a 0, per sezioni critiche brevi */
+typedef SYS_ATOMIC SYS_SPINLOCK;
+
+static SYS_INLINE void SysSpinLock(SYS_SPINLOCK *p)
+{
+  while (!SysAtomicCAS(p,0,1)) {
+#ifdef WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+  }
+}
+
+static SYS_INLINE void SysSpinUnlock(SYS_SPINLOCK *p)
+{
+  SysAtomicStore(p,0);
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // SYSDEP_H
@@ -0,0 +1,569 @@
+/*****************************************************************************
+              Traccia diagnostica asincrona della libreria
+*****************************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libsiaecardt.h"
+#include "libsiaecard.h"
+#include "sysdep.h"
+#include "tracelog.h"
+#if defined(WIN32) || defined(_WIN32)
+#	include <process.h>
+#	define getpid _getpid
+#	if defined(_MSC_VER) && (_MSC_VER<1900)
+#		define snprintf _snprintf
+#	endif
+#else
+#	include <sys/time.h>
+#endif
+
+/* Record nel buffer circolare: intestazione seguita dagli argomenti */
+/* (8 byte ciascuno, le stringhe come lunghezza e caratteri) o dal   */
+/* contenuto del buffer. Le lunghezze sono multiple di 8.            */
+#define TRACE_PAD     0
+#define TRACE_MSG     1
+#define TRACE_BUFFER  2
+
+typedef struct _TRACE_RECORD {
+  unsigned short size;
+  unsigned char type;
+  unsigned char reserved;
+  unsigned int len;
+  SYS_INT64 time;
+  union {
+    const char *sz;           /* formato o nome del buffer */
+    SYS_INT64 align;
+  } u;
+} TRACE_RECORD;
+
+#define ALIGN8(n) (((n)+7)&~(size_t)7)
+
+/* Buffer circolare di un thread: head avanza solo nel thread che lo */
+/* possiede, tail solo nel thread di scrittura                       */
+typedef struct _TRACE_RING {
+  struct _TRACE_RING *next;
+  SYS_ATOMIC owned;
+  SYS_ATOMIC head;
+  SYS_ATOMIC tail;
+  SYS_ATOMIC lost;
+  int id;
+  SYS_INT64 data[TRACE_RING_SIZE/8];
+} TRACE_RING;
+
+/* Stato della traccia */
+#define TRACE_UNINIT  0
+#define TRACE_INIT    1
+#define TRACE_ON      2
+#define TRACE_OFF     3          /* configurata, file e thread non attivi */
+#define TRACE_CLOSED  4          /* dopo l'uscita del processo */
+
+#define TRACE_LEVEL_UNSET 0x7fff
+
+volatile long traceLevel=TRACE_LEVEL_UNSET;
+static SYS_ATOMIC traceState=TRACE_UNINIT;
+static SYS_ATOMIC traceStop=0;
+static SYS_THREAD traceThread;
+static int traceThreadRunning=FALSE;
+static SYS_MUTEX traceWakeLock;        /* con traceWake, per svegliare il */
+static SYS_COND traceWake;             /* thread di scrittura             */
+static int traceKeyValid=FALSE;
+static int traceExitHook=FALSE;
+static SYS_ATOMIC traceRingCount=0;
+static TRACE_RING *volatile traceRings=NULL;
+static SYS_TLS traceKey;
+static SYS_SPINLOCK traceWriteLock=0;
+static FILE *traceFile=NULL;
+static char tracePath[260];
+static long traceMaxSize=TRACE_DEFAULT_SIZE;
+static SYS_INT64 traceBaseWallUs;      /* ora di TraceInit, in us dal 1970 */
+static SYS_INT64 traceBaseUs;          /* SysTimeUs() allo stesso istante  */
+static int tracePid;
+
+/* Tipi degli argomenti */
+#define ARG_NONE    0
+#define ARG_INT     1
+#define ARG_LONG    2
+#define ARG_INT64   3
+#define ARG_SIZE    4
+#define ARG_DOUBLE  5
+#define ARG_PTR     6
+#define ARG_STR     7
+
+/* Analizza la specifica di conversione che segue un '%': ritorna il */
+/* carattere successivo, in *pKind il tipo dell'argomento e in       */
+/* *pStars il numero di '*' (larghezza e precisione come argomenti)  */
+static const char *ParseSpec(const char *p, int *pKind, int *pStars)
+{
+  int l=0, z=0;
+  *pStars=0;
+  *pKind=ARG_NONE;
+  while ((*p!='\0')&&(strchr("-+ #0",*p)!=NULL)) p++;
+  for (; (*p=='*')||((*p>='0')&&(*p<='9'))||(*p=='.'); p++)
+    if (*p=='*') (*pStars)++;
+  for (; (*p!='\0')&&(strchr("hlLzjt",*p)!=NULL); p++) {
+    if (*p=='l') l++;
+    else if ((*p=='z')||(*p=='j')||(*p=='t')) z=1;
+  }
+  switch (*p) {
+  case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+    *pKind=(l>=2)?ARG_INT64:(l==1)?ARG_LONG:z?ARG_SIZE:ARG_INT;
+    break;
+  case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    *pKind=ARG_DOUBLE;
+    break;
+  case 'p':
+    *pKind=ARG_PTR;
+    break;
+  case 's':
+    *pKind=ARG_STR;
+    break;
+  }
+  if (*p!='\0') p++;
+  return p;
+}
+
+static SYS_TLS_DESTRUCTOR(ReleaseRing,pRing)
+{
+  /* il buffer resta nell'elenco: lo svuota il thread di scrittura e */
+  /* lo riutilizza il prossimo thread che ne ha bisogno              */
+  if (pRing!=NULL) SysAtomicStore(&((TRACE_RING*)pRing)->owned,0);
+}
+
+static TRACE_RING *ThreadRing()
+{
+  TRACE_RING *pRing=(TRACE_RING*)SysTlsGet(traceKey);
+  if (pRing!=NULL) return pRing;
+  for (pRing=(TRACE_RING*)SysAtomicLoadPtr((void *volatile *)&traceRings); pRing!=NULL; pRing=pRing->next)
+    if (SysAtomicCAS(&pRing->owned,0,1)) break;
+  if (pRing==NULL) {
+    pRing=(TRACE_RING*)calloc(1,sizeof(TRACE_RING));
+    if (pRing==NULL) return NULL;
+    pRing->owned=1;
+    pRing->id=(int)SysAtomicAdd(&traceRingCount,1);
+    do pRing->next=(TRACE_RING*)SysAtomicLoadPtr((void *volatile *)&traceRings);
+    while (!SysAtomicCASPtr((void *volatile *)&traceRings,pRing->next,pRing));
+  }
+  SysTlsSet(traceKey,pRing);
+  return pRing;
+}
+
+/* Copia il record nel buffer del thread; se non c'e' spazio lo scarta */
+static void RingPut(TRACE_RING *pRing, const TRACE_RECORD *pRec, const void *pData, size_t lData)
+{
+  unsigned long h=(unsigned long)pRing->head;
+  unsigned long t=(unsigned long)SysAtomicLoad(&pRing->tail);
+  unsigned long off=h%TRACE_RING_SIZE;
+  unsigned long contig=TRACE_RING_SIZE-off;
+  unsigned long need=pRec->size;
+  unsigned char *p;
+  if (contig<pRec->size) need+=contig;
+  if (TRACE_RING_SIZE-(h-t)<need) {
+    SysAtomicAdd(&pRing->lost,1);
+    return;
+  }
+  if (contig<pRec->size) {
+    /* il record non si divide: il resto del buffer viene saltato */
+    ((TRACE_RECORD*)((unsigned char*)pRing->data+off))->size=(unsigned short)contig;
+    ((TRACE_RECORD*)((unsigned char*)pRing->data+off))->type=TRACE_PAD;
+    h+=contig;
+    off=0;
+  }
+  p=(unsigned char*)pRing->data+off;
+  memcpy(p,pRec,sizeof(TRACE_RECORD));
+  if (lData>0) memcpy(p+sizeof(TRACE_RECORD),pData,lData);
+  SysAtomicStore(&pRing->head,(long)(h+pRec->size));
+}
+
+static void OpenTraceFile()
+{
+  traceFile=fopen(tracePath,"ab");
+  if (traceFile!=NULL) fseek(traceFile,0,SEEK_END);
+}
+
+/* Rinomina il file corrente in .1, il precedente .1 in .2, ... */
+static void RotateTraceFile()
+{
+  char from[280], to[280];
+  int i;
+  fclose(traceFile);
+  for (i=TRACE_FILES-1; i>0; i--) {
+    if (i>1) sprintf(from,"%s.%d",tracePath,i-1);
+    else strcpy(from,tracePath);
+    sprintf(to,"%s.%d",tracePath,i);
+    remove(to);
+    rename(from,to);
+  }
+  OpenTraceFile();
+}
+
+/* Ora corrente in microsecondi dal 1970 */
+static SYS_INT64 WallTimeUs()
+{
+#if defined(WIN32) || defined(_WIN32)
+  FILETIME ft;
+  ULARGE_INTEGER u;
+  GetSystemTimeAsFileTime(&ft);
+  u.LowPart=ft.dwLowDateTime;
+  u.HighPart=ft.dwHighDateTime;
+  /* intervalli di 100 ns dal 1601 */
+  return (SYS_INT64)(u.QuadPart/10)-(SYS_INT64)11644473600*1000000;
+#else
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return (SYS_INT64)tv.tv_sec*1000000+tv.tv_usec;
+#endif
+}
+
+static void WritePrefix(const TRACE_RECORD *pRec, int id)
+{
+  /* l'ora viene dal tempo monotono, riportato all'ora di TraceInit */
+  SYS_INT64 us=traceBaseWallUs+(pRec->time-traceBaseUs);
+  time_t t=(time_t)(us/1000000);
+  struct tm m;
+#if defined(WIN32) || defined(_WIN32)
+  localtime_s(&m,&t);
+#else
+  localtime_r(&t,&m);
+#endif
+  fprintf(traceFile,"[%04d, %02d:%02d:%02d.%06d, T%02d] ",tracePid,m.tm_hour,m.tm_min,m.tm_sec,
+          (int)(us%1000000),id);
+}
+
+/* Formatta un messaggio ripercorrendo il formato come TraceLog */
+static void FormatMessage(const TRACE_RECORD *pRec, char *line)
+{
+  const unsigned char *a=(const unsigned char*)(pRec+1);
+  const unsigned char *aEnd=a+pRec->len;
+  const char *f=pRec->u.sz, *start;
+  char spec[32], str[TRACE_MAX_STRING+1];
+  int n=0, k, kind, stars, s, w;
+  unsigned short l;
+
+  while ((*f!='\0')&&(n<TRACE_MAX_LINE-1)) {
+    if (*f!='%') {
+      line[n++]=*f++;
+      continue;
+    }
+    start=f;
+    f=ParseSpec(f+1,&kind,&stars);
+    if (kind==ARG_NONE) {
+      if (f[-1]=='%') line[n++]='%';
+      continue;
+    }
+    /* la specifica, con le '*' sostituite dai valori registrati */
+    for (s=0; (start<f)&&(s<(int)sizeof(spec)-12); start++) {
+      if ((*start=='*')&&(a<aEnd)) {
+        memcpy(&w,a,sizeof(int));
+        a+=8;
+        s+=sprintf(spec+s,"%d",w);
+      }
+      else spec[s++]=*start;
+    }
+    spec[s]='\0';
+    if (a>=aEnd) {
+      line[n++]='?';
+      continue;
+    }
+    switch (kind) {
+    case ARG_INT:    { int v;       memcpy(&v,a,sizeof(v)); k=snprintf(line+n,TRACE_MAX_LINE-n,spec,v); break; }
+    case ARG_LONG:   { long v;      memcpy(&v,a,sizeof(v)); k=snprintf(line+n,TRACE_MAX_LINE-n,spec,v); break; }
+    case ARG_INT64:  { SYS_INT64 v; memcpy(&v,a,sizeof(v)); k=snprintf(line+n,TRACE_MAX_LINE-n,spec,v); break; }
+    case ARG_SIZE:   { size_t v;    memcpy(&v,a,sizeof(v)); k=snprintf(line+n,TRACE_MAX_LINE-n,spec,v); break; }
+    case ARG_DOUBLE: { double v;    memcpy(&v,a,sizeof(v)); k=snprintf(line+n,TRACE_MAX_LINE-n,spec,v); break; }
+    case ARG_PTR:    { void *v;     memcpy(&v,a,sizeof(v)); k=snprintf(line+n,TRACE_MAX_LINE-n,spec,v); break; }
+    default:
+      memcpy(&l,a,sizeof(l));
+      memcpy(str,a+sizeof(l),l);
+      str[l]='\0';
+      k=snprintf(line+n,TRACE_MAX_LINE-n,spec,str);
+      a+=ALIGN8(sizeof(l)+l)-8;
+      break;
+    }
+    a+=8;
+    if ((k<0)||(k>=TRACE_MAX_LINE-n)) n=TRACE_MAX_LINE-1;
+    else n+=k;
+  }
+  line[n]='\0';
+}
+
+static void WriteRecord(const TRACE_RECORD *pRec, int id)
+{
+  static const char hex[]="0123456789ABCDEF";
+  char line[TRACE_MAX_LINE];
+  const unsigned char *p;
+  unsigned int i;
+
+  WritePrefix(pRec,id);
+  if (pRec->type==TRACE_MSG) {
+    FormatMessage(pRec,line);
+    fputs(line,traceFile);
+#ifdef _DEBUG
+    fputs(line,stderr);
+#endif
+    return;
+  }
+  fprintf(traceFile,"%s -> ",pRec->u.sz);
+  p=(const unsigned char*)(pRec+1);
+  for (i=0; i<pRec->len; i++) {
+    fputc(hex[p[i]>>4],traceFile);
+    fputc(hex[p[i]&0x0f],traceFile);
+  }
+  fputc('\n',traceFile);
+}
+
+/* Svuota i buffer di tutti i thread; con traceWriteLock */
+static void Drain()
+{
+  TRACE_RING *pRing;
+  TRACE_RECORD *pRec;
+  unsigned long h, t;
+  long lost;
+  int written=0;
+
+  if (traceFile==NULL) return;
+  for (pRing=(TRACE_RING*)SysAtomicLoadPtr((void *volatile *)&traceRings); pRing!=NULL; pRing=pRing->next) {
+    h=(unsigned long)SysAtomicLoad(&pRing->head);
+    t=(unsigned long)pRing->tail;
+    while (t!=h) {
+      pRec=(TRACE_RECORD*)((unsigned char*)pRing->data+t%TRACE_RING_SIZE);
+      if (pRec->type!=TRACE_PAD) {
+        WriteRecord(pRec,pRing->id);
+        written=1;
+      }
+      t+=pRec->size;
+    }
+    SysAtomicStore(&pRing->tail,(long)t);
+    lost=SysAtomicExchange(&pRing->lost,0);
+    if (lost>0) {
+      fprintf(traceFile,"[%04d, T%02d] %ld messaggi persi\n",tracePid,pRing->id,lost);
+      written=1;
+    }
+  }
+  if (!written) return;
+  fflush(traceFile);
+  if (ftell(traceFile)>=traceMaxSize) RotateTraceFile();
+}
+
+void TraceFlush()
+{
+  SysSpinLock(&traceWriteLock);
+  Drain();
+  SysSpinUnlock(&traceWriteLock);
+}
+
+static SYS_THREAD_PROC(TraceWriter,arg)
+{
+  SysMutexLock(&traceWakeLock);
+  while (!SysAtomicLoad(&traceStop)) {
+    SysMutexUnlock(&traceWakeLock);
+    TraceFlush();
+    SysMutexLock(&traceWakeLock);
+    if (!SysAtomicLoad(&traceStop))
+      SysCondTimedWait(&traceWake,&traceWakeLock,TRACE_FLUSH_MS);
+  }
+  SysMutexUnlock(&traceWakeLock);
+  return SYS_THREAD_RETURN;
+}
+
+/* All'uscita del processo o allo scaricamento della libreria il thread */
+/* di scrittura viene fermato e atteso, poi i messaggi in attesa        */
+/* vengono scritti dal thread che termina                               */
+static void TraceShutdown()
+{
+  SysAtomicStore(&traceLevel,TRACE_LEVEL_OFF);
+  SysAtomicStore(&traceState,TRACE_CLOSED);
+  if (traceThreadRunning) {
+    SysMutexLock(&traceWakeLock);
+    SysAtomicStore(&traceStop,1);
+    SysCondBroadcast(&traceWake);
+    SysMutexUnlock(&traceWakeLock);
+    SysThreadJoin(traceThread);
+    traceThreadRunning=FALSE;
+  }
+  SysSpinLock(&traceWriteLock);
+  Drain();
+  if (traceFile!=NULL) fclose(traceFile);
+  traceFile=NULL;
+  SysSpinUnlock(&traceWriteLock);
+}
+
+/* Apre il file e avvia il thread di scrittura; va chiamata nello */
+/* stato TRACE_INIT                                               */
+static int TraceStart()
+{
+  OpenTraceFile();
+  if (traceFile==NULL) return FALSE;
+  if (!traceKeyValid) traceKeyValid=SysTlsCreate(&traceKey,ReleaseRing);
+  if (traceKeyValid&&SysThreadCreate(&traceThread,TraceWriter,NULL)) {
+    traceThreadRunning=TRUE;
+    if (!traceExitHook) atexit(TraceShutdown);
+    traceExitHook=TRUE;
+    return TRUE;
+  }
+  fclose(traceFile);
+  traceFile=NULL;
+  return FALSE;
+}
+
+static int ParseLevel(const char *s)
+{
+  static const char *names[]={"off","error","info","apdu"};
+  int i;
+  if ((s==NULL)||(*s=='\0')) return TRACE_LEVEL_APDU;
+  if ((s[0]>='0')&&(s[0]<='9'))
+    return (atoi(s)>TRACE_LEVEL_APDU)?TRACE_LEVEL_APDU:atoi(s);
+  for (i=TRACE_LEVEL_OFF; i<=TRACE_LEVEL_APDU; i++)
+    if (strcmp(s,names[i])==0) return i;
+  return TRACE_LEVEL_APDU;
+}
+
+static void TraceInit()
+{
+  const char *env;
+  long level;
+
+  if (!SysAtomicCAS(&traceState,TRACE_UNINIT,TRACE_INIT)) {
+    while (SysAtomicLoad(&traceState)==TRACE_INIT) SysSleep(1);
+    return;
+  }
+  env=getenv("LIBSIAE_LOG_FILE");
+  if ((env!=NULL)&&(*env!='\0')&&(strlen(env)<sizeof(tracePath)))
+    strcpy(tracePath,env);
+  else {
+#if defined(WIN32) || defined(_WIN32)
+    char szSysPath[MAX_PATH];
+    GetSystemDirectoryA(szSysPath, sizeof(szSysPath));
+    sprintf(tracePath, "%c:/libsiaelog/libsiae.log", szSysPath[0]);
+#else
+    strcpy(tracePath, "/libsiaelog/libsiae.log");
+#endif
+  }
+  env=getenv("LIBSIAE_LOG_SIZE");
+  if ((env!=NULL)&&(atol(env)>0)) traceMaxSize=atol(env);
+  tracePid=(int)getpid();
+  SysMutexInit(&traceWakeLock);
+  SysCondInit(&traceWake);
+  traceBaseWallUs=WallTimeUs();
+  traceBaseUs=SysTimeUs();
+
+  /* con il livello off il file non viene nemmeno aperto */
+  level=ParseLevel(getenv("LIBSIAE_LOG_LEVEL"));
+  if ((level==TRACE_LEVEL_OFF)||!TraceStart()) level=TRACE_LEVEL_OFF;
+  SysAtomicStore(&traceLevel,level);
+  SysAtomicStore(&traceState,(level==TRACE_LEVEL_OFF)?TRACE_OFF:TRACE_ON);
+}
+
+static SYS_INLINE int TraceEnabled(int nLevel)
+{
+  if (SysAtomicLoad(&traceState)==TRACE_UNINIT) TraceInit();
+  return (nLevel<=traceLevel)&&(SysAtomicLoad(&traceState)==TRACE_ON);
+}
+
+int CALLINGCONV SetTraceLevel(int nLevel)
+{
+  long state;
+  if ((nLevel<TRACE_LEVEL_OFF)||(nLevel>TRACE_LEVEL_APDU)) return C_GENERIC_ERROR;
+  if (SysAtomicLoad(&traceState)==TRACE_UNINIT) TraceInit();
+  if (nLevel>TRACE_LEVEL_OFF) {
+    /* traccia spenta all'avvio o file non disponibile: si riprova */
+    if (SysAtomicCAS(&traceState,TRACE_OFF,TRACE_INIT)) {
+      state=TraceStart()?TRACE_ON:TRACE_OFF;
+      SysAtomicStore(&traceState,state);
+    }
+    else
+      while ((state=SysAtomicLoad(&traceState))==TRACE_INIT) SysSleep(1);
+    if (state!=TRACE_ON) return C_GENERIC_ERROR;
+  }
+  SysAtomicStore(&traceLevel,nLevel);
+  return C_OK;
+}
+
+int CALLINGCONV GetTraceLevel()
+{
+  if (SysAtomicLoad(&traceState)==TRACE_UNINIT) TraceInit();
+  return (int)SysAtomicLoad(&traceLevel);
+}
+
+void TraceLog(int nLevel, const char *szFormat, ...)
+{
+  SYS_INT64 rec[TRACE_MAX_RECORD/8];
+  TRACE_RECORD *pRec=(TRACE_RECORD*)rec;
+  TRACE_RING *pRing;
+  unsigned char *p=(unsigned char*)(pRec+1);
+  unsigned char *end=(unsigned char*)rec+sizeof(rec);
+  const char *f, *s;
+  int kind, stars, i;
+  size_t l;
+  va_list va;
+
+  if (!TraceEnabled(nLevel)) return;
+  pRing=ThreadRing();
+  if (pRing==NULL) return;
+
+  va_start(va,szFormat);
+  for (f=szFormat; *f!='\0'; ) {
+    if (*f++!='%') continue;
+    f=ParseSpec(f,&kind,&stars);
+    for (i=0; i<stars; i++) {
+      int w=va_arg(va,int);
+      if (p+8>end) goto Full;
+      memcpy(p,&w,sizeof(w));
+      p+=8;
+    }
+    if (kind==ARG_NONE) continue;
+    if (p+8>end) goto Full;
+    switch (kind) {
+    case ARG_INT:    { int v=va_arg(va,int);             memcpy(p,&v,sizeof(v)); break; }
+    case ARG_LONG:   { long v=va_arg(va,long);           memcpy(p,&v,sizeof(v)); break; }
+    case ARG_INT64:  { SYS_INT64 v=va_arg(va,SYS_INT64); memcpy(p,&v,sizeof(v)); break; }
+    case ARG_SIZE:   { size_t v=va_arg(va,size_t);       memcpy(p,&v,sizeof(v)); break; }
+    case ARG_DOUBLE: { double v=va_arg(va,double);       memcpy(p,&v,sizeof(v)); break; }
+    case ARG_PTR:    { void *v=va_arg(va,void*);         memcpy(p,&v,sizeof(v)); break; }
+    default:
+    {
+      unsigned short ls;
+      s=va_arg(va,const char*);
+      if (s==NULL) s="(null)";
+      for (l=0; (l<TRACE_MAX_STRING)&&(s[l]!='\0'); l++);
+      if (p+ALIGN8(sizeof(ls)+l)>end) l=end-p-sizeof(ls);
+      ls=(unsigned short)l;
+      memcpy(p,&ls,sizeof(ls));
+      memcpy(p+sizeof(ls),s,l);
+      p+=ALIGN8(sizeof(ls)+l)-8;
+      break;
+    }
+    }
+    p+=8;
+  }
+Full:
+  va_end(va);
+  pRec->type=TRACE_MSG;
+  pRec->reserved=0;
+  pRec->len=(unsigned int)(p-(unsigned char*)(pRec+1));
+  pRec->size=(unsigned short)ALIGN8(p-(unsigned char*)rec);
+  pRec->time=SysTimeUs();
+  pRec->u.sz=szFormat;
+  RingPut(pRing,pRec,pRec+1,pRec->len);
+}
+
+void TraceLogBuffer(int nLevel, const char *szName, const unsigned char *pBuff, size_t len)
+{
+  TRACE_RECORD rec;
+  TRACE_RING *pRing;
+
+  if (!TraceEnabled(nLevel)) return;
+  pRing=ThreadRing();
+  if (pRing==NULL) return;
+  if (len>TRACE_MAX_RECORD-sizeof(rec)) len=TRACE_MAX_RECORD-sizeof(rec);
+  rec.type=TRACE_BUFFER;
+  rec.reserved=0;
+  rec.len=(unsigned int)len;
+  rec.size=(unsigned short)ALIGN8(sizeof(rec)+len);
+  rec.time=SysTimeUs();
+  rec.u.sz=szName;
+  RingPut(pRing,&rec,pBuff,len);
+}
@@ -0,0 +1,79 @@
+#ifndef TRACELOG_H
+#define TRACELOG_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************
+  Traccia diagnostica della libreria (S_TRACE e S_TRACE_BUFFER).
+
+  Il thread chiamante non formatta e non scrive nulla: copia il puntatore
+  al formato, gli argomenti (le stringhe per valore) oppure il buffer
+  binario in un buffer circolare proprio, senza lock. Un thread di
+  scrittura svuota periodicamente i buffer di tutti i thread, formatta i
+  messaggi (anche l'esadecimale delle APDU) e li accoda al file di log,
+  aperto una sola volta e ruotato quando supera la dimensione massima.
+  Se il buffer di un thread e' pieno il messaggio viene scartato e il
+  numero dei messaggi persi compare nel log.
+
+  Il formato deve essere una stringa costante. Sono gestite le specifiche
+  di printf per interi (anche l, ll, h, z), double, puntatori e stringhe.
+
+  I messaggi hanno un livello (errori, chiamate, APDU). Quelli di livello
+  superiore a LIBSIAE_TRACE_LEVEL non vengono compilati; gli altri costano,
+  se disattivati, un solo confronto con il livello corrente, impostato con
+  SetTraceLevel o con la variabile d'ambiente LIBSIAE_LOG_LEVEL.
+
+  La traccia e' attiva se il livello non e' off e il file di log si puo'
+  aprire:
+    LIBSIAE_LOG_LEVEL  off, error, info o apdu (oppure da 0 a 3);
+                       predefinito apdu
+    LIBSIAE_LOG_FILE   percorso del file (predefinito /libsiaelog/libsiae.log,
+                       su Windows <unita' di sistema>:/libsiaelog/libsiae.log)
+    LIBSIAE_LOG_SIZE   dimensione in byte oltre la quale il file viene
+                       rinominato in .1 (e il precedente .1 in .2)
+*****************************************************************************/
+
+#define TRACE_LEVEL_OFF     0
+#define TRACE_LEVEL_ERROR   1          /* errori della carta o di PC/SC */
+#define TRACE_LEVEL_INFO    2          /* chiamate della libreria */
+#define TRACE_LEVEL_APDU    3          /* anche le APDU scambiate */
+
+/* Livello massimo compilato: -DLIBSIAE_TRACE_LEVEL=0 elimina la traccia */
+#ifndef LIBSIAE_TRACE_LEVEL
+#define LIBSIAE_TRACE_LEVEL TRACE_LEVEL_APDU
+#endif
+
+#define TRACE_RING_SIZE     131072     /* buffer circolare di ogni thread */
+#define TRACE_MAX_RECORD    2048       /* messaggio o buffer piu' grande  */
+#define TRACE_MAX_STRING    256        /* stringa piu' lunga tra gli argomenti */
+#define TRACE_MAX_LINE      1024
+#define TRACE_FLUSH_MS      10         /* intervallo del thread di scrittura */
+#define TRACE_DEFAULT_SIZE  (16*1024*1024)
+#define TRACE_FILES         3          /* file corrente e due rotazioni */
+
+/* Livello corrente; finche' la traccia non e' configurata vale piu' di */
+/* ogni livello, cosi' il primo messaggio legge la configurazione        */
+extern volatile long traceLevel;
+
+#define TRACE_ENABLED(lvl) (((lvl)<=LIBSIAE_TRACE_LEVEL)&&((lvl)<=traceLevel))
+
+#define TRACE_AT(lvl,...) \
+  do { if (TRACE_ENABLED(lvl)) TraceLog((lvl),__VA_ARGS__); } while (0)
+#define TRACE_BUFFER_AT(lvl,name,buf,len) \
+  do { if (TRACE_ENABLED(lvl)) TraceLogBuffer((lvl),(name),(buf),(len)); } while (0)
+
+void TraceLog(int nLevel, const char *szFormat, ...);
+void TraceLogBuffer(int nLevel, const char *szName, const unsigned char *pBuff, size_t len);
+
+/* Scrive subito nel file i messaggi in attesa */
+void TraceFlush();
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // TRACELOG_H
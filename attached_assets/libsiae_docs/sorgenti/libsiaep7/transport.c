@@ -0,0 +1,124 @@
+/*****************************************************************************
+        Registro dei trasporti e trasporto predefinito PC/SC
+*****************************************************************************/
+
+#include <string.h>
+#include "transport.h"
+#include "cardemu.h"
+#include "replay.h"
+#include "internals.h"
+#include "sysdep.h"
+
+/* Trasporto PC/SC: chiamate dirette a winscard */
+
+static LONG PcscEstablishContext(SIAE_TRANSPORT *t, SCARDCONTEXT *phContext)
+{
+  return SCardEstablishContext(SCARD_SCOPE_USER,NULL,NULL,phContext);
+}
+
+static LONG PcscReleaseContext(SIAE_TRANSPORT *t, SCARDCONTEXT hContext)
+{
+  return SCardReleaseContext(hContext);
+}
+
+static LONG PcscListReaders(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPSTR mszReaders, LPDWORD pcchReaders)
+{
+  return SCardListReaders(hContext,NULL,mszReaders,pcchReaders);
+}
+
+static LONG PcscGetStatusChange(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, DWORD dwTimeout, SCARD_READERSTATE *rgReaderStates, DWORD cReaders)
+{
+  return SCardGetStatusChange(hContext,dwTimeout,rgReaderStates,cReaders);
+}
+
+static LONG PcscCancel(SIAE_TRANSPORT *t, SCARDCONTEXT hContext)
+{
+  return SCardCancel(hContext);
+}
+
+static LONG PcscConnect(SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPCSTR szReader, SCARDHANDLE *phCard)
+{
+  DWORD dwAP=0;
+  return SCardConnect(hContext,szReader,SCARD_SHARE_SHARED,SCARD_PROTOCOL_T1,phCard,&dwAP);
+}
+
+static LONG PcscReconnect(SIAE_TRANSPORT *t, SCARDHANDLE hCard)
+{
+  DWORD dwProto=0;
+  return SCardReconnect(hCard,SCARD_SHARE_SHARED,SCARD_PROTOCOL_T1,SCARD_LEAVE_CARD,&dwProto);
+}
+
+static LONG PcscDisconnect(SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition)
+{
+  return SCardDisconnect(hCard,dwDisposition);
+}
+
+static LONG PcscBeginTransaction(SIAE_TRANSPORT *t, SCARDHANDLE hCard)
+{
+  return SCardBeginTransaction(hCard);
+}
+
+static LONG PcscEndTransaction(SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition)
+{
+  return SCardEndTransaction(hCard,dwDisposition);
+}
+
+static LONG PcscTransmit(SIAE_TRANSPORT *t, SCARDHANDLE hCard, LPCBYTE pbSend, DWORD cbSend, LPBYTE pbRecv, LPDWORD pcbRecv)
+{
+  return SCardTransmit(hCard,SCARD_PCI_T1,pbSend,cbSend,NULL,pbRecv,pcbRecv);
+}
+
+static SIAE_TRANSPORT pcscTransport={
+  "pcsc", NULL,
+  PcscEstablishContext, PcscReleaseContext, PcscListReaders,
+  PcscGetStatusChange, PcscCancel,
+  PcscConnect, PcscReconnect, PcscDisconnect,
+  PcscBeginTransaction, PcscEndTransaction, PcscTransmit
+};
+
+/* Registro: la prima posizione e' sempre occupata dal trasporto PC/SC, */
+/* le successive inizialmente dall'emulatore della carta (cardemu.c) e */
+/* dalla riproduzione delle sessioni registrate (replay.c)              */
+static SIAE_TRANSPORT *transports[MAX_TRANSPORTS]={&pcscTransport,&emuTransport,&replayTransport};
+static SYS_SPINLOCK transportsLock=0;
+
+int CALLINGCONV RegisterTransport(SIAE_TRANSPORT *pTransport)
+{
+  int i, rv=C_GENERIC_ERROR;
+  if ((pTransport==NULL)||(pTransport->name[0]=='\0')) return C_GENERIC_ERROR;
+  if ((pTransport->EstablishContext==NULL)||(pTransport->ReleaseContext==NULL)||
+      (pTransport->ListReaders==NULL)||(pTransport->GetStatusChange==NULL)||
+      (pTransport->Cancel==NULL)||(pTransport->Connect==NULL)||
+      (pTransport->Reconnect==NULL)||(pTransport->Disconnect==NULL)||
+      (pTransport->BeginTransaction==NULL)||(pTransport->EndTransaction==NULL)||
+      (pTransport->Transmit==NULL)) return C_GENERIC_ERROR;
+  if (strcmp(pTransport->name,pcscTransport.name)==0) return C_ALREADY_EXISTS;
+
+  SysSpinLock(&transportsLock);
+  for (i=1; i<MAX_TRANSPORTS; i++)
+    if ((transports[i]!=NULL)&&(strcmp(transports[i]->name,pTransport->name)==0)) break;
+  if (i==MAX_TRANSPORTS)
+    for (i=1; (i<MAX_TRANSPORTS)&&(transports[i]!=NULL); i++);
+  if (i<MAX_TRANSPORTS) {
+    transports[i]=pTransport;
+    rv=C_OK;
+  }
+  SysSpinUnlock(&transportsLock);
+  S_TRACE("RegisterTransport: %s, rv=%d\n", pTransport->name, rv);
+  return rv;
+}
+
+SIAE_TRANSPORT *FindTransport(const char *szName)
+{
+  SIAE_TRANSPORT *t=NULL;
+  int i;
+  if ((szName==NULL)||(*szName=='\0')) return NULL;
+  SysSpinLock(&transportsLock);
+  for (i=0; i<MAX_TRANSPORTS; i++)
+    if ((transports[i]!=NULL)&&(strcmp(transports[i]->name,szName)==0)) {
+      t=transports[i];
+      break;
+    }
+  SysSpinUnlock(&transportsLock);
+  return t;
+}
@@ -0,0 +1,64 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "scardhal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************
+  Trasporto verso la carta. scardhal.c non chiama direttamente PC/SC ma le
+  funzioni del trasporto selezionato, che hanno la stessa semantica (e gli
+  stessi codici di errore SCARD_xxx) delle corrispondenti funzioni SCardXxx.
+  Il trasporto predefinito e' "pcsc"; "emu" e' l'emulatore software della
+  carta (cardemu.h), "replay" riproduce le sessioni registrate (replay.h).
+  Altri trasporti (proxy di rete, strumenti di prova) vanno registrati con
+  RegisterTransport e si selezionano con SelectTransport o con la variabile
+  d'ambiente LIBSIAE_TRANSPORT.
+  I valori SCARDCONTEXT e SCARDHANDLE sono opachi per la libreria: ogni
+  trasporto vi puo' memorizzare i propri identificativi, purche' diversi
+  da 0.
+*****************************************************************************/
+
+#define MAX_TRANSPORT_NAME  16
+#define MAX_TRANSPORTS      8
+
+typedef struct _SIAE_TRANSPORT {
+  char name[MAX_TRANSPORT_NAME];
+  void *pUserData;             /* a disposizione del trasporto */
+
+  /* contesto */
+  LONG (*EstablishContext)(struct _SIAE_TRANSPORT *t, SCARDCONTEXT *phContext);
+  LONG (*ReleaseContext)(struct _SIAE_TRANSPORT *t, SCARDCONTEXT hContext);
+  LONG (*ListReaders)(struct _SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPSTR mszReaders, LPDWORD pcchReaders);
+  LONG (*GetStatusChange)(struct _SIAE_TRANSPORT *t, SCARDCONTEXT hContext, DWORD dwTimeout, SCARD_READERSTATE *rgReaderStates, DWORD cReaders);
+  LONG (*Cancel)(struct _SIAE_TRANSPORT *t, SCARDCONTEXT hContext);
+
+  /* connessione con la carta (sempre condivisa, protocollo T=1) */
+  LONG (*Connect)(struct _SIAE_TRANSPORT *t, SCARDCONTEXT hContext, LPCSTR szReader, SCARDHANDLE *phCard);
+  LONG (*Reconnect)(struct _SIAE_TRANSPORT *t, SCARDHANDLE hCard);
+  LONG (*Disconnect)(struct _SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition);
+  LONG (*BeginTransaction)(struct _SIAE_TRANSPORT *t, SCARDHANDLE hCard);
+  LONG (*EndTransaction)(struct _SIAE_TRANSPORT *t, SCARDHANDLE hCard, DWORD dwDisposition);
+  LONG (*Transmit)(struct _SIAE_TRANSPORT *t, SCARDHANDLE hCard, LPCBYTE pbSend, DWORD cbSend, LPBYTE pbRecv, LPDWORD pcbRecv);
+} SIAE_TRANSPORT;
+
+/* Registra un trasporto; la struttura deve restare valida finche' la */
+/* libreria e' in uso. Un trasporto con lo stesso nome viene sostituito. */
+int CALLINGCONV RegisterTransport(SIAE_TRANSPORT *pTransport);
+
+/* Seleziona il trasporto da usare; possibile solo quando nessuno slot */
+/* e' inizializzato e il monitor delle carte non e' attivo.            */
+int CALLINGCONV SelectTransport(const char *szName);
+
+/* Uso interno: trasporto registrato con il nome indicato, NULL se */
+/* non esiste. "pcsc" e' sempre presente, "emu" e "replay" salvo     */
+/* sostituzione.                                                     */
+SIAE_TRANSPORT *FindTransport(const char *szName);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // TRANSPORT_H
@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include "utility.h"
+#include "probes.h"
 
 
 int MemWriteFile(const char* lpFileName, const unsigned char* lpbAddress, size_t dwNumberOfBytesWrite)
@@ -9,10 +10,14 @@ int MemWriteFile(const char* lpFileName, const unsigned char* lpbAddress, size_t
   FILE* f;
   f = fopen(lpFileName, "wb+");
 
-  if(!f) return FALSE;
+  if(!f) {
+    S_PROBE3(file__write, lpFileName, dwNumberOfBytesWrite, FALSE);
+    return FALSE;
+  }
   fwrite(lpbAddress, 1, dwNumberOfBytesWrite, f);
   fclose(f);
   f=NULL;
+  S_PROBE3(file__write, lpFileName, dwNumberOfBytesWrite, TRUE);
   return TRUE;
 }
 
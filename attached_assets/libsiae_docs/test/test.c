@@ -40,6 +40,7 @@ typedef int (CALLINGCONV_1 *t_ComputeSigilloEx)(BYTE *Data_Ora,DWORD Prezzo,BYTE
 typedef int (CALLINGCONV_1 *t_ComputeSigilloExML)(BYTE *Data_Ora,DWORD Prezzo,BYTE *mac,DWORD *cnt, int nSlot);
 typedef int (CALLINGCONV_1 *t_ComputeSigilloFast)(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt);
 typedef int (CALLINGCONV_1 *t_ComputeSigilloFastML)(BYTE *Data_Ora,DWORD Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt, int nSlot);
+typedef int (CALLINGCONV_1 *t_ComputeSigilloBatchML)(int nItems,BYTE *Data_Ora,DWORD *Prezzo,BYTE *SN,BYTE *mac,DWORD *cnt,int *status,int nSlot);
 
 #define CHECK_RESULT(RES, CLEANUP) if (RES != 0) goto CLEANUP;
 
@@ -107,6 +108,7 @@ int main(int argc, char* argv[])
     t_ComputeSigilloExML pComputeSigilloExML = NULL;
     t_ComputeSigilloFast pComputeSigilloFast = NULL;
     t_ComputeSigilloFastML pComputeSigilloFastML = NULL;
+    t_ComputeSigilloBatchML pComputeSigilloBatchML = NULL;
     
 	unsigned char Sha1Digest[] = {0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14, // struttura per OID sha1
 						 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
@@ -192,6 +194,7 @@ int main(int argc, char* argv[])
     pComputeSigilloExML = (t_ComputeSigilloExML)dyn_GetProcAddress(hLib, "ComputeSigilloExML");
     pComputeSigilloFast = (t_ComputeSigilloFast)dyn_GetProcAddress(hLib, "ComputeSigilloFast");
     pComputeSigilloFastML = (t_ComputeSigilloFastML)dyn_GetProcAddress(hLib, "ComputeSigilloFastML");
+    pComputeSigilloBatchML = (t_ComputeSigilloBatchML)dyn_GetProcAddress(hLib, "ComputeSigilloBatchML");
     
 	// libSIAEdll code sample:
 	printf("libSIAE test starting, slot:%d, pin:%s...\n", slot, pin);
@@ -251,6 +254,27 @@ int main(int argc, char* argv[])
             }
 			printf("**\npComputeSigilloFastML Sigillo/s: %.02f\n", cycles / ((clock()-s) / 1000.0) );
 
+			if (pComputeSigilloBatchML)
+			{
+				BYTE *bData_Ora = (BYTE*)calloc(cycles, 8);
+				BYTE *bSN = (BYTE*)calloc(cycles, 8);
+				BYTE *bMac = (BYTE*)calloc(cycles, 8);
+				DWORD *bPrezzo = (DWORD*)calloc(cycles, sizeof(DWORD));
+				DWORD *bCnt = (DWORD*)calloc(cycles, sizeof(DWORD));
+				int *bStatus = (int*)calloc(cycles, sizeof(int));
+				for (i=0; i<cycles; i++)
+				{
+					memcpy(bSN+i*8, SN, 8);
+					bPrezzo[i] = 10+i;
+				}
+				s = clock();
+				res = pComputeSigilloBatchML(cycles, bData_Ora, bPrezzo, bSN, bMac, bCnt, bStatus, slot);
+				printf("pComputeSigilloBatchML: 0x%08X, last cnt:0x%08X\n", res, bCnt[cycles-1]);
+				printf("**\npComputeSigilloBatchML Sigillo/s: %.02f\n", cycles / ((clock()-s) / 1000.0) );
+				free(bData_Ora); free(bSN); free(bMac); free(bPrezzo); free(bCnt); free(bStatus);
+				CHECK_RESULT(res, CleanUp1);
+			}
+
         }
 
 		exit(0);